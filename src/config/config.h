@@ -25,6 +25,7 @@
 
 class HttpRequest;
 class HttpResponse;
+class StaticFileCache;
 
 typedef enum {
     GET,
@@ -54,11 +55,29 @@ typedef struct {
     std::map<int, std::string> error_pages; // Status code to page path
     bool deny_all; // Access control
     std::map<std::string, std::string> cgi_params;
+    std::vector<std::string> cgi_environment; // Request independent cgi variables as NAME=value, built once
     std::pair<int, std::string> return_directive;
+    std::string fastcgi_pass; // FastCGI backend, unix:/path or host:port
+    size_t fastcgi_connections; // Max keep-alive connections to the backend
+    size_t cgi_workers_min; // Pre-forked interpreters kept alive, 0 and 0 disables the pool
+    size_t cgi_workers_max;
+    size_t cgi_worker_max_requests; // Requests until a worker is replaced, 0 for no limit
+    size_t cgi_worker_idle_timeout; // In seconds, idle workers above the minimum are stopped
+    size_t cgi_max_concurrent; // Cgi processes running at once for the location, 0 for no limit
+    size_t cgi_cache; // In seconds, how long GET responses of scripts are cached, 0 disables the cache
+    std::vector<std::string> cgi_cache_key; // Request headers that are part of the cache key
     std::function<HttpResponse(const std::shared_ptr<HttpRequest> &request)> internalHandler;
 // Redirects
 } RouteConfig;
 
+// where a request body goes once it is larger than client_body_buffer_size
+enum class SpillBackend {
+    DISK, // a temporary file next to the upload target or in the temp directory
+    MEMFD, // an anonymous memory file
+    TMPFS, // a temporary file in a configured directory
+    MMAP, // an anonymous memory file that is mapped and copied into without syscalls
+};
+
 typedef struct  {
     size_t client_header_timeout; // In seconds
     size_t client_max_header_size; // In bytes the max size of a single header
@@ -78,15 +97,35 @@ typedef struct {
     // Connection settings
     size_t client_body_timeout; // In seconds
     size_t client_max_body_size; // In bytes
+    size_t client_body_buffer_size; // In bytes, larger bodies are spilled
+    SpillBackend client_body_buffer; // Where spilled bodies are kept
+    std::string client_body_buffer_path; // Directory of the tmpfs backend
+    size_t client_body_buffer_max; // In bytes, larger or chunked bodies are spilled to disk, 0 for no limit
     size_t keepalive_timeout; // In seconds
     size_t cgi_timeout; // In seconds
     size_t keepalive_requests; // Max requests per connection
     bool internal_api; // Enable internal API
+    size_t static_cache_size; // In bytes, memory budget for cached static responses, 0 disables it
+    size_t static_cache_max_file_size; // In bytes, larger files are never cached
+    std::shared_ptr<StaticFileCache> staticCache;
+    bool gzip; // Compress matching responses on the fly
+    bool gzip_static; // Serve precompressed .br and .gz siblings of static files
+    int gzip_comp_level; // 1 (fastest) to 9 (smallest)
+    size_t gzip_min_length; // In bytes, smaller bodies are sent uncompressed
+    std::vector<std::string> gzip_types; // Mime types to compress, type/* matches a whole group
 } ServerConfig;
 
 typedef struct {
     ClientHeaderConfig headerConfig;
     size_t max_request_line_size;
+    size_t open_file_cache; // Max cached file lookups, 0 disables the cache
+    size_t open_file_cache_valid; // In seconds, until a cached lookup is checked again
+    size_t cgi_max_concurrent; // Cgi processes running at once over all servers, 0 for no limit
+    size_t cgi_queue_size; // Requests waiting for a cgi slot, more are answered with 503
+    size_t cgi_cache_size; // In bytes, memory and tmp file budget of the cgi cache
+    size_t memory_budget; // In bytes, buffered data of all connections, 0 for no limit
+    size_t thread_pool_size; // Threads for blocking file work, 0 runs it on the event loop
+    size_t autoindex_cache_size; // In bytes, memory of the cached directory listings, 0 disables the cache
 }HttpConfig;
 
 #endif //CONFIG_H
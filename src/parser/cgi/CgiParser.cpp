@@ -3,94 +3,125 @@
 //
 
 #include "CgiParser.h"
-#include <sstream>
 #include <algorithm>
-#include <filesystem>
-#include <unistd.h>
-#include <chrono>
 #include <cstring>
-#include <regex>
+#include <cstdint>
 #include <webserv.h>
-#include <sys/stat.h>
-#include <iostream>
 #include <common/Logger.h>
-#include <unistd.h>
-#include <fcntl.h>
 
 
 CgiParser::CgiParser()
     : state(CgiParseState::HEADERS) {
-    result.body = std::make_shared<SmartBuffer>();
+    result.body = std::make_shared<SmartBuffer>(static_cast<size_t>(CGI_BODY_MEMORY_SIZE));
     contentLength = -1;
 }
 
 bool CgiParser::parse(const char *data, const size_t length) {
-    if (state == CgiParseState::COMPLETE || state == CgiParseState::ERROR)
-        return false;
+    if (state == CgiParseState::BODY) {
+        appendToBody(data, length);
+        return true;
+    }
+    if (state != CgiParseState::HEADERS)
+        return hasHeaders();
 
     buffer.append(data, length);
+    while (state == CgiParseState::HEADERS) {
+        const size_t lineEnd = buffer.find('\n', lineStart);
+        if (lineEnd == std::string::npos)
+            break;
+
+        size_t end = lineEnd;
+        if (end > lineStart && buffer[end - 1] == '\r')
+            end--;
+
+        if (end == lineStart) {
+            const auto it = result.headers.find("Content-Length");
+            if (it != result.headers.end() && !it->second.empty() &&
+                it->second.find_first_not_of("0123456789") == std::string::npos)
+                contentLength = std::stol(it->second);
 
-    if (state == CgiParseState::HEADERS) {
-        if (!parseHeaders())
-            return false;
-        state = CgiParseState::BODY;
-    }
+            setState(CgiParseState::BODY);
+            appendToBody(buffer.data() + lineEnd + 1, buffer.size() - lineEnd - 1);
+            buffer.clear();
+            lineStart = 0;
+            break;
+        }
 
-    if (state == CgiParseState::BODY) {
-        if (!appendToBody(buffer))
-            return false;
-        state = CgiParseState::COMPLETE;
+        parseHeaderLine(buffer.data() + lineStart, end - lineStart);
+        lineStart = lineEnd + 1;
     }
 
-    return isComplete();
+    if (state == CgiParseState::HEADERS && buffer.size() > CGI_MAX_HEADER_SIZE) {
+        Logger::log(LogLevel::ERROR, "CGI headers are larger than " + std::to_string(CGI_MAX_HEADER_SIZE) + " bytes");
+        setState(CgiParseState::ERROR);
+    }
+    return hasHeaders();
 }
 
-bool CgiParser::parseHeaders() {
-    std::istringstream stream(buffer);
-    std::string line;
-    size_t pos = 0;
-    std::regex headerRegex(R"(([^:]+):\s*(.*?)\s*$)");
-    std::smatch matches;
-
-    while (std::getline(stream, line)) {
-        pos += line.size() + 1;
+void CgiParser::finish() {
+    if (state == CgiParseState::HEADERS)
+        setState(CgiParseState::ERROR);
+    else if (state == CgiParseState::BODY)
+        setState(CgiParseState::COMPLETE);
+}
 
-        if (!line.empty() && line.back() == '\r')
-            line.pop_back();
+void CgiParser::copyBody(const size_t limit) {
+    bodyCopyLimit = limit;
+    bodyCopyComplete = true;
+}
 
-        if (line.empty()) {
-            buffer.erase(0, pos);
-            auto it = result.headers.find("Content-Length");
-            if (it != result.headers.end()) {
-                contentLength = std::stol(it->second);
-            }
-            return true;
-        }
+void CgiParser::skipBody(const size_t length) {
+    bodyCopyComplete = false;
+    bodyCopy.clear();
+    bodyLength += length;
+    if (contentLength != -1 && bodyLength >= static_cast<size_t>(contentLength))
+        setState(CgiParseState::COMPLETE);
+}
 
+size_t CgiParser::getRemainingBody() const {
+    if (contentLength == -1)
+        return SIZE_MAX;
+    return static_cast<size_t>(contentLength) - std::min(bodyLength, static_cast<size_t>(contentLength));
+}
 
-        if (std::regex_match(line, matches, headerRegex)) {
-            if (matches[1] == "Set-Cookie") {
-                result.setCookies.push_back(matches[2]);
-            } else
-                result.headers[matches[1]] = matches[2];
-        }
-    }
-    return false;
+void CgiParser::parseHeaderLine(const char *line, const size_t length) {
+    const char *colon = static_cast<const char *>(std::memchr(line, ':', length));
+    if (!colon || colon == line)
+        return;
+
+    const std::string name(line, colon - line);
+    const char *valueStart = colon + 1;
+    const char *valueEnd = line + length;
+    while (valueStart < valueEnd && (*valueStart == ' ' || *valueStart == '\t'))
+        valueStart++;
+    while (valueEnd > valueStart && (valueEnd[-1] == ' ' || valueEnd[-1] == '\t'))
+        valueEnd--;
+
+    if (name == "Set-Cookie")
+        result.setCookies.emplace_back(valueStart, valueEnd);
+    else
+        result.headers[name].assign(valueStart, valueEnd);
 }
 
-bool CgiParser::appendToBody(std::string data) {
-    const bool hasEnd = data.find("\r\n") != std::string::npos;
+void CgiParser::appendToBody(const char *data, size_t length) {
+    if (contentLength != -1)
+        length = std::min(length, static_cast<size_t>(contentLength) - bodyLength);
 
-    if (hasEnd)
-        data = data.substr(0, data.find("\r\n"));
+    result.body->append(data, length);
+    bodyLength += length;
 
-    result.body->append(data.c_str(), data.length());
+    if (bodyCopyComplete && bodyCopy.size() + length > bodyCopyLimit) {
+        bodyCopyComplete = false;
+        bodyCopy.clear();
+        bodyCopy.shrink_to_fit();
+    } else if (bodyCopyComplete)
+        bodyCopy.append(data, length);
 
-    if (contentLength != -1 && result.body->getSize() >= static_cast<size_t>(contentLength)) {
-        state = CgiParseState::COMPLETE;
-        return true;
-    }
+    if (contentLength != -1 && bodyLength >= static_cast<size_t>(contentLength))
+        setState(CgiParseState::COMPLETE);
+}
 
-    buffer.clear();
-    return hasEnd;
+void CgiParser::setState(const CgiParseState state) {
+    this->state = state;
+    result.body->setStreaming(state == CgiParseState::BODY);
 }
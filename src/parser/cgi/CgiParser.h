@@ -21,6 +21,7 @@ enum class CgiParseState {
     ERROR
 };
 
+// parses cgi output as it arrives, header lines are parsed once and the body is streamed into result.body
 class CgiParser {
 public:
     struct CgiResult {
@@ -32,20 +33,49 @@ public:
 private:
     CgiParseState state;
     std::string buffer;
+    // start of the first header line that was not parsed yet
+    size_t lineStart = 0;
     CgiResult result;
     ssize_t contentLength;
+    size_t bodyLength = 0;
+    // a copy of the body that outlives the streamed buffer, dropped once it grows over its limit
+    std::string bodyCopy;
+    size_t bodyCopyLimit = 0;
+    bool bodyCopyComplete = false;
 
-    bool parseHeaders();
+    void parseHeaderLine(const char *line, size_t length);
 
-    bool appendToBody(std::string data);
+    void appendToBody(const char *data, size_t length);
+
+    void setState(CgiParseState state);
 
 public:
     CgiParser();
 
+    // returns true once the headers are complete, the body can still be streaming afterwards
     bool parse(const char *data, size_t length);
 
+    // the script closed its output
+    void finish();
+
+    // body bytes that were passed on without going through the parser
+    void skipBody(size_t length);
+
+    // keeps a copy of up to limit body bytes next to the streamed body
+    void copyBody(size_t limit);
+
+    // nullptr if no copy was requested or the body did not fit
+    [[nodiscard]] const std::string *getBodyCopy() const { return bodyCopyComplete ? &bodyCopy : nullptr; }
+
+    // how much body is left before the Content-Length is reached, SIZE_MAX without one
+    [[nodiscard]] size_t getRemainingBody() const;
+
+    bool hasHeaders() const { return state == CgiParseState::BODY || state == CgiParseState::COMPLETE; }
     bool isComplete() const { return state == CgiParseState::COMPLETE; }
     bool hasError() const { return state == CgiParseState::ERROR; }
+    // the script promised a Content-Length and stopped early
+    bool isTruncated() const { return contentLength != -1 && bodyLength < static_cast<size_t>(contentLength); }
+    ssize_t getContentLength() const { return contentLength; }
     const CgiResult &getResult() const { return result; }
 };
 
@@ -32,10 +32,19 @@ int ConfigBlock::getIntValue(std::optional<Directive> directive, int defaultValu
 size_t ConfigBlock::getSizeValue(std::optional<Directive> directive, size_t defaultValue) const {
     if (!directive.has_value()) return defaultValue;
     const auto values = getDirective(directive->name);
-    double multiplier = 1;
-    std::string numberPart;
-    std::string suffixPart;
-    std::unordered_map<std::string, size_t> suffixes = {
+
+    if (values.empty()) return defaultValue;
+    if (directive->type == Directive::SIZE)
+        return parseSize(values[0]).value_or(defaultValue);
+    try {
+        return static_cast<size_t>(std::stod(values[0]));
+    } catch (...) {
+        return defaultValue;
+    }
+}
+
+std::optional<size_t> ConfigBlock::parseSize(const std::string &value) {
+    static const std::unordered_map<std::string, size_t> suffixes = {
         {"kb", 1024ULL},
         {"mb", 1024ULL * 1024},
         {"gb", 1024ULL * 1024 * 1024},
@@ -44,32 +53,27 @@ size_t ConfigBlock::getSizeValue(std::optional<Directive> directive, size_t defa
         {"b", 1}
     };
 
-    if (values.empty()) return defaultValue;
-    if (directive->type == Directive::SIZE) {
-        std::string str = values[0];
-        std::transform(str.begin(), str.end(), str.begin(), ::tolower);
+    std::string str = value;
+    std::transform(str.begin(), str.end(), str.begin(), ::tolower);
 
-        size_t i = 0;
-        while (i < str.size() && (std::isdigit(str[i]) || str[i] == '.'))
-            ++i;
+    size_t i = 0;
+    while (i < str.size() && (std::isdigit(str[i]) || str[i] == '.'))
+        ++i;
 
-        numberPart = str.substr(0, i);
-        suffixPart = str.substr(i);
-    } else {
-        numberPart = values[0];
-        suffixPart = "";
-    }
+    const std::string numberPart = str.substr(0, i);
+    const std::string suffixPart = str.substr(i);
+    double multiplier = 1;
     try {
-        double value = std::stod(numberPart);
+        double number = std::stod(numberPart);
         auto it = suffixes.find(suffixPart);
         if (it != suffixes.end()) {
             multiplier = it->second;
         } else if (!suffixPart.empty()) {
-            return defaultValue;
+            return std::nullopt;
         }
-        return static_cast<size_t>(value * multiplier);
+        return static_cast<size_t>(number * multiplier);
     } catch (...) {
-        return defaultValue;
+        return std::nullopt;
     }
 }
 
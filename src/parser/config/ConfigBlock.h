@@ -40,6 +40,9 @@ struct ConfigBlock {
 
     [[nodiscard]] size_t getSizeValue(std::optional<Directive> directive, size_t defaultValue = 0) const;
 
+    // parses a size with an optional kb, mb, gb, tb or b suffix
+    static std::optional<size_t> parseSize(const std::string &value);
+
     std::vector<ConfigBlock*> findBlocks(const std::string& blockName);
 };
 
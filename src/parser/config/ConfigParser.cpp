@@ -11,6 +11,7 @@
 #include <sys/unistd.h>
 #include <filesystem>
 #include <server/requestHandler/InternalApi.h>
+#include <server/cache/StaticFileCache.h>
 
 ConfigParser::ConfigParser() : rootBlock{"root", {}, {}}, currentLine(0), currentFilename(""), parseSuccessful(true) {
     httpDirectives = {
@@ -29,6 +30,38 @@ ConfigParser::ConfigParser() : rootBlock{"root", {}, {}}, currentLine(0), curren
         {
             .name = "max_request_line_size",
             .type = Directive::SIZE,
+        },
+        {
+            .name = "open_file_cache",
+            .type = Directive::COUNT,
+        },
+        {
+            .name = "open_file_cache_valid",
+            .type = Directive::TIME,
+        },
+        {
+            .name = "cgi_max_concurrent",
+            .type = Directive::COUNT,
+        },
+        {
+            .name = "cgi_queue_size",
+            .type = Directive::COUNT,
+        },
+        {
+            .name = "cgi_cache_size",
+            .type = Directive::SIZE,
+        },
+        {
+            .name = "memory_budget",
+            .type = Directive::SIZE,
+        },
+        {
+            .name = "thread_pool_size",
+            .type = Directive::COUNT,
+        },
+        {
+            .name = "autoindex_cache_size",
+            .type = Directive::SIZE,
         }
     };
 
@@ -62,6 +95,19 @@ ConfigParser::ConfigParser() : rootBlock{"root", {}, {}}, currentLine(0), curren
             .name = "client_body_timeout",
             .type = Directive::TIME,
         },
+        {
+            .name = "client_body_buffer_size",
+            .type = Directive::SIZE,
+        },
+        {
+            .name = "client_body_buffer",
+            .type = Directive::LIST,
+            .min_arg = 1,
+            .max_arg = 3,
+            .validate = [this](const std::vector<std::string> &tokens) {
+                return validateClientBodyBuffer(tokens);
+            },
+        },
         {
             .name = "cgi_timeout",
             .type = Directive::TIME,
@@ -98,6 +144,39 @@ ConfigParser::ConfigParser() : rootBlock{"root", {}, {}}, currentLine(0), curren
         {
             .name = "internal_api",
             .type = Directive::TOGGLE,
+        },
+        {
+            .name = "static_cache_size",
+            .type = Directive::SIZE,
+        },
+        {
+            .name = "static_cache_max_file_size",
+            .type = Directive::SIZE,
+        },
+        {
+            .name = "gzip",
+            .type = Directive::TOGGLE,
+        },
+        {
+            .name = "gzip_static",
+            .type = Directive::TOGGLE,
+        },
+        {
+            .name = "gzip_comp_level",
+            .type = Directive::COUNT,
+            .validate = [this](const std::vector<std::string> &tokens) {
+                return validateGzipCompLevel(tokens);
+            },
+        },
+        {
+            .name = "gzip_min_length",
+            .type = Directive::SIZE,
+        },
+        {
+            .name = "gzip_types",
+            .type = Directive::LIST,
+            .min_arg = 1,
+            .max_arg = 20,
         }
     };
 
@@ -145,6 +224,47 @@ ConfigParser::ConfigParser() : rootBlock{"root", {}, {}}, currentLine(0), curren
             .type = Directive::LIST,
             .min_arg = 2,
             .max_arg = 2,
+        },
+        {
+            .name = "fastcgi_pass",
+            .type = Directive::LIST,
+            .min_arg = 1,
+            .max_arg = 1,
+        },
+        {
+            .name = "fastcgi_connections",
+            .type = Directive::COUNT,
+        },
+        {
+            .name = "cgi_workers",
+            .type = Directive::LIST,
+            .min_arg = 2,
+            .max_arg = 2,
+            .validate = [this](const std::vector<std::string> &tokens) {
+                return validateCgiWorkers(tokens);
+            },
+        },
+        {
+            .name = "cgi_worker_max_requests",
+            .type = Directive::COUNT,
+        },
+        {
+            .name = "cgi_worker_idle_timeout",
+            .type = Directive::TIME,
+        },
+        {
+            .name = "cgi_max_concurrent",
+            .type = Directive::COUNT,
+        },
+        {
+            .name = "cgi_cache",
+            .type = Directive::TIME,
+        },
+        {
+            .name = "cgi_cache_key",
+            .type = Directive::LIST,
+            .min_arg = 1,
+            .max_arg = 10,
         }
     };
 }
@@ -301,10 +421,23 @@ void ConfigParser::printServerConfig(ServerConfig config)const {
     std::cout << "  Client Max Header Count: " << config.headerConfig.client_max_header_count << std::endl;
     std::cout << "  Client Header Timeout: " << config.headerConfig.client_header_timeout << std::endl;
     std::cout << "  Client Body Timeout: " << config.client_body_timeout << std::endl;
+    std::cout << "  Client Body Buffer Size: " << config.client_body_buffer_size << std::endl;
+    std::cout << "  Client Body Buffer: " << static_cast<int>(config.client_body_buffer) << " " <<
+            config.client_body_buffer_path << " " << config.client_body_buffer_max << std::endl;
     std::cout << "  Keepalive Timeout: " << config.keepalive_timeout << std::endl;
     std::cout << "  Keepalive Requests: " << config.keepalive_requests << std::endl;
     std::cout << "  cgi_timeout: " << config.cgi_timeout << std::endl;
     std::cout << "  Internal API: " << (config.internal_api ? "on" : "off") << std::endl;
+    std::cout << "  Static Cache Size: " << config.static_cache_size << std::endl;
+    std::cout << "  Static Cache Max File Size: " << config.static_cache_max_file_size << std::endl;
+    std::cout << "  Gzip: " << (config.gzip ? "on" : "off") << std::endl;
+    std::cout << "  Gzip Static: " << (config.gzip_static ? "on" : "off") << std::endl;
+    std::cout << "  Gzip Comp Level: " << config.gzip_comp_level << std::endl;
+    std::cout << "  Gzip Min Length: " << config.gzip_min_length << std::endl;
+    std::cout << "  Gzip Types: ";
+    for (const auto &type: config.gzip_types)
+        std::cout << type << " ";
+    std::cout << std::endl;
     std::cout << "  Error Pages: " << std::endl;
     for (const auto &errorPage: config.error_pages) {
         std::cout << "\t" << errorPage.first << ": " << errorPage.second << std::endl;
@@ -318,6 +451,18 @@ void ConfigParser::printServerConfig(ServerConfig config)const {
     std::cout << std::endl;
 }
 
+static std::optional<SpillBackend> getSpillBackend(const std::string &name) {
+    if (name == "disk")
+        return SpillBackend::DISK;
+    if (name == "memfd")
+        return SpillBackend::MEMFD;
+    if (name == "tmpfs")
+        return SpillBackend::TMPFS;
+    if (name == "mmap")
+        return SpillBackend::MMAP;
+    return std::nullopt;
+}
+
 ServerConfig ConfigParser::parseServerBlock(const ConfigBlock &block) const {
     ServerConfig config;
 
@@ -345,10 +490,33 @@ ServerConfig ConfigParser::parseServerBlock(const ConfigBlock &block) const {
     config.headerConfig.client_header_timeout = block.getSizeValue(getValidDirective("client_header_timeout", block.name), 60);
     config.headerConfig.client_max_header_count = block.getSizeValue(getValidDirective("client_max_header_count", block.name), 100);
     config.client_body_timeout = block.getSizeValue(getValidDirective("client_body_timeout", block.name), 60);
+    config.client_body_buffer_size = block.getSizeValue(getValidDirective("client_body_buffer_size", block.name), 40000);
+    config.client_body_buffer = SpillBackend::DISK;
+    config.client_body_buffer_max = 64 * 1024 * 1024;
+    const auto bodyBuffer = block.getDirective("client_body_buffer");
+    if (!bodyBuffer.empty()) {
+        config.client_body_buffer = getSpillBackend(bodyBuffer[0]).value_or(SpillBackend::DISK);
+        size_t next = 1;
+        if (config.client_body_buffer == SpillBackend::TMPFS && bodyBuffer.size() > next)
+            config.client_body_buffer_path = bodyBuffer[next++];
+        if (bodyBuffer.size() > next)
+            config.client_body_buffer_max = ConfigBlock::parseSize(bodyBuffer[next]).value_or(config.client_body_buffer_max);
+    }
     config.keepalive_timeout = block.getSizeValue(getValidDirective("keepalive_timeout", block.name), 65);
     config.keepalive_requests = block.getSizeValue(getValidDirective("keepalive_requests", block.name), 100);
     config.internal_api = (block.getStringValue(getValidDirective("internal_api", block.name), "off") == "on");
     config.cgi_timeout = block.getSizeValue(getValidDirective("cgi_timeout", block.name), 20);
+    config.static_cache_size = block.getSizeValue(getValidDirective("static_cache_size", block.name), 0);
+    config.static_cache_max_file_size = block.getSizeValue(getValidDirective("static_cache_max_file_size", block.name), 64 * 1024);
+    if (config.static_cache_size > 0)
+        config.staticCache = std::make_shared<StaticFileCache>(config.static_cache_size, config.static_cache_max_file_size);
+    config.gzip = (block.getStringValue(getValidDirective("gzip", block.name), "off") == "on");
+    config.gzip_static = (block.getStringValue(getValidDirective("gzip_static", block.name), "off") == "on");
+    config.gzip_comp_level = block.getIntValue(getValidDirective("gzip_comp_level", block.name), 1);
+    config.gzip_min_length = block.getSizeValue(getValidDirective("gzip_min_length", block.name), 1024);
+    config.gzip_types = block.getDirective("gzip_types");
+    if (config.gzip_types.empty())
+        config.gzip_types = {"text/*", "application/javascript", "application/json", "application/xml", "image/svg+xml"};
 
     const auto errorPages = block.getDirective("error_page");
     parseErrorPages(errorPages, config.error_pages);
@@ -375,6 +543,14 @@ void ConfigParser::printHttpConfig(HttpConfig httpConfig) const {
     std::cout << "  Client Header Timeout: " << httpConfig.headerConfig.client_header_timeout << std::endl;
     std::cout << "  Client Max Header Size: " << httpConfig.headerConfig.client_max_header_size << std::endl;
     std::cout << "  Client Max Header Count: " << httpConfig.headerConfig.client_max_header_count << std::endl;
+    std::cout << "  Open File Cache: " << httpConfig.open_file_cache << std::endl;
+    std::cout << "  Open File Cache Valid: " << httpConfig.open_file_cache_valid << std::endl;
+    std::cout << "  CGI Max Concurrent: " << httpConfig.cgi_max_concurrent << std::endl;
+    std::cout << "  CGI Queue Size: " << httpConfig.cgi_queue_size << std::endl;
+    std::cout << "  CGI Cache Size: " << httpConfig.cgi_cache_size << std::endl;
+    std::cout << "  Memory Budget: " << httpConfig.memory_budget << std::endl;
+    std::cout << "  Thread Pool Size: " << httpConfig.thread_pool_size << std::endl;
+    std::cout << "  Autoindex Cache Size: " << httpConfig.autoindex_cache_size << std::endl;
 
     std::cout << std::endl;
     std::cout << "----------------------------------------" << std::endl;
@@ -392,6 +568,14 @@ HttpConfig ConfigParser::parseHttpBlock(const ConfigBlock& block) const
 
     httpConfig.headerConfig = headerConfig;
     httpConfig.max_request_line_size = block.getSizeValue(getValidDirective("max_request_line_size", block.name), 1024);
+    httpConfig.open_file_cache = block.getSizeValue(getValidDirective("open_file_cache", block.name), 0);
+    httpConfig.open_file_cache_valid = block.getSizeValue(getValidDirective("open_file_cache_valid", block.name), 60);
+    httpConfig.cgi_max_concurrent = block.getSizeValue(getValidDirective("cgi_max_concurrent", block.name), 0);
+    httpConfig.cgi_queue_size = block.getSizeValue(getValidDirective("cgi_queue_size", block.name), 100);
+    httpConfig.cgi_cache_size = block.getSizeValue(getValidDirective("cgi_cache_size", block.name), 16 * 1024 * 1024);
+    httpConfig.memory_budget = block.getSizeValue(getValidDirective("memory_budget", block.name), 512 * 1024 * 1024);
+    httpConfig.thread_pool_size = block.getSizeValue(getValidDirective("thread_pool_size", block.name), 4);
+    httpConfig.autoindex_cache_size = block.getSizeValue(getValidDirective("autoindex_cache_size", block.name), 16 * 1024 * 1024);
 
 #ifdef DEBUG_MODE
     printHttpConfig(httpConfig);
@@ -447,12 +631,31 @@ RouteConfig ConfigParser::parseRouteBlock(const ConfigBlock &block, const Server
     const auto errorPages = block.getDirective("error_page");
     parseErrorPages(errorPages, route.error_pages);
 
-    auto cgiParams = block.findDirectivesByPrefix("cgi");
-    for (const auto &[key, values]: cgiParams) {
-        if (values.size() >= 2) {
-            route.cgi_params[values[0]] = values[1];
-        }
-    }
+    // only the cgi directive itself, cgi_workers or cgi_cache_key share its prefix
+    const auto cgi = block.getDirective("cgi");
+    if (cgi.size() >= 2)
+        route.cgi_params[cgi[0]] = cgi[1];
+
+    route.fastcgi_pass = block.getStringValue(getValidDirective("fastcgi_pass", block.name));
+    route.fastcgi_connections = block.getSizeValue(getValidDirective("fastcgi_connections", block.name), 8);
+
+    const auto cgiWorkers = block.getDirective("cgi_workers");
+    route.cgi_workers_min = cgiWorkers.size() == 2 ? std::stoul(cgiWorkers[0]) : 0;
+    route.cgi_workers_max = cgiWorkers.size() == 2 ? std::stoul(cgiWorkers[1]) : 0;
+    route.cgi_worker_max_requests = block.getSizeValue(getValidDirective("cgi_worker_max_requests", block.name), 500);
+    route.cgi_worker_idle_timeout = block.getSizeValue(getValidDirective("cgi_worker_idle_timeout", block.name), 60);
+    route.cgi_max_concurrent = block.getSizeValue(getValidDirective("cgi_max_concurrent", block.name), 0);
+    route.cgi_cache = block.getSizeValue(getValidDirective("cgi_cache", block.name), 0);
+    route.cgi_cache_key = block.getDirective("cgi_cache_key");
+
+    route.cgi_environment = {
+        "SERVER_PROTOCOL=HTTP/1.1",
+        "SERVER_SOFTWARE=Webserv/1.0",
+        "GATEWAY_INTERFACE=CGI/1.1",
+        "SERVER_NAME=" + serverConfig.host,
+        "SERVER_PORT=" + std::to_string(serverConfig.port),
+        "REDIRECT_STATUS=200",
+    };
 
     const auto returnDir = block.getDirective("return");
     if (returnDir.size() >= 2) {
@@ -500,6 +703,52 @@ bool ConfigParser::validateErrorPage(const std::vector<std::string> &tokens) {
     return true;
 }
 
+bool ConfigParser::validateCgiWorkers(const std::vector<std::string> &tokens) {
+    int minWorkers;
+    int maxWorkers;
+    if (!tryParseInt(tokens[0], minWorkers) || !tryParseInt(tokens[1], maxWorkers) || minWorkers < 0 ||
+        maxWorkers < 1 || minWorkers > maxWorkers) {
+        reportError("Invalid cgi_workers: " + tokens[0] + " " + tokens[1] + " - expected <min> <max> with min <= max");
+        return false;
+    }
+    return true;
+}
+
+bool ConfigParser::validateClientBodyBuffer(const std::vector<std::string> &tokens) {
+    const std::optional<SpillBackend> backend = getSpillBackend(tokens[0]);
+    if (!backend) {
+        reportError("Invalid client_body_buffer: " + tokens[0] + " - expected disk, memfd, mmap or tmpfs");
+        return false;
+    }
+
+    size_t next = 1;
+    if (*backend == SpillBackend::TMPFS) {
+        if (tokens.size() < 2 || !std::filesystem::is_directory(tokens[1])) {
+            reportError("Invalid client_body_buffer: tmpfs needs an existing directory");
+            return false;
+        }
+        next++;
+    }
+    if (*backend == SpillBackend::DISK && tokens.size() > 1) {
+        reportError("Invalid client_body_buffer: disk takes no arguments");
+        return false;
+    }
+    if (tokens.size() > next + 1 || (tokens.size() == next + 1 && !ConfigBlock::parseSize(tokens[next]))) {
+        reportError("Invalid client_body_buffer: expected client_body_buffer <backend> [directory] [max body size]");
+        return false;
+    }
+    return true;
+}
+
+bool ConfigParser::validateGzipCompLevel(const std::vector<std::string> &tokens) {
+    int level;
+    if (!tryParseInt(tokens[0], level) || level < 1 || level > 9) {
+        reportError("Invalid gzip_comp_level: " + tokens[0] + " - must be between 1 and 9");
+        return false;
+    }
+    return true;
+}
+
 bool ConfigParser::validateListenValue(const std::vector<std::string> &tokens) {
     if (tokens.size() != 1) {
         reportError("Invalid listen directive: " + tokens[0] + " - expected format: listen <port> or listen <host>:<port>");
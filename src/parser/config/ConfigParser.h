@@ -34,6 +34,9 @@ private:
     bool validateDigitsOnly(const std::string& value, const std::string& directive);
     bool validateErrorPage(const std::vector<std::string> &tokens);
     bool validateListenValue(const std::vector<std::string> &tokens);
+    bool validateGzipCompLevel(const std::vector<std::string> &tokens);
+    bool validateCgiWorkers(const std::vector<std::string> &tokens);
+    bool validateClientBodyBuffer(const std::vector<std::string> &tokens);
 
     [[nodiscard]] ServerConfig parseServerBlock(const ConfigBlock& block) const;
 
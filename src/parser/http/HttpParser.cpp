@@ -15,6 +15,8 @@
 #include <sys/stat.h>
 #include <cstring>
 #include <server/ServerPool.h>
+#include <server/requestHandler/RequestHandler.h>
+#include <server/handler/MetricHandler.h>
 
 ssize_t HttpParser::tmpFileCount = 0;
 
@@ -57,7 +59,12 @@ bool HttpParser::parse(const char *data, const size_t length) {
         return false;
 
     buffer.append(data, length);
+    const bool complete = parseBuffer();
+    MemoryBudget::update(MemoryCategory::PARSER, accountedBytes, buffer.size());
+    return complete;
+}
 
+bool HttpParser::parseBuffer() {
     bool needMoreData = false;
 
     while (!needMoreData) {
@@ -200,9 +207,30 @@ bool HttpParser::parseHeaders() {
                 return false;
             }
 
+            // the request is shed before its body is read, which is where most of the memory would go.
+            // the internal api stays reachable, so the pressure can still be observed
+            if (MemoryBudget::isExhausted() && !clientConnection->config.internal_api) {
+                Logger::log(LogLevel::WARNING, "Memory budget exhausted, rejecting request");
+                MetricHandler::incrementMetric("memory_shed_requests", 1);
+                errorCode = HttpResponse::StatusCode::SERVICE_UNAVAILABLE;
+                state = ParseState::ERROR;
+                return false;
+            }
+
             if (contentLength > 0 || chunkedTransfer) {
                 bodyStart = std::time(nullptr);
                 state = ParseState::BODY;
+                const ServerConfig &config = clientConnection->config;
+                request->body->setMaxMemorySize(config.client_body_buffer_size);
+                // bodies of unknown or large size are spilled to disk, memory backends only take what fits them
+                if (config.client_body_buffer != SpillBackend::DISK && !chunkedTransfer &&
+                    (config.client_body_buffer_max == 0 || contentLength <= config.client_body_buffer_max))
+                    request->body->setSpillBackend(config.client_body_buffer, config.client_body_buffer_path);
+                // a large upload is spilled next to its destination, so it can be moved there instead of copied
+                else if (request->method == PUT || request->method == POST) {
+                    const RequestHandler handler(clientConnection, request, clientConnection->config);
+                    request->body->setSpillDirectory(handler.getUploadDirectory());
+                }
             } else {
                 state = ParseState::COMPLETE;
             }
@@ -435,6 +463,7 @@ void HttpParser::reset() {
     request.reset();
     request = std::make_shared<HttpRequest>();
     buffer.clear();
+    MemoryBudget::update(MemoryCategory::PARSER, accountedBytes, 0);
     contentLength = 0;
     chunkedTransfer = false;
     headerStart = 0;
@@ -37,9 +37,13 @@ private:
 
     unsigned long chunkSize = 0;
     bool hasChunkSize = false;
+    // size of buffer reported to the memory budget
+    size_t accountedBytes = 0;
 
     bool parseChunkedBody();
 
+    bool parseBuffer();
+
 public:
     std::time_t headerStart = 0;
     std::time_t bodyStart = 0;
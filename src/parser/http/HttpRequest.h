@@ -25,6 +25,7 @@ public:
 
     HttpRequest() : method(GET) {
         body = std::make_shared<SmartBuffer>();
+        body->setMemoryCategory(MemoryCategory::REQUEST_BODY);
     }
 
 
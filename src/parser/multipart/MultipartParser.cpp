@@ -0,0 +1,282 @@
+//
+// Created by Emil Ebert on 18.10.26.
+//
+
+#include "MultipartParser.h"
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+#include <webserv.h>
+#include <common/Logger.h>
+
+MultipartParser::MultipartParser(const std::string &boundary): delimiter("\r\n--" + boundary) {
+    const size_t length = delimiter.size();
+    std::fill(std::begin(skipTable), std::end(skipTable), length);
+    for (size_t i = 0; i + 1 < length; i++)
+        skipTable[static_cast<unsigned char>(delimiter[i])] = length - 1 - i;
+}
+
+bool MultipartParser::parse(const char *data, const size_t length) {
+    size_t pos = 0;
+    while (pos < length) {
+        switch (state) {
+            case MultipartParseState::PREAMBLE:
+            case MultipartParseState::BODY:
+                pos += lookback.empty() ? parseBody(data + pos, length - pos) : parseLookback(data + pos, length - pos);
+                break;
+            case MultipartParseState::AFTER_DELIMITER:
+                pos += parseAfterDelimiter(data + pos, length - pos);
+                break;
+            case MultipartParseState::HEADERS:
+                pos += parseHeaders(data + pos, length - pos);
+                break;
+            // everything after the last boundary is an epilogue that is ignored
+            case MultipartParseState::COMPLETE:
+                return true;
+            case MultipartParseState::ERROR:
+                return false;
+        }
+    }
+    return state != MultipartParseState::ERROR;
+}
+
+size_t MultipartParser::findDelimiter(const char *data, const size_t length) const {
+    const size_t delimiterLength = delimiter.size();
+    size_t pos = 0;
+    while (pos + delimiterLength <= length) {
+        size_t i = delimiterLength - 1;
+        while (data[pos + i] == delimiter[i]) {
+            if (i == 0)
+                return pos;
+            i--;
+        }
+        pos += skipTable[static_cast<unsigned char>(data[pos + delimiterLength - 1])];
+    }
+    return std::string::npos;
+}
+
+// start of the shortest tail of data that is a prefix of the delimiter, or length if there is none
+size_t MultipartParser::findPartialDelimiter(const char *data, const size_t length) const {
+    const size_t delimiterLength = delimiter.size();
+    size_t pos = length >= delimiterLength ? length - delimiterLength + 1 : 0;
+    for (; pos < length; pos++) {
+        const void *start = std::memchr(data + pos, delimiter[0], length - pos);
+        if (!start)
+            return length;
+        pos = static_cast<const char *>(start) - data;
+        if (std::memcmp(data + pos, delimiter.data(), length - pos) == 0)
+            return pos;
+    }
+    return length;
+}
+
+size_t MultipartParser::parseBody(const char *data, const size_t length) {
+    const size_t delimiterPos = findDelimiter(data, length);
+    if (delimiterPos != std::string::npos) {
+        if (!emitData(data, delimiterPos) || !endPart())
+            return length;
+        state = MultipartParseState::AFTER_DELIMITER;
+        delimiterSuffix.clear();
+        return delimiterPos + delimiter.size();
+    }
+
+    const size_t tail = findPartialDelimiter(data, length);
+    if (!emitData(data, tail))
+        return length;
+    lookback.assign(data + tail, length - tail);
+    return length;
+}
+
+// the lookback is shorter than the delimiter, so a delimiter starting inside it ends in this chunk or is still partial
+size_t MultipartParser::parseLookback(const char *data, const size_t length) {
+    const size_t delimiterLength = delimiter.size();
+    for (size_t start = 0; start < lookback.size(); start++) {
+        const size_t inLookback = lookback.size() - start;
+        if (lookback.compare(start, inLookback, delimiter, 0, inLookback) != 0)
+            continue;
+
+        const size_t inData = std::min(length, delimiterLength - inLookback);
+        if (std::memcmp(data, delimiter.data() + inLookback, inData) != 0)
+            continue;
+
+        if (!emitData(lookback.data(), start))
+            return length;
+        if (inLookback + inData < delimiterLength) {
+            lookback.erase(0, start);
+            lookback.append(data, length);
+            return length;
+        }
+
+        lookback.clear();
+        if (!endPart())
+            return length;
+        state = MultipartParseState::AFTER_DELIMITER;
+        delimiterSuffix.clear();
+        return inData;
+    }
+
+    const bool emitted = emitData(lookback.data(), lookback.size());
+    lookback.clear();
+    return emitted ? 0 : length;
+}
+
+size_t MultipartParser::parseAfterDelimiter(const char *data, const size_t length) {
+    for (size_t i = 0; i < length; i++) {
+        // transport padding between the boundary and the line break
+        if (delimiterSuffix.empty() && (data[i] == ' ' || data[i] == '\t'))
+            continue;
+        delimiterSuffix += data[i];
+        if (delimiterSuffix.size() < 2)
+            continue;
+
+        if (delimiterSuffix == "--")
+            state = MultipartParseState::COMPLETE;
+        else if (delimiterSuffix == "\r\n") {
+            state = MultipartParseState::HEADERS;
+            headerBuffer.clear();
+        } else
+            fail("invalid characters after boundary");
+        return i + 1;
+    }
+    return length;
+}
+
+size_t MultipartParser::parseHeaders(const char *data, const size_t length) {
+    const size_t previousSize = headerBuffer.size();
+    const size_t searchStart = previousSize >= 3 ? previousSize - 3 : 0;
+    headerBuffer.append(data, std::min<size_t>(length, MULTIPART_MAX_HEADER_SIZE + 4 - previousSize));
+
+    size_t headersEnd = std::string::npos;
+    size_t separatorLength = 4;
+    if (headerBuffer.compare(0, 2, "\r\n") == 0) {
+        headersEnd = 0;
+        separatorLength = 2;
+    } else
+        headersEnd = headerBuffer.find("\r\n\r\n", searchStart);
+
+    if (headersEnd == std::string::npos) {
+        if (headerBuffer.size() > MULTIPART_MAX_HEADER_SIZE)
+            fail("part headers are too large");
+        return headerBuffer.size() - previousSize;
+    }
+
+    MultipartPart part;
+    if (!parsePartHeaders(headerBuffer.substr(0, headersEnd), part)) {
+        fail("invalid part headers");
+        return length;
+    }
+    headerBuffer.clear();
+
+    state = MultipartParseState::BODY;
+    inPart = true;
+    if (onPartBegin && !onPartBegin(part))
+        fail("part was rejected");
+    return headersEnd + separatorLength - previousSize;
+}
+
+bool MultipartParser::emitData(const char *data, const size_t length) {
+    if (length == 0 || state != MultipartParseState::BODY || !inPart || !onPartData)
+        return true;
+    if (onPartData(data, length))
+        return true;
+    fail("part data was rejected");
+    return false;
+}
+
+bool MultipartParser::endPart() {
+    if (!inPart)
+        return true;
+    inPart = false;
+    if (!onPartEnd || onPartEnd())
+        return true;
+    fail("part was rejected");
+    return false;
+}
+
+void MultipartParser::fail(const std::string &reason) {
+    Logger::log(LogLevel::WARNING, "Multipart parse error: " + reason);
+    state = MultipartParseState::ERROR;
+}
+
+static std::string toLower(std::string value) {
+    std::transform(value.begin(), value.end(), value.begin(), ::tolower);
+    return value;
+}
+
+static std::string trim(const std::string &value) {
+    const size_t start = value.find_first_not_of(" \t");
+    if (start == std::string::npos)
+        return "";
+    return value.substr(start, value.find_last_not_of(" \t") - start + 1);
+}
+
+// splits "type; key=value; key=\"quoted; value\"" into its parameters, the first entry is the value itself
+static std::vector<std::pair<std::string, std::string> > parseParameters(const std::string &header) {
+    std::vector<std::pair<std::string, std::string> > parameters;
+    size_t pos = 0;
+    while (pos <= header.size()) {
+        std::string name;
+        std::string value;
+        while (pos < header.size() && header[pos] != ';' && header[pos] != '=')
+            name += header[pos++];
+
+        if (pos < header.size() && header[pos] == '=') {
+            pos++;
+            while (pos < header.size() && (header[pos] == ' ' || header[pos] == '\t'))
+                pos++;
+            if (pos < header.size() && header[pos] == '"') {
+                for (pos++; pos < header.size() && header[pos] != '"'; pos++) {
+                    if (header[pos] == '\\' && pos + 1 < header.size())
+                        pos++;
+                    value += header[pos];
+                }
+                pos++;
+            }
+            while (pos < header.size() && header[pos] != ';')
+                value += header[pos++];
+        }
+        parameters.emplace_back(toLower(trim(name)), trim(value));
+        pos++;
+    }
+    return parameters;
+}
+
+bool MultipartParser::parsePartHeaders(const std::string &headers, MultipartPart &part) {
+    size_t lineStart = 0;
+    while (lineStart < headers.size()) {
+        size_t lineEnd = headers.find("\r\n", lineStart);
+        if (lineEnd == std::string::npos)
+            lineEnd = headers.size();
+
+        const std::string line = headers.substr(lineStart, lineEnd - lineStart);
+        lineStart = lineEnd + 2;
+        const size_t colon = line.find(':');
+        if (colon == std::string::npos || colon == 0)
+            return false;
+
+        const std::string name = toLower(trim(line.substr(0, colon)));
+        const std::string value = trim(line.substr(colon + 1));
+        if (name == "content-type")
+            part.contentType = value;
+        if (name != "content-disposition")
+            continue;
+
+        for (const auto &[key, parameter]: parseParameters(value)) {
+            if (key == "name")
+                part.name = parameter;
+            else if (key == "filename")
+                part.filename = parameter;
+        }
+    }
+    return true;
+}
+
+std::string MultipartParser::getBoundary(const std::string &contentType) {
+    for (const auto &[key, value]: parseParameters(contentType)) {
+        // boundaries are at most 70 characters long
+        if (key == "boundary" && !value.empty() && value.size() <= 70)
+            return value;
+    }
+    return "";
+}
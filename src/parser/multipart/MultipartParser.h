@@ -0,0 +1,83 @@
+//
+// Created by Emil Ebert on 18.10.26.
+//
+
+#ifndef MULTIPARTPARSER_H
+#define MULTIPARTPARSER_H
+
+#include <string>
+#include <functional>
+#include <sys/types.h>
+
+enum class MultipartParseState {
+    PREAMBLE,
+    BODY,
+    AFTER_DELIMITER,
+    HEADERS,
+    COMPLETE,
+    ERROR
+};
+
+struct MultipartPart {
+    std::string name;
+    std::string filename;
+    std::string contentType;
+};
+
+// streaming multipart/form-data parser. the delimiter is searched with a boyer-moore-horspool skip table
+// and part data is handed out as pointers into the fed chunks, only a delimiter prefix at the end of a chunk is kept
+class MultipartParser {
+public:
+    // returning false from a callback stops the parser with an error
+    std::function<bool(const MultipartPart &part)> onPartBegin;
+    std::function<bool(const char *data, size_t length)> onPartData;
+    std::function<bool()> onPartEnd;
+
+private:
+    MultipartParseState state = MultipartParseState::PREAMBLE;
+    // "\r\n--" + boundary, the first boundary is found by starting the lookback with "\r\n"
+    std::string delimiter;
+    size_t skipTable[256];
+    // end of the previous chunk that could be the start of a delimiter
+    std::string lookback = "\r\n";
+    std::string headerBuffer;
+    // bytes after the boundary that tell if it was the last one
+    std::string delimiterSuffix;
+    bool inPart = false;
+
+    size_t findDelimiter(const char *data, size_t length) const;
+
+    size_t findPartialDelimiter(const char *data, size_t length) const;
+
+    size_t parseBody(const char *data, size_t length);
+
+    size_t parseLookback(const char *data, size_t length);
+
+    size_t parseAfterDelimiter(const char *data, size_t length);
+
+    size_t parseHeaders(const char *data, size_t length);
+
+    bool emitData(const char *data, size_t length);
+
+    bool endPart();
+
+    void fail(const std::string &reason);
+
+public:
+    explicit MultipartParser(const std::string &boundary);
+
+    // feeds the next chunk of the body, returns false once the body is invalid
+    bool parse(const char *data, size_t length);
+
+    [[nodiscard]] MultipartParseState getState() const { return state; }
+    [[nodiscard]] bool isComplete() const { return state == MultipartParseState::COMPLETE; }
+    [[nodiscard]] bool hasError() const { return state == MultipartParseState::ERROR; }
+
+    // boundary parameter of a multipart content type, empty if there is none
+    static std::string getBoundary(const std::string &contentType);
+
+    static bool parsePartHeaders(const std::string &headers, MultipartPart &part);
+};
+
+
+#endif //MULTIPARTPARSER_H
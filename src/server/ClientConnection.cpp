@@ -22,7 +22,13 @@
 #include "ServerPool.h"
 #include "handler/MetricHandler.h"
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <netinet/in.h>
+#include <cerrno>
+#include <algorithm>
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
 
 
 ClientConnection::ClientConnection(const int clientFd,
@@ -117,7 +123,12 @@ void ClientConnection::handleInput() {
     }
 
     if (parser.hasError()) {
-        const HttpResponse response = HttpResponse::html(parser.getErrorCode());
+        HttpResponse response = HttpResponse::html(parser.getErrorCode());
+        // a shed request is answered without reading its body, so the connection can't be reused
+        if (parser.getErrorCode() == HttpResponse::StatusCode::SERVICE_UNAVAILABLE) {
+            response.setHeader("Retry-After", "1");
+            keepAlive = false;
+        }
         setResponse(RequestHandler::handleCustomErrorPage(response, config, std::nullopt));
         parser.reset();
         debugBuffer.clear();
@@ -128,17 +139,32 @@ void ClientConnection::handleOutput() {
     if (hasPendingResponse()) {
         lastPackageSend = 0;
         HttpResponse &response = getResponse().value();
-        if (response.getBody()->isStillWriting())
-            return;
         if (keepAlive)
             response.setHeader("Connection", "keep-alive");
         else
             response.setHeader("Connection", "close");
 
+        if (response.getPrerendered()) {
+            handlePrerenderedOutput();
+            return;
+        }
         handleFileOutput();
+        // the client took some of the body, so a paused producer may continue
+        if (requestHandler) {
+            requestHandler->resumeCgiOutput();
+            requestHandler->resumeAutoIndex();
+        }
     }
 }
 
+size_t ClientConnection::getBufferedBytes() const {
+    size_t bytes = parser.getBuffer().size() + parser.getRequest()->body->getMemoryUsage();
+    if (response && response->getBody())
+        bytes += response->getBody()->getMemoryUsage();
+    return bytes;
+}
+
+
 void ClientConnection::handleFileOutput() {
     if (!response.value().alreadySendHeader) {
         const std::string header = response.value().toHeaderString();
@@ -151,52 +177,232 @@ void ClientConnection::handleFileOutput() {
         }
         MetricHandler::incrementMetric("bytes_send", header.length());
         response.value().alreadySendHeader = true;
+        if (!response.value().hasBody())
+            completeResponse();
+        return;
+    }
+
+    if (response->getFileBody()) {
+        handleFileBodyOutput();
         return;
     }
 
 
     std::shared_ptr<SmartBuffer> body = response->getBody();
+    const std::shared_ptr<GzipEncoder> encoder = response->getEncoder();
     // TODO: fix magic number number should probably be higher
     body->read(4000);
 
-    const std::string readBuffer = body->getReadBuffer();
-
-    if (!readBuffer.empty()) {
-        std::stringstream chunkHeader;
-        chunkHeader << std::hex << readBuffer.length() << "\r\n";
-        const std::string chunkHeaderStr = chunkHeader.str();
-
-        std::string chunk;
-        chunk.append(chunkHeaderStr);
-        chunk.append(readBuffer);
-        chunk.append("\r\n");
-        if (chunkHeaderStr.empty()) {
-            Logger::log(LogLevel::ERROR, "Chunk header is empty, cannot send chunk");
-            clearResponse();
+    if (body->getReadBufferSize() > 0) {
+        iovec iov[BUFFER_MAX_IOVECS];
+        const size_t count = body->getReadIovecs(iov, BUFFER_MAX_IOVECS);
+
+        // a cgi script that sent a Content-Length gets its body forwarded as is
+        if (!response->isChunkedEncoding()) {
+            msghdr message{};
+            message.msg_iov = iov;
+            message.msg_iovlen = count;
+            const ssize_t bytesSent = sendmsg(fd, &message, MSG_NOSIGNAL);
+            if (bytesSent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                return;
+            if (bytesSent <= 0) {
+                Logger::log(LogLevel::ERROR, "Failed to write body to client");
+                clearResponse();
+                return;
+            }
+            MetricHandler::incrementMetric("bytes_send", bytesSent);
+            body->cleanReadBuffer(bytesSent);
             return;
         }
 
-        ssize_t bytesSent = send(fd, chunk.c_str(), chunk.length(), MSG_NOSIGNAL);
-        if (bytesSent != static_cast<ssize_t>(chunk.length())) {
-            Logger::log(LogLevel::ERROR, "Failed to write chunk header to client");
+        size_t length = 0;
+        for (size_t i = 0; i < count; i++)
+            length += iov[i].iov_len;
+
+        // deflate buffers internally, so a compressed chunk can be empty until enough input arrived.
+        // output of a producer like cgi is flushed with every chunk, it may take a while until the next one comes
+        if (encoder) {
+            std::string data;
+            for (size_t i = 0; i < count; i++)
+                data += encoder->compress(static_cast<const char *>(iov[i].iov_base), iov[i].iov_len,
+                                          body->isStreaming() && i == count - 1);
+            if (!data.empty() && !sendChunk(data)) {
+                clearResponse();
+                return;
+            }
+        } else if (!sendChunk(iov, count, length)) {
             clearResponse();
             return;
         }
 
-        body->cleanReadBuffer(bytesSent - chunkHeaderStr.length() - 2);
-        MetricHandler::incrementMetric("bytes_send", bytesSent);
+        body->cleanReadBuffer(length);
         return;
     }
 
+    // the producer has not written the rest of the body yet
+    if (body->isStreaming())
+        return;
 
     if (body->getReadPos() >= body->getSize()) {
+        if (!response->isChunkedEncoding()) {
+            completeResponse();
+            return;
+        }
+        if (encoder) {
+            const std::string data = encoder->finish();
+            if (!data.empty() && !sendChunk(data)) {
+                clearResponse();
+                return;
+            }
+            MetricHandler::incrementMetric("gzip_responses", 1);
+            if (encoder->getBytesIn() > encoder->getBytesOut())
+                MetricHandler::incrementMetric("gzip_bytes_saved", encoder->getBytesIn() - encoder->getBytesOut());
+        }
         if (send(fd, "0\r\n\r\n", 5, MSG_NOSIGNAL) <= 0)
             Logger::log(LogLevel::ERROR, "Failed to write final chunk to client");
-        lastPackageSend = std::time(nullptr);
-        MetricHandler::incrementMetric("responses", 1);
-        Logger::log(LogLevel::INFO, "Client response sent");
+        completeResponse();
+    }
+}
+
+bool ClientConnection::sendChunk(const std::string &data) {
+    iovec iov{const_cast<char *>(data.data()), data.size()};
+    return sendChunk(&iov, 1, data.size());
+}
+
+bool ClientConnection::sendChunk(const iovec *data, const size_t count, const size_t length) {
+    std::stringstream chunkHeader;
+    chunkHeader << std::hex << length << "\r\n";
+    const std::string header = chunkHeader.str();
+
+    // the chunk is sent with the data where it is, framed by its header and line break
+    iovec iov[BUFFER_MAX_IOVECS + 2];
+    iov[0] = {const_cast<char *>(header.data()), header.size()};
+    for (size_t i = 0; i < count; i++)
+        iov[i + 1] = data[i];
+    iov[count + 1] = {const_cast<char *>("\r\n"), 2};
+
+    msghdr message{};
+    message.msg_iov = iov;
+    message.msg_iovlen = count + 2;
+    const ssize_t bytesSent = sendmsg(fd, &message, MSG_NOSIGNAL);
+    if (bytesSent != static_cast<ssize_t>(header.size() + length + 2)) {
+        Logger::log(LogLevel::ERROR, "Failed to write chunk to client");
+        return false;
+    }
+
+    MetricHandler::incrementMetric("bytes_send", bytesSent);
+    return true;
+}
+
+void ClientConnection::handlePrerenderedOutput() {
+    HttpResponse &current = response.value();
+    const PrerenderedResponse &prerendered = *current.getPrerendered();
+
+    if (current.bytesSent == 0) {
+        current.prerenderedTail.clear();
+        for (const auto &[name, value]: current.getLateHeaders())
+            current.prerenderedTail += name + ": " + value + "\r\n";
+        current.prerenderedTail += "Connection: " + current.getHeader("Connection") + "\r\n";
+        for (const auto &cookie: current.getSetCookies())
+            current.prerenderedTail += "Set-Cookie: " + cookie + "\r\n";
+        current.prerenderedTail += "\r\n";
+        Logger::log(LogLevel::INFO, "status code: " + std::to_string(current.getStatus()));
+    }
+
+    static const std::string noBody;
+    const std::string *parts[] = {
+        &prerendered.head, &current.prerenderedTail, current.hasBody() ? &prerendered.body : &noBody
+    };
+    iovec iov[3];
+    int iovCount = 0;
+    size_t skip = current.bytesSent;
+    size_t total = 0;
+    for (const std::string *part: parts) {
+        total += part->size();
+        if (skip >= part->size()) {
+            skip -= part->size();
+            continue;
+        }
+        iov[iovCount].iov_base = const_cast<char *>(part->data() + skip);
+        iov[iovCount].iov_len = part->size() - skip;
+        iovCount++;
+        skip = 0;
+    }
+
+    msghdr message{};
+    message.msg_iov = iov;
+    message.msg_iovlen = iovCount;
+    const ssize_t bytesSent = iovCount > 0 ? sendmsg(fd, &message, MSG_NOSIGNAL) : 0;
+    if (bytesSent < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+            return;
+        Logger::log(LogLevel::ERROR, "Failed to write prerendered response to client");
         clearResponse();
+        return;
     }
+
+    current.bytesSent += bytesSent;
+    MetricHandler::incrementMetric("bytes_send", bytesSent);
+    if (current.bytesSent >= total)
+        completeResponse();
+}
+
+static ssize_t sendFileData(const int socketFd, const int fileFd, off_t offset, const size_t length) {
+#ifdef __linux__
+    return sendfile(socketFd, fileFd, &offset, length);
+#else
+    char buffer[16384];
+    const ssize_t bytesRead = pread(fileFd, buffer, std::min(length, sizeof(buffer)), offset);
+    if (bytesRead <= 0)
+        return bytesRead;
+    return send(socketFd, buffer, bytesRead, MSG_NOSIGNAL);
+#endif
+}
+
+void ClientConnection::handleFileBodyOutput() {
+    FileBody &file = *response->getFileBody();
+    if (file.segmentIndex >= file.segments.size()) {
+        completeResponse();
+        return;
+    }
+
+    const FileSegment &segment = file.segments[file.segmentIndex];
+    ssize_t bytesSent;
+    if (file.segmentSent < segment.prefix.size()) {
+        bytesSent = send(fd, segment.prefix.data() + file.segmentSent, segment.prefix.size() - file.segmentSent,
+                         MSG_NOSIGNAL);
+    } else {
+        // limited per poll round, so one large download can't starve the other clients
+        const size_t done = file.segmentSent - segment.prefix.size();
+        const size_t length = std::min(segment.length - done, static_cast<size_t>(FILE_BODY_SEND_SIZE));
+        bytesSent = sendFileData(fd, file.fd, segment.offset + static_cast<off_t>(done), length);
+    }
+
+    if (bytesSent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        return;
+    // the Content-Length was already sent, so a failed send or a file that shrank can only end the connection
+    if (bytesSent <= 0) {
+        Logger::log(LogLevel::ERROR, "Failed to send file body to client");
+        keepAlive = false;
+        clearResponse();
+        return;
+    }
+
+    file.segmentSent += bytesSent;
+    MetricHandler::incrementMetric("bytes_send", bytesSent);
+    if (file.segmentSent >= segment.prefix.size() + segment.length) {
+        file.segmentIndex++;
+        file.segmentSent = 0;
+    }
+    if (file.segmentIndex >= file.segments.size())
+        completeResponse();
+}
+
+void ClientConnection::completeResponse() {
+    lastPackageSend = std::time(nullptr);
+    MetricHandler::incrementMetric("responses", 1);
+    Logger::log(LogLevel::INFO, "Client response sent");
+    clearResponse();
 }
 
 
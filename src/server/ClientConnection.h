@@ -51,6 +51,16 @@ public:
 
     void handleFileOutput();
 
+    void handlePrerenderedOutput();
+
+    void handleFileBodyOutput();
+
+    bool sendChunk(const std::string &data);
+
+    bool sendChunk(const iovec *data, size_t count, size_t length);
+
+    void completeResponse();
+
     void setResponse(HttpResponse response);
 
     void clearResponse();
@@ -64,6 +74,10 @@ public:
     }
 
     void setConfig(const ServerConfig &config);
+
+    // bytes the connection holds in memory for its request and response
+    [[nodiscard]] size_t getBufferedBytes() const;
+
 };
 
 
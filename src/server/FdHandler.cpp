@@ -30,6 +30,29 @@ std::vector<pollfd>::iterator FdHandler::removeFd(const int fd) {
     return pollfds.end();
 }
 
+void FdHandler::setEvents(const int fd, const short events) {
+    for (auto &pfd: pollfds) {
+        if (pfd.fd == fd) {
+            pfd.events = events;
+            return;
+        }
+    }
+
+    // still waiting in the queue, so the events are applied once it gets polled
+    std::queue<pollfd> queued;
+    while (!fdQueue.empty()) {
+        pollfd pfd = fdQueue.front();
+        fdQueue.pop();
+        if (pfd.fd == fd)
+            pfd.events = events;
+        queued.push(pfd);
+    }
+    fdQueue = std::move(queued);
+}
+
+bool FdHandler::hasFd(const int fd) {
+    return fdCallbacks.find(fd) != fdCallbacks.end();
+}
 
 void FdHandler::pollFds() {
     while (!fdQueue.empty() && pollfds.size() < 1024) {
@@ -45,22 +68,18 @@ void FdHandler::pollFds() {
 
     auto it = pollfds.begin();
     while (it != pollfds.end()) {
-        if (it->revents & POLLERR) {
-            Logger::log(LogLevel::ERROR, "Poll error on fd: " + std::to_string(it->fd));
-            //Logger::log(LogLevel::ERROR, "Error: " + std::string(strerror(errno)));
-            it = removeFd(it->fd);
-            continue;
-        }
         if (it->revents & POLLNVAL) {
             it = removeFd(it->fd);
             continue;
         }
-        if (it->revents & POLLIN || it->revents & POLLOUT || it->revents & POLLHUP) {
+        // errors go to the callback too, so the owner of the fd can clean up
+        if (it->revents & (POLLIN | POLLOUT | POLLHUP | POLLERR)) {
             if (auto fdCallbacksIt = fdCallbacks.find(it->fd); fdCallbacksIt == fdCallbacks.end()) {
                 it = removeFd(it->fd);
                 continue;
             }
 
+            const bool error = it->revents & POLLERR;
             try {
                 if (fdCallbacks[it->fd](it->fd, it->revents)) {
                     it = removeFd(it->fd);
@@ -69,6 +88,12 @@ void FdHandler::pollFds() {
             }catch (std::exception &e) {
                 Logger::log(LogLevel::ERROR, e.what());
             }
+            // the error stays until the fd is closed, a callback that ignored it would be called again and again
+            if (error) {
+                Logger::log(LogLevel::ERROR, "Poll error on fd: " + std::to_string(it->fd));
+                it = removeFd(it->fd);
+                continue;
+            }
         }
         ++it;
     }
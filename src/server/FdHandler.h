@@ -26,6 +26,12 @@ public:
     static void addFd(int fd, short events, const std::function<bool(int, short)> &callback);
     static std::vector<pollfd>::iterator removeFd(int fd);
 
+    // changes the polled events of an already added fd, so idle fds don't wake up the loop
+    static void setEvents(int fd, short events);
+
+    // false once the fd was removed, also when its callback did not handle a POLLERR
+    static bool hasFd(int fd);
+
     static void pollFds();
 };
 
@@ -14,10 +14,24 @@
 #include <webserv.h>
 #include <common/SessionManager.h>
 #include <parser/config/ConfigParser.h>
+#include <server/fastcgi/FastCgiPool.h>
+#include <server/cgi/CgiWorkerPool.h>
+#include <server/cgi/CgiProcessManager.h>
+#include <server/cache/CgiCache.h>
 
 #include "handler/CallbackHandler.h"
 #include "FdHandler.h"
 #include "handler/MetricHandler.h"
+#include "cache/OpenFileCache.h"
+#include "cache/DirectoryCache.h"
+#include "cache/ErrorPageCache.h"
+#include "handler/FileWatcher.h"
+#include "handler/SystemStats.h"
+#include "handler/MetricStream.h"
+#include "buffer/BufferSlice.h"
+#include "buffer/MemoryBudget.h"
+#include "handler/ThreadPool.h"
+#include "requestHandler/InternalApi.h"
 
 std::vector<std::shared_ptr<Server> > ServerPool::servers;
 std::atomic<bool> ServerPool::running{false};
@@ -116,6 +130,23 @@ bool ServerPool::loadConfig(const std::string &configFile) {
 
     httpConfig = parser.getHttpConfig();
     configs = parser.getServerConfigs();
+    // a static cache hit is answered from the cached lookup of the file, so without it every hit would stat the file
+    const bool staticCache = std::any_of(configs.begin(), configs.end(), [](const ServerConfig &config) {
+        return config.staticCache != nullptr;
+    });
+    if (staticCache && httpConfig.open_file_cache == 0) {
+        httpConfig.open_file_cache = STATIC_CACHE_OPEN_FILES;
+        Logger::log(LogLevel::INFO, "static_cache_size turns on the open file cache with " +
+                                    std::to_string(httpConfig.open_file_cache) + " entries");
+    }
+    OpenFileCache::configure(httpConfig.open_file_cache, static_cast<std::time_t>(httpConfig.open_file_cache_valid));
+    CgiProcessManager::configure(httpConfig.cgi_max_concurrent, httpConfig.cgi_queue_size);
+    CgiCache::configure(httpConfig.cgi_cache_size);
+    MemoryBudget::configure(httpConfig.memory_budget);
+    ThreadPool::configure(httpConfig.thread_pool_size);
+    DirectoryCache::configure(httpConfig.autoindex_cache_size);
+    HttpResponse::prerenderStatusPages();
+    ErrorPageCache::configure(configs);
 
     if (configs.empty()) {
         Logger::log(LogLevel::ERROR, "No valid server configurations found in the file: " + configFile);
@@ -175,7 +206,8 @@ void ServerPool::serverLoop() {
         closeConnections();
         FdHandler::pollFds();
         CallbackHandler::executeCallbacks();
-        MetricHandler::resetMetrics();
+        if (MetricHandler::resetMetrics() && MetricStream::getSubscriberCount() > 0)
+            MetricStream::publish(InternalApi::createMetrics());
     }
     cleanUp();
 }
@@ -184,7 +216,8 @@ void ServerPool::closeConnections() {
     const time_t currentTime = std::time(nullptr);
     std::vector<int> clientsToClose;
     for (auto &[fd, client]: clients) {
-        if (client->shouldClose) {
+        // a socket with an error is dropped by poll, nothing would close the connection otherwise
+        if (client->shouldClose || !FdHandler::hasFd(fd)) {
             clientsToClose.push_back(fd);
             continue;
         }
@@ -197,6 +230,14 @@ void ServerPool::closeConnections() {
             continue;
         }
 
+        // idle connections are the cheapest to give up when memory runs out
+        if (MemoryBudget::isExhausted() && !client->hasPendingResponse() && client->lastPackageSend != 0 &&
+            client->parser.headerStart == 0) {
+            clientsToClose.push_back(fd);
+            MetricHandler::incrementMetric("memory_shed_connections", 1);
+            continue;
+        }
+
         if (client->parser.headerStart != 0 &&
             currentTime - client->parser.headerStart > static_cast<long>(client->config.headerConfig.
                 client_header_timeout)) {
@@ -216,6 +257,15 @@ void ServerPool::closeConnections() {
             Logger::log(LogLevel::INFO, "Client connection body timed out");
         }
 
+        if (client->cgiProcessStart != 0 && client->hasPendingResponse() &&
+            currentTime - client->cgiProcessStart > static_cast<long>(client->config.cgi_timeout)) {
+            // a streamed cgi response already sent its status, so the connection is cut instead
+            clientsToClose.push_back(fd);
+            MetricHandler::incrementMetric("cgi_timeout", 1);
+            Logger::log(LogLevel::INFO, "Client connection CGI process timed out while streaming");
+            continue;
+        }
+
         if (client->cgiProcessStart != 0 &&
             currentTime - client->cgiProcessStart > static_cast<long>(client->config.cgi_timeout)) {
             client->setResponse(RequestHandler::handleCustomErrorPage(
@@ -236,8 +286,20 @@ void ServerPool::closeConnections() {
 
 void ServerPool::cleanUp() {
     clients.clear();
+    ThreadPool::clear();
+    FastCgiPool::clear();
+    CgiWorkerPool::clear();
+    CgiProcessManager::clear();
+    CgiCache::clear();
+    OpenFileCache::clear();
+    DirectoryCache::clear();
+    ErrorPageCache::clear();
+    FileWatcher::clear();
+    SystemStats::clear();
+    MetricStream::clear();
     configs.clear();
     servers.clear();
+    SlicePool::clear();
     SessionManager::serialize(SESSION_SAVE_FILE);
     Logger::log(LogLevel::INFO, "Server pool cleaned up.");
 }
@@ -246,6 +308,13 @@ int ServerPool::getClientCount() {
     return clients.size();
 }
 
+size_t ServerPool::getMaxClientBufferedBytes() {
+    size_t maxBytes = 0;
+    for (const auto &[fd, client]: clients)
+        maxBytes = std::max(maxBytes, client->getBufferedBytes());
+    return maxBytes;
+}
+
 std::time_t ServerPool::getStartTime() {
     return startTime;
 }
@@ -35,6 +35,9 @@ public:
 
     static int getClientCount();
 
+    // memory held by the connection that buffers the most
+    static size_t getMaxClientBufferedBytes();
+
     static std::time_t getStartTime();
 
     static HttpConfig& getHttpConfig();
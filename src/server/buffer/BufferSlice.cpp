@@ -0,0 +1,33 @@
+//
+// Created by Emil Ebert on 18.10.26.
+//
+
+#include "BufferSlice.h"
+
+std::vector<BufferSlice *> *SlicePool::freeSlices = new std::vector<BufferSlice *>();
+
+std::shared_ptr<BufferSlice> SlicePool::acquire() {
+    BufferSlice *slice;
+    if (freeSlices->empty())
+        slice = new BufferSlice;
+    else {
+        slice = freeSlices->back();
+        freeSlices->pop_back();
+        slice->used = 0;
+    }
+    return {slice, release};
+}
+
+void SlicePool::release(BufferSlice *slice) {
+    if (freeSlices->size() >= BUFFER_SLICE_POOL_SIZE) {
+        delete slice;
+        return;
+    }
+    freeSlices->push_back(slice);
+}
+
+void SlicePool::clear() {
+    for (const BufferSlice *slice: *freeSlices)
+        delete slice;
+    freeSlices->clear();
+}
@@ -0,0 +1,45 @@
+//
+// Created by Emil Ebert on 18.10.26.
+//
+
+#ifndef BUFFERSLICE_H
+#define BUFFERSLICE_H
+
+#include <memory>
+#include <vector>
+#include <webserv.h>
+
+// fixed size block of buffered data, a slice is shared by every view on it and filled from the front
+struct BufferSlice {
+    size_t used = 0;
+    char data[BUFFER_SLICE_SIZE];
+};
+
+// part of a slice, the slice stays alive as long as a view on it exists
+struct SliceView {
+    std::shared_ptr<BufferSlice> slice;
+    size_t begin;
+    size_t end;
+
+    [[nodiscard]] const char *data() const { return slice->data + begin; }
+    [[nodiscard]] size_t size() const { return end - begin; }
+};
+
+// released slices are kept for the next buffer instead of being freed
+class SlicePool {
+private:
+    // never destroyed, slices of static buffers can be released after the exit handlers ran
+    static std::vector<BufferSlice *> *freeSlices;
+
+    static void release(BufferSlice *slice);
+
+public:
+    static std::shared_ptr<BufferSlice> acquire();
+
+    static void clear();
+
+    [[nodiscard]] static size_t getFreeCount() { return freeSlices->size(); }
+};
+
+
+#endif //BUFFERSLICE_H
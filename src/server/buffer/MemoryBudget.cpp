@@ -0,0 +1,37 @@
+//
+// Created by Emil Ebert on 18.10.26.
+//
+
+#include "MemoryBudget.h"
+
+size_t MemoryBudget::limit = 0;
+size_t MemoryBudget::total = 0;
+size_t MemoryBudget::usage[static_cast<size_t>(MemoryCategory::COUNT)] = {};
+
+void MemoryBudget::configure(const size_t limit) {
+    MemoryBudget::limit = limit;
+}
+
+void MemoryBudget::update(const MemoryCategory category, size_t &accounted, const size_t current) {
+    if (current == accounted)
+        return;
+    size_t &categoryUsage = usage[static_cast<size_t>(category)];
+    categoryUsage = categoryUsage - accounted + current;
+    total = total - accounted + current;
+    accounted = current;
+}
+
+const char *MemoryBudget::getCategoryName(const MemoryCategory category) {
+    switch (category) {
+        case MemoryCategory::PARSER:
+            return "parser";
+        case MemoryCategory::REQUEST_BODY:
+            return "request_body";
+        case MemoryCategory::RESPONSE_BODY:
+            return "response_body";
+        case MemoryCategory::SPILLED_BODY:
+            return "spilled_body";
+        default:
+            return "unknown";
+    }
+}
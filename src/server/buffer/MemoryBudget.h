@@ -0,0 +1,45 @@
+//
+// Created by Emil Ebert on 18.10.26.
+//
+
+#ifndef MEMORYBUDGET_H
+#define MEMORYBUDGET_H
+
+#include <cstddef>
+
+enum class MemoryCategory {
+    PARSER, // unparsed request data of a connection
+    REQUEST_BODY,
+    RESPONSE_BODY,
+    SPILLED_BODY, // bodies spilled to a memory backend
+    COUNT
+};
+
+// counts the bytes buffered by the whole process, buffers report their size after every change
+class MemoryBudget {
+private:
+    static size_t limit;
+    static size_t total;
+    static size_t usage[static_cast<size_t>(MemoryCategory::COUNT)];
+
+public:
+    // 0 disables the budget
+    static void configure(size_t limit);
+
+    // replaces what an owner accounted so far with its current size
+    static void update(MemoryCategory category, size_t &accounted, size_t current);
+
+    // above the watermark buffers spill to disk early and memory backends are skipped
+    [[nodiscard]] static bool isAboveWatermark() { return limit > 0 && total >= limit / 4 * 3; }
+
+    // once the budget is used up new requests are rejected
+    [[nodiscard]] static bool isExhausted() { return limit > 0 && total >= limit; }
+
+    [[nodiscard]] static size_t getLimit() { return limit; }
+    [[nodiscard]] static size_t getUsage() { return total; }
+    [[nodiscard]] static size_t getUsage(MemoryCategory category) { return usage[static_cast<size_t>(category)]; }
+
+    static const char *getCategoryName(MemoryCategory category);
+};
+
+#endif //MEMORYBUDGET_H
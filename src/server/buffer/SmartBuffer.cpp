@@ -6,13 +6,29 @@
 #include <common/Logger.h>
 #include <sys/stat.h>
 #include <filesystem>
-#include <vector>
+#include <cerrno>
+#include <cstring>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <server/handler/MetricHandler.h>
 
-#include "../FdHandler.h"
 #include "webserv.h"
 
 size_t SmartBuffer::tmpFileCount = 0;
 
+static const char *getSpillMetric(const SpillBackend backend) {
+    switch (backend) {
+        case SpillBackend::MEMFD:
+            return "spilled_bytes_memfd";
+        case SpillBackend::TMPFS:
+            return "spilled_bytes_tmpfs";
+        case SpillBackend::MMAP:
+            return "spilled_bytes_mmap";
+        default:
+            return "spilled_bytes_disk";
+    }
+}
+
 SmartBuffer::SmartBuffer(const size_t maxMemorySize)
     : maxMemorySize(maxMemorySize) {
 }
@@ -25,14 +41,16 @@ SmartBuffer::SmartBuffer(const int fd): fd(fd) {
     }
     size = fileStat.st_size;
     isFile = true;
-    FdHandler::addFd(fd, POLLIN | POLLOUT, [this](const int fd, const short events) {
-        return this->onFileEvent(fd, events);
-    });
-    fdCallbackRegistered = true;
+    // the file is sent from front to back, so the kernel can read ahead further
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    posix_fadvise(fd, 0, FILE_READ_SIZE, POSIX_FADV_WILLNEED);
 }
 
 SmartBuffer::~SmartBuffer() {
-    unregisterCallback();
+    MemoryBudget::update(category, accountedMemory, 0);
+    MemoryBudget::update(MemoryCategory::SPILLED_BODY, accountedSpill, 0);
+    if (mapping)
+        munmap(mapping, mappingSize);
     if (isFile && fd >= 0) {
         Logger::log(LogLevel::DEBUG, "Closing file descriptor: " + std::to_string(fd));
         if (close(fd) < 0)
@@ -51,71 +69,276 @@ SmartBuffer::~SmartBuffer() {
     }
 }
 
-void SmartBuffer::unregisterCallback() {
-    if (fdCallbackRegistered) {
-        FdHandler::removeFd(fd);
-        fdCallbackRegistered = false;
-    }
+void SmartBuffer::closeFile() {
+    close(fd);
+    fd = -1;
+}
+
+void SmartBuffer::setSpillBackend(const SpillBackend backend, const std::string &directory) {
+    this->backend = backend;
+    if (backend == SpillBackend::TMPFS)
+        spillDirectory = directory;
+}
+
+void SmartBuffer::setMemoryCategory(const MemoryCategory category) {
+    MemoryBudget::update(this->category, accountedMemory, 0);
+    this->category = category;
+    updateMemoryUsage();
+}
+
+void SmartBuffer::updateMemoryUsage() {
+    MemoryBudget::update(category, accountedMemory, bufferSize + readBufferSize);
+    MemoryBudget::update(MemoryCategory::SPILLED_BODY, accountedSpill,
+                         isSpilledToMemory() && fd >= 0 ? size - discardedBytes : 0);
 }
 
-bool SmartBuffer::onFileEvent(const int fd, const short events) {
-    if (events & POLLOUT && !writeBuffer.empty()) {
-        const ssize_t bytesWritten = ::write(fd, writeBuffer.data(), writeBuffer.length());
+int SmartBuffer::createMemoryFile() {
+#ifdef __linux__
+    return memfd_create("smartbuffer", MFD_CLOEXEC);
+#else
+    return -1;
+#endif
+}
+
+bool SmartBuffer::growMapping(const size_t length) {
+    if (length <= mappingSize)
+        return true;
+#ifdef __linux__
+    // the file is sparse, so only the pages that are written take memory
+    size_t newSize = std::max({length, mappingSize * 2, static_cast<size_t>(BUFFER_MMAP_MIN_SIZE)});
+    const size_t pageSize = sysconf(_SC_PAGESIZE);
+    newSize = (newSize + pageSize - 1) / pageSize * pageSize;
+    if (ftruncate(fd, static_cast<off_t>(newSize)) != 0)
+        return false;
+
+    void *newMapping = mapping
+                           ? mremap(mapping, mappingSize, newSize, MREMAP_MAYMOVE)
+                           : mmap(nullptr, newSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (newMapping == MAP_FAILED)
+        return false;
+    mapping = static_cast<char *>(newMapping);
+    mappingSize = newSize;
+    return true;
+#else
+    return false;
+#endif
+}
+
+void SmartBuffer::writeFile(iovec *iov, size_t count) {
+    const size_t previousSize = size;
+    if (backend == SpillBackend::MMAP) {
+        for (size_t i = 0; i < count && fd >= 0; i++) {
+            const size_t offset = size - discardedBytes;
+            if (!growMapping(offset + iov[i].iov_len)) {
+                Logger::log(LogLevel::ERROR, "Failed to map file: " + std::to_string(fd));
+                closeFile();
+                break;
+            }
+            std::memcpy(mapping + offset, iov[i].iov_base, iov[i].iov_len);
+            size += iov[i].iov_len;
+        }
+        count = 0;
+    }
+
+    while (count > 0 && fd >= 0) {
+        ssize_t bytesWritten = ::pwritev(fd, iov, static_cast<int>(count), static_cast<off_t>(size - discardedBytes));
         if (bytesWritten <= 0) {
-            close(fd);
-            this->fd = -1;
             Logger::log(LogLevel::ERROR, "Failed to write to file: " + std::to_string(fd));
-            return true;
+            closeFile();
+            return;
         }
         size += bytesWritten;
-        writeBuffer.erase(0, bytesWritten);
-    }
-    if (events & POLLIN && toRead > 0) {
-        if (lseek(fd, readPos, SEEK_SET) < 0) {
-            Logger::log(LogLevel::ERROR, "Failed to seek in file: " + std::to_string(fd));
-            return false;
+        while (count > 0 && static_cast<size_t>(bytesWritten) >= iov->iov_len) {
+            bytesWritten -= static_cast<ssize_t>(iov->iov_len);
+            iov++;
+            count--;
         }
-        toRead = std::min(toRead, static_cast<size_t>(60000));
-        std::vector<char> buf(toRead + 1);
-        const ssize_t bytesRead = ::read(fd, buf.data(), toRead);
-        if (bytesRead <= 0) {
-            close(fd);
-            this->fd = -1;
-            return true;
+        if (count > 0) {
+            iov->iov_base = static_cast<char *>(iov->iov_base) + bytesWritten;
+            iov->iov_len -= bytesWritten;
         }
-
-        buf[bytesRead] = '\0';
-        readBuffer.append(buf.data(), bytesRead);
-        readPos += bytesRead;
-        toRead -= bytesRead;
     }
-    return false;
+    MetricHandler::incrementMetric(getSpillMetric(backend), size - previousSize);
 }
 
+// a reader can catch up with the writer, so only what was written so far is read
+void SmartBuffer::readFile(const size_t length) {
+    if (fd < 0 || readPos >= size || readBufferSize >= length)
+        return;
+
+    const size_t toRead = std::min(static_cast<size_t>(FILE_READ_SIZE), size - readPos);
+
+    // the file is read straight into fresh slices, which the reader gets as they are
+    std::shared_ptr<BufferSlice> slices[FILE_READ_SIZE / BUFFER_SLICE_SIZE];
+    iovec iov[FILE_READ_SIZE / BUFFER_SLICE_SIZE];
+    size_t count = 0;
+    for (size_t offset = 0; offset < toRead; offset += BUFFER_SLICE_SIZE) {
+        slices[count] = SlicePool::acquire();
+        iov[count].iov_base = slices[count]->data;
+        iov[count].iov_len = std::min<size_t>(BUFFER_SLICE_SIZE, toRead - offset);
+        count++;
+    }
+    const size_t offset = readPos - discardedBytes;
+    ssize_t bytesRead = static_cast<ssize_t>(toRead);
+    if (mapping) {
+        for (size_t i = 0, copied = 0; i < count; copied += iov[i].iov_len, i++)
+            std::memcpy(iov[i].iov_base, mapping + offset + copied, iov[i].iov_len);
+    } else
+        bytesRead = ::preadv(fd, iov, static_cast<int>(count), static_cast<off_t>(offset));
+    if (bytesRead <= 0) {
+        Logger::log(LogLevel::ERROR, "Failed to read from file: " + std::to_string(fd));
+        closeFile();
+        return;
+    }
+
+    size_t remaining = bytesRead;
+    for (size_t i = 0; i < count && remaining > 0; i++) {
+        slices[i]->used = std::min(remaining, iov[i].iov_len);
+        readBuffer.push_back({slices[i], 0, slices[i]->used});
+        remaining -= slices[i]->used;
+    }
+    readBufferSize += bytesRead;
+    readPos += bytesRead;
+}
 
 void SmartBuffer::switchToFile() {
     if (isFile)
         return;
 
-    size = 0;
+    size = discardedBytes;
     Logger::log(LogLevel::DEBUG, "Switching SmartBuffer to file mode");
 
-    tmpFileName = TEMP_DIR_NAME "/smartbuffer_" + std::to_string(tmpFileCount++);
-    fd = open(tmpFileName.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0666);
+    // memory is running out, so the buffer goes to disk like any other
+    if (backend != SpillBackend::DISK && MemoryBudget::isAboveWatermark()) {
+        backend = SpillBackend::DISK;
+        spillDirectory.clear();
+    }
+
+    if (!openSpillFile())
+        return;
+
+    isFile = true;
+    spilled = true;
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    // the unread memory buffer becomes the start of the file
+    while (bufferSize > 0 && fd >= 0) {
+        iovec iov[BUFFER_MAX_IOVECS];
+        const size_t count = fillIovecs(buffer, iov, BUFFER_MAX_IOVECS);
+        size_t length = 0;
+        for (size_t i = 0; i < count; i++)
+            length += iov[i].iov_len;
+        writeFile(iov, count);
+        dropViews(buffer, length);
+        bufferSize -= length;
+    }
+    buffer.clear();
+    bufferSize = 0;
+    updateMemoryUsage();
+}
+
+bool SmartBuffer::openSpillFile() {
+    if (backend == SpillBackend::MEMFD || backend == SpillBackend::MMAP)
+        fd = createMemoryFile();
+#ifdef O_TMPFILE
+    if (fd < 0 && !spillDirectory.empty())
+        fd = open(spillDirectory.c_str(), O_TMPFILE | O_RDWR | O_CLOEXEC, 0644);
+#endif
+    if (fd < 0 && !spillDirectory.empty()) {
+        std::string name = spillDirectory + "/.smartbuffer_XXXXXX";
+        fd = mkstemp(name.data());
+        if (fd >= 0) {
+            fcntl(fd, F_SETFD, FD_CLOEXEC);
+            fchmod(fd, 0644);
+            tmpFileName = name;
+        }
+    }
+    if (fd < 0) {
+        backend = SpillBackend::DISK;
+        tmpFileName = TEMP_DIR_NAME "/smartbuffer_" + std::to_string(tmpFileCount++);
+        fd = open(tmpFileName.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+    }
     if (fd < 0) {
         Logger::log(LogLevel::ERROR, "Failed to create temporary file: " + tmpFileName);
+        tmpFileName.clear();
+        return false;
+    }
+    Logger::log(LogLevel::DEBUG, "Created temporary file: " + (tmpFileName.empty() ? spillDirectory : tmpFileName));
+    return true;
+}
+
+// the data keeps its offsets, so readers don't notice that the file changed
+void SmartBuffer::evictToDisk() {
+    if (!isSpilledToMemory() || fd < 0)
         return;
+
+    const int memoryFd = fd;
+    const std::string memoryFileName = tmpFileName;
+    if (mapping)
+        munmap(mapping, mappingSize);
+    mapping = nullptr;
+    mappingSize = 0;
+    fd = -1;
+    tmpFileName.clear();
+    backend = SpillBackend::DISK;
+    spillDirectory.clear();
+    Logger::log(LogLevel::DEBUG, "Moving SmartBuffer from memory to disk");
+
+    const size_t length = size - discardedBytes;
+    off_t offset = 0;
+    const bool opened = openSpillFile();
+    while (opened && static_cast<size_t>(offset) < length) {
+        // the disk file is new, so sendfile writes it from the start
+        if (sendfile(fd, memoryFd, &offset, length - offset) <= 0) {
+            Logger::log(LogLevel::ERROR, "Failed to move file to disk: " + std::string(strerror(errno)));
+            closeFile();
+            break;
+        }
     }
-    Logger::log(LogLevel::DEBUG, "Created temporary file: " + tmpFileName);
+    close(memoryFd);
+    if (!memoryFileName.empty())
+        unlink(memoryFileName.c_str());
+    MetricHandler::incrementMetric(getSpillMetric(backend), offset);
+    updateMemoryUsage();
+}
 
-    writeBuffer.append(buffer);
-    buffer.clear();
+bool SmartBuffer::moveTo(const std::string &path) {
+    // memory files can't be linked into a filesystem
+    if (!spilled || fd < 0 || discardedBytes != 0 || backend == SpillBackend::MEMFD || backend == SpillBackend::MMAP)
+        return false;
 
-    isFile = true;
-    FdHandler::addFd(fd, POLLIN | POLLOUT, [this](const int fd, const short events) {
-        return this->onFileEvent(fd, events);
-    });
-    fdCallbackRegistered = true;
+    if (!tmpFileName.empty()) {
+        // fails with EXDEV if the buffer was spilled to another filesystem
+        if (rename(tmpFileName.c_str(), path.c_str()) != 0)
+            return false;
+        tmpFileName.clear();
+    } else if (!linkTmpFile(fd, path))
+        return false;
+
+    spilled = false;
+    return true;
+}
+
+bool SmartBuffer::linkTmpFile(const int fd, const std::string &path) {
+#ifdef O_TMPFILE
+    const std::string procPath = "/proc/self/fd/" + std::to_string(fd);
+    if (linkat(AT_FDCWD, procPath.c_str(), AT_FDCWD, path.c_str(), AT_SYMLINK_FOLLOW) == 0)
+        return true;
+    if (errno != EEXIST)
+        return false;
+
+    // linkat can't replace a file, so the file gets a name first and is renamed over it
+    const std::string tmpPath = path + ".link-" + std::to_string(getpid()) + "-" + std::to_string(tmpFileCount++);
+    if (linkat(AT_FDCWD, procPath.c_str(), AT_FDCWD, tmpPath.c_str(), AT_SYMLINK_FOLLOW) != 0)
+        return false;
+    if (rename(tmpPath.c_str(), path.c_str()) == 0)
+        return true;
+    unlink(tmpPath.c_str());
+#else
+    (void) fd;
+    (void) path;
+#endif
+    return false;
 }
 
 
@@ -123,15 +346,23 @@ void SmartBuffer::append(const char *data, const size_t length) {
     if (!data || length == 0)
         return;
 
-    if (isFile && fd >= 0)
-        writeBuffer.append(data, length);
-    else {
-        buffer.append(data, length);
+    // a file buffer writes the data where it is, without copying it into slices first
+    if (isFile && fd >= 0) {
+        iovec iov{const_cast<char *>(data), length};
+        writeFile(&iov, 1);
+    } else {
+        appendTo(buffer, data, length);
+        bufferSize += length;
         size += length;
     }
 
-    if (size > maxMemorySize)
+    // above the watermark everything but small buffers is spilled right away
+    if (!isFile && (bufferSize > maxMemorySize || (bufferSize > BUFFER_SLICE_SIZE && MemoryBudget::isAboveWatermark())))
         switchToFile();
+    updateMemoryUsage();
+    // a buffer that keeps growing in memory after the budget ran out gives its memory back
+    if (isSpilledToMemory() && MemoryBudget::isExhausted())
+        evictToDisk();
 }
 
 void SmartBuffer::read(const size_t length) {
@@ -139,23 +370,83 @@ void SmartBuffer::read(const size_t length) {
         return;
 
     if (isFile && fd >= 0) {
-        toRead += length;
+        readFile(length);
+        updateMemoryUsage();
         return;
     }
 
     if (readPos >= size)
         return;
 
-    const size_t available = size - readPos;
-    const size_t toRead = std::min(length, available);
-
-    readBuffer.append(buffer.substr(readPos, toRead));
-    readPos = std::min(readPos + toRead, size);
+    // the views move to the reader, memory only holds what was not read yet
+    const size_t moved = moveViews(buffer, readBuffer, length);
+    bufferSize -= moved;
+    readBufferSize += moved;
+    readPos += moved;
+    discardedBytes = readPos;
+    updateMemoryUsage();
 }
 
 void SmartBuffer::cleanReadBuffer(size_t length) {
-    if (length > readBuffer.length())
-        length = readBuffer.length();
+    if (length > readBufferSize)
+        length = readBufferSize;
+
+    dropViews(readBuffer, length);
+    readBufferSize -= length;
+    updateMemoryUsage();
+}
+
+void SmartBuffer::appendTo(std::deque<SliceView> &chain, const char *data, size_t length) {
+    while (length > 0) {
+        if (!tail || tail->used == BUFFER_SLICE_SIZE)
+            tail = SlicePool::acquire();
+
+        const size_t count = std::min<size_t>(length, BUFFER_SLICE_SIZE - tail->used);
+        std::memcpy(tail->data + tail->used, data, count);
+        if (!chain.empty() && chain.back().slice == tail && chain.back().end == tail->used)
+            chain.back().end += count;
+        else
+            chain.push_back({tail, tail->used, tail->used + count});
+        tail->used += count;
+        data += count;
+        length -= count;
+    }
+}
 
-    readBuffer.erase(0, length);
+size_t SmartBuffer::moveViews(std::deque<SliceView> &from, std::deque<SliceView> &to, const size_t length) {
+    size_t moved = 0;
+    while (moved < length && !from.empty()) {
+        SliceView &view = from.front();
+        const size_t count = std::min(view.size(), length - moved);
+        if (count == view.size()) {
+            to.push_back(std::move(view));
+            from.pop_front();
+        } else {
+            to.push_back({view.slice, view.begin, view.begin + count});
+            view.begin += count;
+        }
+        moved += count;
+    }
+    return moved;
+}
+
+void SmartBuffer::dropViews(std::deque<SliceView> &chain, size_t length) {
+    while (length > 0 && !chain.empty()) {
+        SliceView &view = chain.front();
+        if (length < view.size()) {
+            view.begin += length;
+            return;
+        }
+        length -= view.size();
+        chain.pop_front();
+    }
+}
+
+size_t SmartBuffer::fillIovecs(const std::deque<SliceView> &chain, iovec *iov, const size_t count) {
+    size_t used = 0;
+    for (auto it = chain.begin(); it != chain.end() && used < count; ++it, ++used) {
+        iov[used].iov_base = const_cast<char *>(it->data());
+        iov[used].iov_len = it->size();
+    }
+    return used;
 }
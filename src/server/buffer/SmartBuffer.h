@@ -6,23 +6,70 @@
 #define SMARTBUFFER_H
 
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <string>
+#include <deque>
 #include <functional>
+#include <server/buffer/BufferSlice.h>
+#include <config/config.h>
+#include <server/buffer/MemoryBudget.h>
 
+// the data is kept in pooled slices, reading hands out views on them instead of copies
 class SmartBuffer {
 private:
     int fd = -1;
     size_t size = 0;
     size_t maxMemorySize = 0;
     bool isFile = false;
-    std::string buffer;
-    std::string writeBuffer;
-    std::string readBuffer;
+    // unread data of a memory buffer
+    std::deque<SliceView> buffer;
+    size_t bufferSize = 0;
+    // data handed to the reader until it is consumed with cleanReadBuffer
+    std::deque<SliceView> readBuffer;
+    size_t readBufferSize = 0;
+    // slice that appended data is copied into
+    std::shared_ptr<BufferSlice> tail;
     size_t readPos = 0;
-    size_t toRead = 0;
-    bool fdCallbackRegistered = false;
+    // bytes that are neither in memory nor in the file, they were read before the buffer switched to a file
+    size_t discardedBytes = 0;
+    bool streaming = false;
     static size_t tmpFileCount;
     std::string tmpFileName;
+    // where the buffer is spilled to, a request body is spilled next to its upload target so it can be moved there
+    std::string spillDirectory;
+    // the file was created by switchToFile and only holds the buffered data
+    bool spilled = false;
+    SpillBackend backend = SpillBackend::DISK;
+    // the mmap backend copies into a shared mapping of its memory file, which grows with the data
+    char *mapping = nullptr;
+    size_t mappingSize = 0;
+    MemoryCategory category = MemoryCategory::RESPONSE_BODY;
+    // what this buffer reported to the memory budget
+    size_t accountedMemory = 0;
+    size_t accountedSpill = 0;
+
+    void appendTo(std::deque<SliceView> &chain, const char *data, size_t length);
+
+    static size_t moveViews(std::deque<SliceView> &from, std::deque<SliceView> &to, size_t length);
+
+    static void dropViews(std::deque<SliceView> &chain, size_t length);
+
+    static size_t fillIovecs(const std::deque<SliceView> &chain, iovec *iov, size_t count);
+
+    // regular files never block, so they are written and read right away at explicit offsets instead of polled
+    void writeFile(iovec *iov, size_t count);
+
+    void readFile(size_t length);
+
+    void closeFile();
+
+    int createMemoryFile();
+
+    bool openSpillFile();
+
+    bool growMapping(size_t length);
+
+    void updateMemoryUsage();
 
 public:
     SmartBuffer(size_t maxMemorySize = 40000);
@@ -33,23 +80,47 @@ public:
 
     void switchToFile();
 
-    bool onFileEvent(int fd, short events);
+    // moves a buffer that was spilled to memory onto the disk, so its memory is freed
+    void evictToDisk();
+
+    // links a spilled, completely written buffer to path without copying it, false if it has to be copied
+    bool moveTo(const std::string &path);
+
+    // gives an unlinked O_TMPFILE file a name, an existing file at path is replaced atomically
+    static bool linkTmpFile(int fd, const std::string &path);
 
     void append(const char *data, size_t length);
 
     void read(size_t length);
 
-    void unregisterCallback();
-
     void cleanReadBuffer(size_t length);
 
-    [[nodiscard]] std::string getReadBuffer() const { return readBuffer; }
+    // a streaming buffer is still appended to by a producer, so reaching its end does not mean the body is complete
+    void setStreaming(bool streaming) { this->streaming = streaming; }
+    void setSpillDirectory(const std::string &directory) { spillDirectory = directory; }
+    // the tmpfs backend spills into directory, the others ignore it
+    void setSpillBackend(SpillBackend backend, const std::string &directory);
+    void setMaxMemorySize(const size_t maxMemorySize) { this->maxMemorySize = maxMemorySize; }
+    void setMemoryCategory(MemoryCategory category);
+    [[nodiscard]] bool isStreaming() const { return streaming; }
+
+    // views on the read data, they stay valid until the data is consumed
+    [[nodiscard]] const std::deque<SliceView> &getReadSlices() const { return readBuffer; }
+    // fills iov with the start of the read data, returns the number of entries used
+    size_t getReadIovecs(iovec *iov, const size_t count) const { return fillIovecs(readBuffer, iov, count); }
+    [[nodiscard]] size_t getReadBufferSize() const { return readBufferSize; }
     [[nodiscard]] size_t getReadPos() const { return readPos; }
     [[nodiscard]] size_t getSize() const { return size; }
     [[nodiscard]] bool isFileBuffer() const { return isFile; }
+    // the file of the buffer lives in memory
+    [[nodiscard]] bool isSpilledToMemory() const { return isFile && backend != SpillBackend::DISK; }
+    [[nodiscard]] size_t getMemoryUsage() const { return accountedMemory + accountedSpill; }
     [[nodiscard]] int getFd() const { return fd; }
     [[nodiscard]] std::string getTmpFileName() const { return tmpFileName; }
-    [[nodiscard]] bool isStillWriting() const { return !writeBuffer.empty(); }
+    // position of the read buffer in the file, -1 if the buffer is not backed by a file
+    [[nodiscard]] off_t getReadBufferFileOffset() const {
+        return isFile && fd >= 0 ? static_cast<off_t>(readPos - readBufferSize - discardedBytes) : -1;
+    }
 };
 
 #endif //SMARTBUFFER_H
@@ -0,0 +1,199 @@
+//
+// Created by Emil Ebert on 18.10.26.
+//
+
+#include "CgiCache.h"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <algorithm>
+#include <sstream>
+#include <webserv.h>
+#include <common/Logger.h>
+#include <server/cgi/CgiResponseBuilder.h>
+#include <server/handler/MetricHandler.h>
+
+std::unordered_map<std::string, CgiCache::Entry> CgiCache::entries;
+std::list<std::string> CgiCache::lru;
+std::unordered_map<std::string, std::list<std::pair<size_t, CgiCache::Waiter> > > CgiCache::pending;
+size_t CgiCache::maxSize = 0;
+size_t CgiCache::currentSize = 0;
+size_t CgiCache::nextWaiterId = 0;
+size_t CgiCache::fileCount = 0;
+
+void CgiCache::configure(const size_t maxSize) {
+    clear();
+    CgiCache::maxSize = maxSize;
+}
+
+std::string CgiCache::createKey(const std::string &host, const std::string &uri,
+                                const std::vector<std::string> &headerValues) {
+    std::string key = "GET " + host + uri;
+    for (const auto &value: headerValues)
+        key += "\n" + value;
+    return key;
+}
+
+std::optional<HttpResponse> CgiCache::get(const std::string &key) {
+    const auto it = entries.find(key);
+    if (it == entries.end())
+        return std::nullopt;
+    if (std::chrono::steady_clock::now() >= it->second.expires) {
+        remove(it);
+        return std::nullopt;
+    }
+
+    lru.splice(lru.begin(), lru, it->second.lruIt);
+    return createResponse(it->second);
+}
+
+HttpResponse CgiCache::createResponse(const Entry &entry) {
+    HttpResponse response(entry.statusCode);
+    for (const auto &[name, value]: entry.headers)
+        response.setHeader(name, value);
+
+    if (entry.prerendered)
+        response.setPrerendered(entry.prerendered);
+    else
+        response.setFileBody(fcntl(entry.fd, F_DUPFD_CLOEXEC, 0), {{"", 0, entry.length}});
+    return response;
+}
+
+void CgiCache::lock(const std::string &key) {
+    pending[key];
+}
+
+size_t CgiCache::wait(const std::string &key, Waiter waiter) {
+    const size_t id = nextWaiterId++;
+    pending[key].emplace_back(id, std::move(waiter));
+    MetricHandler::incrementMetric("cgi_cache_coalesced", 1);
+    return id;
+}
+
+void CgiCache::unwait(const std::string &key, const size_t id) {
+    const auto it = pending.find(key);
+    if (it == pending.end())
+        return;
+    it->second.remove_if([id](const std::pair<size_t, Waiter> &waiter) {
+        return waiter.first == id;
+    });
+}
+
+// no-store, no-cache, private and cookies are never shared, max-age and s-maxage replace the configured ttl
+std::optional<size_t> CgiCache::getTtl(const HttpResponse &response, const size_t defaultTtl) {
+    if (response.getStatus() != HttpResponse::OK || !response.getSetCookies().empty())
+        return std::nullopt;
+
+    std::string cacheControl = response.getHeader("Cache-Control");
+    std::transform(cacheControl.begin(), cacheControl.end(), cacheControl.begin(), ::tolower);
+    std::optional<size_t> maxAge;
+    std::optional<size_t> sharedMaxAge;
+    std::stringstream stream(cacheControl);
+    std::string directive;
+    while (std::getline(stream, directive, ',')) {
+        directive.erase(0, directive.find_first_not_of(" \t"));
+        directive.erase(directive.find_last_not_of(" \t") + 1);
+        if (directive == "no-store" || directive == "no-cache" || directive == "private")
+            return std::nullopt;
+
+        const size_t equals = directive.find('=');
+        if (equals == std::string::npos)
+            continue;
+        const std::string value = directive.substr(equals + 1);
+        if (value.empty() || value.find_first_not_of("0123456789") != std::string::npos)
+            continue;
+        if (directive.compare(0, equals, "max-age") == 0)
+            maxAge = std::stoul(value);
+        else if (directive.compare(0, equals, "s-maxage") == 0)
+            sharedMaxAge = std::stoul(value);
+    }
+
+    const size_t ttl = sharedMaxAge.value_or(maxAge.value_or(defaultTtl));
+    if (ttl == 0)
+        return std::nullopt;
+    return ttl;
+}
+
+void CgiCache::complete(const std::string &key, const CgiResponseBuilder &output, const size_t ttl) {
+    const std::string *body = output.getBodyCopy();
+    if (!output.isComplete() || !body || output.isTruncated()) {
+        notify(key, false);
+        return;
+    }
+
+    const HttpResponse base = output.createResponse("");
+    const std::optional<size_t> entryTtl = getTtl(base, ttl);
+    if (!entryTtl) {
+        notify(key, false);
+        return;
+    }
+
+    if (const auto it = entries.find(key); it != entries.end())
+        remove(it);
+
+    Entry entry;
+    entry.statusCode = base.getStatus();
+    for (const auto &[name, value]: base.getHeaders()) {
+        if (name != "Transfer-Encoding" && name != "Content-Length" && name != "Connection")
+            entry.headers[name] = value;
+    }
+    entry.length = body->size();
+    entry.expires = std::chrono::steady_clock::now() + std::chrono::seconds(*entryTtl);
+
+    if (body->size() <= CGI_CACHE_MEMORY_ENTRY_SIZE) {
+        entry.prerendered = base.prerender(*body);
+    } else {
+        const std::string path = TEMP_DIR_NAME "/cgicache_" + std::to_string(fileCount++);
+        entry.fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+        if (entry.fd >= 0)
+            unlink(path.c_str());
+        if (entry.fd < 0 || write(entry.fd, body->data(), body->size()) != static_cast<ssize_t>(body->size())) {
+            Logger::log(LogLevel::ERROR, "Failed to write cgi cache entry to " + path);
+            if (entry.fd >= 0)
+                close(entry.fd);
+            notify(key, false);
+            return;
+        }
+    }
+
+    lru.push_front(key);
+    entry.lruIt = lru.begin();
+    currentSize += entry.length;
+    entries.emplace(key, std::move(entry));
+    while (currentSize > maxSize && lru.size() > 1)
+        remove(entries.find(lru.back()));
+
+    notify(key, true);
+}
+
+void CgiCache::abort(const std::string &key) {
+    notify(key, false);
+}
+
+// the waiters can start scripts themselves, so they are taken out of the map before they are called
+void CgiCache::notify(const std::string &key, const bool cached) {
+    const auto it = pending.find(key);
+    if (it == pending.end())
+        return;
+    const auto waiters = std::move(it->second);
+    pending.erase(it);
+
+    for (const auto &[id, waiter]: waiters) {
+        (void) id;
+        waiter(cached);
+    }
+}
+
+void CgiCache::remove(const std::unordered_map<std::string, Entry>::iterator it) {
+    currentSize -= it->second.length;
+    if (it->second.fd >= 0)
+        close(it->second.fd);
+    lru.erase(it->second.lruIt);
+    entries.erase(it);
+}
+
+void CgiCache::clear() {
+    while (!entries.empty())
+        remove(entries.begin());
+    pending.clear();
+}
@@ -0,0 +1,90 @@
+//
+// Created by Emil Ebert on 18.10.26.
+//
+
+#ifndef CGICACHE_H
+#define CGICACHE_H
+
+#include <string>
+#include <list>
+#include <chrono>
+#include <optional>
+#include <functional>
+#include <unordered_map>
+#include <server/response/HttpResponse.h>
+
+class CgiResponseBuilder;
+
+// short lived cache for GET responses of cgi scripts. concurrent misses of one key wait for the request that
+// runs the script and get its response, small bodies are kept in memory and larger ones in unlinked tmp files
+class CgiCache {
+public:
+    // false if the response can't be shared and the waiter has to run the script itself, otherwise it is cached
+    using Waiter = std::function<void(bool cached)>;
+
+private:
+    struct Entry {
+        int statusCode;
+        std::unordered_map<std::string, std::string> headers;
+        // memory entries
+        std::shared_ptr<const PrerenderedResponse> prerendered;
+        // disk entries
+        int fd = -1;
+        size_t length = 0;
+        std::chrono::steady_clock::time_point expires;
+        std::list<std::string>::iterator lruIt;
+    };
+
+    static std::unordered_map<std::string, Entry> entries;
+    static std::list<std::string> lru;
+    // keys whose script is running, with the requests waiting for it
+    static std::unordered_map<std::string, std::list<std::pair<size_t, Waiter> > > pending;
+    static size_t maxSize;
+    static size_t currentSize;
+    static size_t nextWaiterId;
+    static size_t fileCount;
+
+public:
+    static void configure(size_t maxSize);
+
+    static std::string createKey(const std::string &host, const std::string &uri,
+                                 const std::vector<std::string> &headerValues);
+
+    static std::optional<HttpResponse> get(const std::string &key);
+
+    // true if the script for key already runs, the caller waits for it then
+    [[nodiscard]] static bool isPending(const std::string &key) { return pending.count(key) > 0; }
+
+    // the caller runs the script for key and has to call complete or abort
+    static void lock(const std::string &key);
+
+    static size_t wait(const std::string &key, Waiter waiter);
+
+    static void unwait(const std::string &key, size_t id);
+
+    // stores the finished output if the script allows it and hands it to the waiting requests
+    static void complete(const std::string &key, const CgiResponseBuilder &output, size_t ttl);
+
+    // the script did not finish, every waiter runs its own
+    static void abort(const std::string &key);
+
+    // bodies larger than this are never cached
+    static size_t getMaxEntrySize() { return maxSize / 4; }
+
+    static void clear();
+
+    static size_t getSize() { return currentSize; }
+    static size_t getEntryCount() { return entries.size(); }
+
+private:
+    static std::optional<size_t> getTtl(const HttpResponse &response, size_t defaultTtl);
+
+    static HttpResponse createResponse(const Entry &entry);
+
+    static void remove(std::unordered_map<std::string, Entry>::iterator it);
+
+    static void notify(const std::string &key, bool cached);
+};
+
+
+#endif //CGICACHE_H
@@ -0,0 +1,118 @@
+//
+// Created by Emil Ebert on 18.10.26.
+//
+
+#include "DirectoryCache.h"
+
+#include <dirent.h>
+#include <cerrno>
+#include <algorithm>
+#include <common/Logger.h>
+#include <server/handler/MetricHandler.h>
+#include <server/cache/OpenFileCache.h>
+
+std::unordered_map<std::string, DirectoryCache::Entry> DirectoryCache::entries;
+std::list<std::string> DirectoryCache::lru;
+size_t DirectoryCache::maxSize = 0;
+size_t DirectoryCache::currentSize = 0;
+
+size_t DirectoryListing::getMemoryUsage() const {
+    size_t size = sizeof(DirectoryListing) + entries.capacity() * sizeof(DirectoryEntry);
+    for (const DirectoryEntry &entry: entries)
+        size += entry.name.capacity();
+    return size;
+}
+
+void DirectoryCache::configure(const size_t maxSize) {
+    clear();
+    DirectoryCache::maxSize = maxSize;
+    Logger::log(LogLevel::DEBUG, "Directory cache configured with " + std::to_string(maxSize) + " bytes");
+}
+
+std::shared_ptr<const DirectoryListing> DirectoryCache::find(const std::string &path) {
+    const auto it = entries.find(OpenFileCache::normalizePath(path));
+    if (it == entries.end())
+        return nullptr;
+    lru.splice(lru.begin(), lru, it->second.lruIt);
+    return it->second.listing;
+}
+
+void DirectoryCache::store(const std::string &path, const std::shared_ptr<const DirectoryListing> &listing) {
+    const std::string key = OpenFileCache::normalizePath(path);
+    if (const auto it = entries.find(key); it != entries.end())
+        remove(it);
+
+    const size_t size = listing->getMemoryUsage();
+    if (listing->error != 0 || !listing->cacheable || size > maxSize)
+        return;
+    lru.push_front(key);
+    entries[key] = {listing, size, lru.begin()};
+    currentSize += size;
+    evict();
+}
+
+std::shared_ptr<const DirectoryListing> DirectoryCache::read(const std::string &path) {
+    auto listing = std::make_shared<DirectoryListing>();
+    const std::time_t start = std::time(nullptr);
+
+    DIR *dir = opendir(path.c_str());
+    struct stat directory{};
+    if (!dir || fstat(dirfd(dir), &directory) != 0) {
+        listing->error = errno;
+        if (dir)
+            closedir(dir);
+        return listing;
+    }
+    listing->device = directory.st_dev;
+    listing->inode = directory.st_ino;
+    listing->mtime = directory.st_mtime;
+    listing->cacheable = directory.st_mtime < start;
+
+    const struct dirent *entry;
+    while ((entry = readdir(dir)) != nullptr) {
+        const std::string name = entry->d_name;
+        if (name == "." || name == "..")
+            continue;
+
+        bool isDirectory = entry->d_type == DT_DIR;
+        // the type of links and of filesystems without d_type is only known from the target itself
+        if (entry->d_type == DT_UNKNOWN || entry->d_type == DT_LNK) {
+            struct stat st{};
+            if (fstatat(dirfd(dir), entry->d_name, &st, 0) != 0)
+                continue;
+            isDirectory = S_ISDIR(st.st_mode);
+        }
+        listing->entries.push_back({name, isDirectory});
+    }
+    closedir(dir);
+
+    std::sort(listing->entries.begin(), listing->entries.end(), [](const DirectoryEntry &a, const DirectoryEntry &b) {
+        return a.name < b.name;
+    });
+    listing->entries.shrink_to_fit();
+    return listing;
+}
+
+bool DirectoryCache::isCurrent(const DirectoryListing &listing, const struct stat &directory) {
+    return listing.error == 0 && listing.device == directory.st_dev && listing.inode == directory.st_ino &&
+           listing.mtime == directory.st_mtime;
+}
+
+void DirectoryCache::clear() {
+    entries.clear();
+    lru.clear();
+    currentSize = 0;
+}
+
+void DirectoryCache::remove(const std::unordered_map<std::string, Entry>::iterator it) {
+    currentSize -= it->second.size;
+    lru.erase(it->second.lruIt);
+    entries.erase(it);
+}
+
+void DirectoryCache::evict() {
+    while (currentSize > maxSize && !lru.empty()) {
+        remove(entries.find(lru.back()));
+        MetricHandler::incrementMetric("autoindex_cache_evictions", 1);
+    }
+}
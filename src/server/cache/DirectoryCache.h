@@ -0,0 +1,76 @@
+//
+// Created by Emil Ebert on 18.10.26.
+//
+
+#ifndef DIRECTORYCACHE_H
+#define DIRECTORYCACHE_H
+
+#include <string>
+#include <list>
+#include <memory>
+#include <vector>
+#include <unordered_map>
+#include <ctime>
+#include <sys/stat.h>
+
+struct DirectoryEntry {
+    std::string name;
+    bool directory;
+};
+
+// names of a directory sorted by name, without . and ..
+struct DirectoryListing {
+    int error = 0; // errno if the directory could not be read
+    dev_t device = 0;
+    ino_t inode = 0;
+    std::time_t mtime = 0;
+    // false if the directory changed in the second it was read, its mtime would not tell a later change apart
+    bool cacheable = false;
+    std::vector<DirectoryEntry> entries;
+
+    [[nodiscard]] size_t getMemoryUsage() const;
+};
+
+// listings of directories used by autoindex, an entry is valid as long as the mtime of its directory is the same.
+// sizes and times of the files are not part of it, because changing them does not touch the directory
+class DirectoryCache {
+private:
+    struct Entry {
+        std::shared_ptr<const DirectoryListing> listing;
+        size_t size;
+        std::list<std::string>::iterator lruIt;
+    };
+
+    static std::unordered_map<std::string, Entry> entries;
+    static std::list<std::string> lru;
+    static size_t maxSize;
+    static size_t currentSize;
+
+public:
+    static void configure(size_t maxSize);
+
+    // the last listing of path, the caller checks it with isCurrent before using it
+    static std::shared_ptr<const DirectoryListing> find(const std::string &path);
+
+    static void store(const std::string &path, const std::shared_ptr<const DirectoryListing> &listing);
+
+    // reads and sorts the directory without the cache, d_type is used so only links and unknown types are stat'ed.
+    // it only makes syscalls, so it can run on any thread
+    static std::shared_ptr<const DirectoryListing> read(const std::string &path);
+
+    [[nodiscard]] static bool isCurrent(const DirectoryListing &listing, const struct stat &directory);
+
+    static void clear();
+
+    static size_t getEntryCount() { return entries.size(); }
+
+    static size_t getSize() { return currentSize; }
+
+private:
+    static void remove(std::unordered_map<std::string, Entry>::iterator it);
+
+    static void evict();
+};
+
+
+#endif //DIRECTORYCACHE_H
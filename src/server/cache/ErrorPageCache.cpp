@@ -0,0 +1,151 @@
+//
+// Created by Emil Ebert on 18.10.26.
+//
+
+#include "ErrorPageCache.h"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <filesystem>
+#include <common/Logger.h>
+#include <server/cache/OpenFileCache.h>
+#include <server/handler/FileWatcher.h>
+#include <server/requestHandler/RequestHandler.h>
+#include <webserv.h>
+
+std::unordered_map<std::string, ErrorPageCache::Page> ErrorPageCache::pages;
+std::unordered_set<std::string> ErrorPageCache::watchedDirectories;
+
+void ErrorPageCache::configure(const std::vector<ServerConfig> &configs) {
+    clear();
+    for (const ServerConfig &config: configs) {
+        for (const auto &[statusCode, path]: config.error_pages)
+            preload(path, statusCode);
+        for (const RouteConfig &route: config.routes)
+            for (const auto &[statusCode, path]: route.error_pages)
+                preload(path, statusCode);
+    }
+    Logger::log(LogLevel::DEBUG, "Error page cache loaded " + std::to_string(pages.size()) + " pages");
+}
+
+std::shared_ptr<const PrerenderedResponse> ErrorPageCache::get(const std::string &path, const int statusCode) {
+    const std::string key = OpenFileCache::normalizePath(path);
+    Page &page = pages.count(key) ? pages[key] : preload(path, statusCode);
+    if (page.stale || isChanged(key, page))
+        load(key, page);
+    if (!page.valid)
+        return nullptr;
+
+    if (const auto it = page.responses.find(statusCode); it != page.responses.end())
+        return it->second;
+    return page.responses[statusCode] = render(page, statusCode);
+}
+
+void ErrorPageCache::clear() {
+    pages.clear();
+    watchedDirectories.clear();
+}
+
+ErrorPageCache::Page &ErrorPageCache::preload(const std::string &path, const int statusCode) {
+    const std::string key = OpenFileCache::normalizePath(path);
+    const bool loaded = pages.count(key) > 0;
+    Page &page = pages[key];
+    page.statusCodes.insert(statusCode);
+    if (loaded) {
+        if (page.valid && !page.responses.count(statusCode))
+            page.responses[statusCode] = render(page, statusCode);
+        return page;
+    }
+
+    watch(key);
+    load(key, page);
+    return page;
+}
+
+void ErrorPageCache::load(const std::string &path, Page &page) {
+    page.stale = false;
+    page.valid = false;
+    page.body.clear();
+    page.responses.clear();
+    page.checkedAt = std::time(nullptr);
+
+    struct stat st{};
+    const int fd = open(path.c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0 || fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        Logger::log(LogLevel::ERROR, "error page has an invalid path: " + path);
+        if (fd >= 0)
+            close(fd);
+        return;
+    }
+    page.mtime = st.st_mtime;
+    page.size = st.st_size;
+    if (st.st_size > ERROR_PAGE_MAX_SIZE) {
+        Logger::log(LogLevel::ERROR, "error page is larger than " + std::to_string(ERROR_PAGE_MAX_SIZE) +
+                                     " bytes: " + path);
+        close(fd);
+        return;
+    }
+
+    page.body.resize(st.st_size);
+    size_t total = 0;
+    ssize_t bytesRead = 0;
+    while (total < page.body.size() && (bytesRead = read(fd, &page.body[total], page.body.size() - total)) > 0)
+        total += bytesRead;
+    close(fd);
+    if (bytesRead < 0) {
+        Logger::log(LogLevel::ERROR, "error page can't be read: " + path);
+        page.body.clear();
+        return;
+    }
+    page.body.resize(total);
+    page.contentType = RequestHandler::getMimeType(path);
+    page.valid = true;
+
+    for (const int statusCode: page.statusCodes)
+        page.responses[statusCode] = render(page, statusCode);
+}
+
+std::shared_ptr<const PrerenderedResponse> ErrorPageCache::render(const Page &page, const int statusCode) {
+    HttpResponse base(statusCode);
+    base.setHeader("Content-Type", page.contentType);
+    return base.prerenderCompressible(page.body);
+}
+
+bool ErrorPageCache::isChanged(const std::string &path, Page &page) {
+    const std::time_t now = std::time(nullptr);
+    if (page.watched || now == page.checkedAt)
+        return false;
+    page.checkedAt = now;
+
+    struct stat st{};
+    if (stat(path.c_str(), &st) != 0)
+        return page.valid;
+    return st.st_mtime != page.mtime || st.st_size != page.size;
+}
+
+void ErrorPageCache::watch(const std::string &path) {
+    const std::string directory = std::filesystem::path(path).parent_path().string();
+    if (directory.empty())
+        return;
+    if (!watchedDirectories.count(directory)) {
+        const bool watching = FileWatcher::watch(directory, [directory](const std::string &name) {
+            // without a name the directory itself went away and with it the watch, the pages fall back to stat
+            if (name.empty())
+                watchedDirectories.erase(directory);
+            for (auto &[pagePath, page]: pages) {
+                const std::filesystem::path file(pagePath);
+                if (file.parent_path() != directory)
+                    continue;
+                if (name.empty())
+                    page.watched = false;
+                if (name.empty() || file.filename() == name)
+                    page.stale = true;
+            }
+        });
+        if (!watching)
+            return;
+        watchedDirectories.insert(directory);
+    }
+    pages[path].watched = true;
+}
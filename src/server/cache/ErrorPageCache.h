@@ -0,0 +1,61 @@
+//
+// Created by Emil Ebert on 18.10.26.
+//
+
+#ifndef ERRORPAGECACHE_H
+#define ERRORPAGECACHE_H
+
+#include <string>
+#include <set>
+#include <memory>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+#include <ctime>
+#include <config/config.h>
+#include <server/response/HttpResponse.h>
+
+// files of error_page, read when the config is loaded and prerendered for the status codes they are configured for.
+// a page is read again once its directory reports a change, without a watch it is checked at most once per second
+class ErrorPageCache {
+private:
+    struct Page {
+        bool valid = false; // false if the file can't be served, the built-in page is used then
+        bool stale = false;
+        bool watched = false;
+        std::string body;
+        std::string contentType;
+        std::time_t mtime = 0;
+        off_t size = 0;
+        std::time_t checkedAt = 0;
+        std::set<int> statusCodes;
+        std::unordered_map<int, std::shared_ptr<const PrerenderedResponse> > responses;
+    };
+
+    static std::unordered_map<std::string, Page> pages;
+    static std::unordered_set<std::string> watchedDirectories;
+
+public:
+    static void configure(const std::vector<ServerConfig> &configs);
+
+    // the response of the page for statusCode, nullptr if the page can't be read
+    static std::shared_ptr<const PrerenderedResponse> get(const std::string &path, int statusCode);
+
+    static void clear();
+
+    static size_t getPageCount() { return pages.size(); }
+
+private:
+    static Page &preload(const std::string &path, int statusCode);
+
+    static void load(const std::string &path, Page &page);
+
+    static std::shared_ptr<const PrerenderedResponse> render(const Page &page, int statusCode);
+
+    static bool isChanged(const std::string &path, Page &page);
+
+    static void watch(const std::string &path);
+};
+
+
+#endif //ERRORPAGECACHE_H
@@ -0,0 +1,184 @@
+//
+// Created by Emil Ebert on 18.10.26.
+//
+
+#include "OpenFileCache.h"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <cerrno>
+#include <filesystem>
+#include <server/handler/FileWatcher.h>
+#include <common/Logger.h>
+#include <server/handler/MetricHandler.h>
+#include <server/requestHandler/RequestHandler.h>
+
+std::unordered_map<std::string, OpenFileCache::Entry> OpenFileCache::entries;
+std::list<std::string> OpenFileCache::lru;
+size_t OpenFileCache::maxEntries = 0;
+std::time_t OpenFileCache::validTime = 0;
+std::unordered_set<std::string> OpenFileCache::watchedDirectories;
+
+OpenFileInfo::~OpenFileInfo() {
+    if (fd >= 0)
+        close(fd);
+}
+
+void OpenFileCache::configure(const size_t maxEntries, const std::time_t validTime) {
+    clear();
+    OpenFileCache::maxEntries = maxEntries;
+    OpenFileCache::validTime = validTime;
+    Logger::log(LogLevel::DEBUG, "Open file cache configured with " + std::to_string(maxEntries) + " entries");
+}
+
+std::shared_ptr<const OpenFileInfo> OpenFileCache::lookup(const std::string &path) {
+    if (maxEntries == 0)
+        return load(path);
+
+    const std::time_t now = std::time(nullptr);
+    const std::string key = normalizePath(path);
+    const auto it = entries.find(key);
+    if (it != entries.end()) {
+        Entry &entry = it->second;
+        if (now - entry.validatedAt <= validTime || isUnchanged(*entry.info, path)) {
+            if (now - entry.validatedAt > validTime)
+                entry.validatedAt = now;
+            lru.splice(lru.begin(), lru, entry.lruIt);
+            MetricHandler::incrementMetric("open_file_cache_hits", 1);
+            return entry.info;
+        }
+        lru.erase(entry.lruIt);
+        entries.erase(it);
+    }
+
+    MetricHandler::incrementMetric("open_file_cache_misses", 1);
+    auto info = load(path);
+    store(path, info);
+    return info;
+}
+
+std::shared_ptr<const OpenFileInfo> OpenFileCache::find(const std::string &path) {
+    const auto it = entries.find(normalizePath(path));
+    if (it == entries.end() || std::time(nullptr) - it->second.validatedAt > validTime)
+        return nullptr;
+    lru.splice(lru.begin(), lru, it->second.lruIt);
+    MetricHandler::incrementMetric("open_file_cache_hits", 1);
+    return it->second.info;
+}
+
+void OpenFileCache::store(const std::string &path, const std::shared_ptr<const OpenFileInfo> &info) {
+    if (maxEntries == 0)
+        return;
+
+    const std::string key = normalizePath(path);
+    if (const auto it = entries.find(key); it != entries.end()) {
+        lru.erase(it->second.lruIt);
+        entries.erase(it);
+    }
+    lru.push_front(key);
+    entries[key] = {info, std::time(nullptr), lru.begin()};
+    watchDirectory(key);
+    evict();
+}
+
+int OpenFileCache::openFd(const OpenFileInfo &info) {
+    if (info.fd < 0)
+        return -1;
+    return fcntl(info.fd, F_DUPFD_CLOEXEC, 0);
+}
+
+void OpenFileCache::invalidate(const std::string &path) {
+    const auto it = entries.find(normalizePath(path));
+    if (it == entries.end())
+        return;
+    lru.erase(it->second.lruIt);
+    entries.erase(it);
+}
+
+void OpenFileCache::invalidateDirectory(const std::string &directory) {
+    for (auto it = entries.begin(); it != entries.end();) {
+        if (std::filesystem::path(it->first).parent_path() == directory) {
+            lru.erase(it->second.lruIt);
+            it = entries.erase(it);
+        } else
+            ++it;
+    }
+}
+
+std::string OpenFileCache::normalizePath(const std::string &path) {
+    return std::filesystem::path(path).lexically_normal().string();
+}
+
+void OpenFileCache::clear() {
+    entries.clear();
+    lru.clear();
+    watchedDirectories.clear();
+}
+
+std::shared_ptr<const OpenFileInfo> OpenFileCache::load(const std::string &path) {
+    auto info = std::make_shared<OpenFileInfo>();
+
+    // O_NONBLOCK so a fifo in the document root can't stall the event loop on open
+    const int fd = open(path.c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0) {
+        info->error = errno;
+        // keep the type of paths we are not allowed to read, so a directory still is a directory
+        if (info->error == EACCES && stat(path.c_str(), &info->st) == 0 && S_ISDIR(info->st.st_mode))
+            info->error = 0;
+        return info;
+    }
+
+    if (fstat(fd, &info->st) < 0) {
+        info->error = errno;
+        close(fd);
+        return info;
+    }
+
+    if (!S_ISREG(info->st.st_mode)) {
+        close(fd);
+        return info;
+    }
+
+    info->fd = fd;
+    info->mimeType = RequestHandler::getMimeType(path);
+    info->etag = RequestHandler::createETag(info->st);
+    info->lastModified = RequestHandler::formatHttpDate(info->st.st_mtime);
+    return info;
+}
+
+bool OpenFileCache::isUnchanged(const OpenFileInfo &info, const std::string &path) {
+    struct stat current{};
+    if (stat(path.c_str(), &current) < 0)
+        return !info.exists() && errno == info.error;
+
+    return info.exists() &&
+           current.st_ino == info.st.st_ino &&
+           current.st_dev == info.st.st_dev &&
+           current.st_size == info.st.st_size &&
+           current.st_mtime == info.st.st_mtime;
+}
+
+// with inotify available changes are seen right away, the valid time only matters as a fallback
+void OpenFileCache::watchDirectory(const std::string &path) {
+    const std::string directory = std::filesystem::path(path).parent_path().string();
+    if (directory.empty() || watchedDirectories.count(directory))
+        return;
+
+    const bool watching = FileWatcher::watch(directory, [directory](const std::string &name) {
+        if (name.empty()) {
+            watchedDirectories.erase(directory);
+            invalidateDirectory(directory);
+        } else
+            invalidate((std::filesystem::path(directory) / name).string());
+    });
+    if (watching)
+        watchedDirectories.insert(directory);
+}
+
+void OpenFileCache::evict() {
+    while (entries.size() > maxEntries && !lru.empty()) {
+        entries.erase(lru.back());
+        lru.pop_back();
+        MetricHandler::incrementMetric("open_file_cache_evictions", 1);
+    }
+}
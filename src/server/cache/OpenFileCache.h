@@ -0,0 +1,93 @@
+//
+// Created by Emil Ebert on 18.10.26.
+//
+
+#ifndef OPENFILECACHE_H
+#define OPENFILECACHE_H
+
+#include <string>
+#include <list>
+#include <memory>
+#include <unordered_map>
+#include <unordered_set>
+#include <ctime>
+#include <sys/stat.h>
+
+// result of a single path lookup, shared between the cache and the handlers using it
+struct OpenFileInfo {
+    int error = 0; // errno of the failed lookup, 0 if the path exists
+    struct stat st{};
+    int fd = -1; // read only fd, only opened for regular files
+    std::string mimeType;
+    // validators of regular files, formatted once when the file is looked up
+    std::string etag;
+    std::string lastModified;
+
+    OpenFileInfo() = default;
+
+    OpenFileInfo(const OpenFileInfo &) = delete;
+
+    OpenFileInfo &operator=(const OpenFileInfo &) = delete;
+
+    ~OpenFileInfo();
+
+    [[nodiscard]] bool exists() const { return error == 0; }
+    [[nodiscard]] bool isFile() const { return error == 0 && S_ISREG(st.st_mode); }
+    [[nodiscard]] bool isDirectory() const { return error == 0 && S_ISDIR(st.st_mode); }
+};
+
+class OpenFileCache {
+private:
+    struct Entry {
+        std::shared_ptr<const OpenFileInfo> info;
+        std::time_t validatedAt;
+        std::list<std::string>::iterator lruIt;
+    };
+
+    static std::unordered_map<std::string, Entry> entries;
+    static std::list<std::string> lru;
+    static size_t maxEntries;
+    static std::time_t validTime;
+    static std::unordered_set<std::string> watchedDirectories;
+
+public:
+    static void configure(size_t maxEntries, std::time_t validTime);
+
+    // returns the cached lookup of path, the result is never null
+    static std::shared_ptr<const OpenFileInfo> lookup(const std::string &path);
+
+    // the cached lookup of path if it can be used without touching the disk, nullptr otherwise
+    static std::shared_ptr<const OpenFileInfo> find(const std::string &path);
+
+    // caches a lookup that was loaded elsewhere, like on the thread pool
+    static void store(const std::string &path, const std::shared_ptr<const OpenFileInfo> &info);
+
+    // looks path up without the cache, it only makes syscalls, so it can run on any thread
+    static std::shared_ptr<const OpenFileInfo> load(const std::string &path);
+
+    // dup of the cached fd, so every response can own and close its own descriptor
+    static int openFd(const OpenFileInfo &info);
+
+    static void invalidate(const std::string &path);
+
+    static void invalidateDirectory(const std::string &directory);
+
+    // cache keys are lexically normalized, so ./www/a and www//a share an entry
+    static std::string normalizePath(const std::string &path);
+
+    static void clear();
+
+    [[nodiscard]] static bool isEnabled() { return maxEntries > 0; }
+
+    static size_t size() { return entries.size(); }
+
+private:
+    static bool isUnchanged(const OpenFileInfo &info, const std::string &path);
+
+    static void evict();
+
+    static void watchDirectory(const std::string &path);
+};
+
+
+#endif //OPENFILECACHE_H
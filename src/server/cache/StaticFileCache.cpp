@@ -0,0 +1,161 @@
+//
+// Created by Emil Ebert on 18.10.26.
+//
+
+#include "StaticFileCache.h"
+
+#include <unistd.h>
+#include <filesystem>
+#include <common/Logger.h>
+#include <server/handler/FileWatcher.h>
+#include <server/handler/MetricHandler.h>
+
+#include "OpenFileCache.h"
+#include <server/response/GzipEncoder.h>
+
+size_t StaticFileCache::totalSize = 0;
+
+StaticFileCache::StaticFileCache(const size_t maxSize, const size_t maxFileSize): maxSize(maxSize),
+    maxFileSize(maxFileSize) {
+}
+
+StaticFileCache::~StaticFileCache() {
+    totalSize -= currentSize;
+}
+
+bool StaticFileCache::accepts(const OpenFileInfo &file) const {
+    return file.isFile() && file.fd >= 0 && static_cast<size_t>(file.st.st_size) <= maxFileSize &&
+           static_cast<size_t>(file.st.st_size) < maxSize;
+}
+
+std::shared_ptr<const PrerenderedResponse> StaticFileCache::get(const std::string &path, const OpenFileInfo &file,
+                                                                const bool gzip) {
+    const auto it = entries.find(createKey(path, gzip));
+    if (it == entries.end()) {
+        MetricHandler::incrementMetric("static_cache_misses", 1);
+        return nullptr;
+    }
+
+    // the open file cache revalidates its entries, so this also catches changes without inotify
+    const Entry &entry = it->second;
+    if (entry.inode != file.st.st_ino || entry.fileSize != file.st.st_size || entry.mtime != file.st.st_mtime) {
+        remove(it);
+        MetricHandler::incrementMetric("static_cache_misses", 1);
+        return nullptr;
+    }
+
+    lru.splice(lru.begin(), lru, entry.lruIt);
+    MetricHandler::incrementMetric("static_cache_hits", 1);
+    return entry.response;
+}
+
+std::shared_ptr<const PrerenderedResponse> StaticFileCache::put(const std::string &path, const OpenFileInfo &file,
+                                                                const HttpResponse &base, const int gzipLevel) {
+    std::string body;
+    if (!readFile(file, body))
+        return nullptr;
+    HttpResponse variant = base;
+    if (gzipLevel > 0) {
+        // without an encoder nothing is cached and the caller sends the file as it is
+        body = GzipEncoder::compressAll(body, gzipLevel);
+        if (body.empty())
+            return nullptr;
+        variant.setHeader("Content-Encoding", "gzip");
+    }
+
+    const std::shared_ptr<const PrerenderedResponse> response = variant.prerender(std::move(body));
+    const std::string key = createKey(path, gzipLevel > 0);
+
+    if (const auto it = entries.find(key); it != entries.end())
+        remove(it);
+
+    if (response->size() > maxSize)
+        return response;
+
+    const std::string directory = std::filesystem::path(normalize(path)).parent_path().string();
+    if (!directory.empty() && !watchedDirectories.count(directory)) {
+        std::weak_ptr<StaticFileCache> weakCache = weak_from_this();
+        const bool watching = FileWatcher::watch(directory, [weakCache, directory](const std::string &name) {
+            const auto cache = weakCache.lock();
+            if (!cache)
+                return;
+            if (name.empty()) {
+                cache->watchedDirectories.erase(directory);
+                cache->invalidateDirectory(directory);
+            } else
+                cache->invalidate((std::filesystem::path(directory) / name).string());
+        });
+        if (watching)
+            watchedDirectories.insert(directory);
+    }
+
+    lru.push_front(key);
+    entries[key] = {response, file.st.st_ino, file.st.st_size, file.st.st_mtime, lru.begin()};
+    currentSize += response->size();
+    totalSize += response->size();
+    evict();
+    return response;
+}
+
+void StaticFileCache::invalidate(const std::string &path) {
+    for (const bool gzip: {false, true}) {
+        const auto it = entries.find(createKey(path, gzip));
+        if (it == entries.end())
+            continue;
+        Logger::log(LogLevel::DEBUG, "Static cache invalidated: " + normalize(path));
+        remove(it);
+    }
+}
+
+void StaticFileCache::invalidateDirectory(const std::string &directory) {
+    for (auto it = entries.begin(); it != entries.end();) {
+        if (std::filesystem::path(it->first).parent_path() == directory) {
+            const auto next = std::next(it);
+            remove(it);
+            it = next;
+        } else
+            ++it;
+    }
+}
+
+void StaticFileCache::remove(const std::unordered_map<std::string, Entry>::iterator it) {
+    currentSize -= it->second.response->size();
+    totalSize -= it->second.response->size();
+    lru.erase(it->second.lruIt);
+    entries.erase(it);
+}
+
+void StaticFileCache::evict() {
+    while (currentSize > maxSize && !lru.empty()) {
+        remove(entries.find(lru.back()));
+        MetricHandler::incrementMetric("static_cache_evictions", 1);
+    }
+}
+
+std::string StaticFileCache::normalize(const std::string &path) {
+    return OpenFileCache::normalizePath(path);
+}
+
+// paths can't contain a null byte, so the suffix never collides with another file
+std::string StaticFileCache::createKey(const std::string &path, const bool gzip) {
+    return gzip ? normalize(path) + std::string("\0gzip", 5) : normalize(path);
+}
+
+bool StaticFileCache::readFile(const OpenFileInfo &file, std::string &out) {
+    const size_t size = file.st.st_size;
+    out.resize(size);
+
+    size_t offset = 0;
+    while (offset < size) {
+        const ssize_t bytesRead = pread(file.fd, out.data() + offset, size - offset, static_cast<off_t>(offset));
+        if (bytesRead < 0) {
+            Logger::log(LogLevel::ERROR, "Failed to read file for static cache: " + std::to_string(file.fd));
+            return false;
+        }
+        if (bytesRead == 0)
+            break;
+        offset += bytesRead;
+    }
+    out.resize(offset);
+    return offset == size;
+}
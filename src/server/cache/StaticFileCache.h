@@ -0,0 +1,77 @@
+//
+// Created by Emil Ebert on 18.10.26.
+//
+
+#ifndef STATICFILECACHE_H
+#define STATICFILECACHE_H
+
+#include <string>
+#include <list>
+#include <memory>
+#include <unordered_map>
+#include <unordered_set>
+#include <server/response/HttpResponse.h>
+
+struct OpenFileInfo;
+
+// per server LRU cache holding complete responses of small static files,
+// entries are dropped as soon as the watched directory reports a change
+class StaticFileCache : public std::enable_shared_from_this<StaticFileCache> {
+private:
+    struct Entry {
+        std::shared_ptr<const PrerenderedResponse> response;
+        ino_t inode;
+        off_t fileSize;
+        time_t mtime;
+        std::list<std::string>::iterator lruIt;
+    };
+
+    static size_t totalSize;
+    const size_t maxSize;
+    const size_t maxFileSize;
+    size_t currentSize = 0;
+    std::unordered_map<std::string, Entry> entries;
+    std::list<std::string> lru;
+    std::unordered_set<std::string> watchedDirectories;
+
+public:
+    StaticFileCache(size_t maxSize, size_t maxFileSize);
+
+    ~StaticFileCache();
+
+    [[nodiscard]] bool accepts(const OpenFileInfo &file) const;
+
+    // gzip selects the compressed variant, both variants of a file are cached independently
+    std::shared_ptr<const PrerenderedResponse> get(const std::string &path, const OpenFileInfo &file,
+                                                   bool gzip = false);
+
+    // reads the file and stores the response rendered from base, returns nullptr if the file can't be read.
+    // with a gzipLevel the body is stored compressed
+    std::shared_ptr<const PrerenderedResponse> put(const std::string &path, const OpenFileInfo &file,
+                                                   const HttpResponse &base, int gzipLevel = 0);
+
+    void invalidate(const std::string &path);
+
+    void invalidateDirectory(const std::string &directory);
+
+    [[nodiscard]] size_t getSize() const { return currentSize; }
+
+    [[nodiscard]] size_t getEntryCount() const { return entries.size(); }
+
+    // bytes held by the caches of all servers
+    static size_t getTotalSize() { return totalSize; }
+
+private:
+    void remove(std::unordered_map<std::string, Entry>::iterator it);
+
+    void evict();
+
+    static std::string normalize(const std::string &path);
+
+    static std::string createKey(const std::string &path, bool gzip);
+
+    static bool readFile(const OpenFileInfo &file, std::string &out);
+};
+
+
+#endif //STATICFILECACHE_H
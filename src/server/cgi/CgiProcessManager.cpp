@@ -0,0 +1,243 @@
+//
+// Created by Emil Ebert on 18.10.26.
+//
+
+#include "CgiProcessManager.h"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <csignal>
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+#include <sys/wait.h>
+#include <sys/syscall.h>
+#include <common/Logger.h>
+#include <server/FdHandler.h>
+#include <server/handler/CallbackHandler.h>
+#include <server/handler/MetricHandler.h>
+#include <webserv.h>
+
+size_t CgiProcessManager::maxConcurrent = 0;
+size_t CgiProcessManager::maxQueueSize = 0;
+size_t CgiProcessManager::runningTotal = 0;
+std::unordered_map<std::string, size_t> CgiProcessManager::running;
+std::deque<std::shared_ptr<CgiProcessManager::Ticket> > CgiProcessManager::queue;
+std::unordered_map<pid_t, CgiProcessManager::Process> CgiProcessManager::processes;
+ssize_t CgiProcessManager::pollCallbackId = -1;
+ssize_t CgiProcessManager::killCallbackId = -1;
+std::time_t CgiProcessManager::lastKillCheck = 0;
+size_t CgiProcessManager::maxQueueDepth = 0;
+size_t CgiProcessManager::dequeuedTickets = 0;
+std::chrono::steady_clock::duration CgiProcessManager::totalQueueTime{};
+
+void CgiProcessManager::configure(const size_t maxConcurrent, const size_t queueSize) {
+    CgiProcessManager::maxConcurrent = maxConcurrent;
+    maxQueueSize = queueSize;
+}
+
+bool CgiProcessManager::hasSlot(const std::string &location, const size_t locationLimit) {
+    if (maxConcurrent > 0 && runningTotal >= maxConcurrent)
+        return false;
+    if (locationLimit == 0)
+        return true;
+    const auto it = running.find(location);
+    return it == running.end() || it->second < locationLimit;
+}
+
+std::shared_ptr<CgiProcessManager::Ticket> CgiProcessManager::admit(const std::string &location,
+                                                                    const size_t locationLimit, StartCallback start) {
+    auto ticket = std::make_shared<Ticket>();
+    ticket->location = location;
+    ticket->locationLimit = locationLimit;
+    ticket->start = std::move(start);
+    ticket->queuedAt = std::chrono::steady_clock::now();
+
+    // a free slot is only taken if nobody is waiting for it already
+    if (queue.empty() && hasSlot(location, locationLimit)) {
+        ticket->started = true;
+        runningTotal++;
+        running[location]++;
+        return ticket;
+    }
+
+    if (queue.size() >= maxQueueSize) {
+        MetricHandler::incrementMetric("cgi_rejected", 1);
+        Logger::log(LogLevel::WARNING, "CGI queue is full, rejecting request for " + location);
+        return nullptr;
+    }
+    queue.push_back(ticket);
+    maxQueueDepth = std::max(maxQueueDepth, queue.size());
+    MetricHandler::incrementMetric("cgi_queued", 1);
+    return ticket;
+}
+
+void CgiProcessManager::cancel(const std::shared_ptr<Ticket> &ticket) {
+    if (!ticket)
+        return;
+    ticket->start = nullptr;
+    if (ticket->started) {
+        ticket->started = false;
+        release(ticket->location);
+        return;
+    }
+    queue.erase(std::remove(queue.begin(), queue.end(), ticket), queue.end());
+}
+
+void CgiProcessManager::release(const std::string &location) {
+    runningTotal--;
+    if (const auto it = running.find(location); it != running.end() && --it->second == 0)
+        running.erase(it);
+    dispatch();
+}
+
+// starts the oldest waiting tickets whose location still has room
+void CgiProcessManager::dispatch() {
+    for (auto it = queue.begin(); it != queue.end();) {
+        if (maxConcurrent > 0 && runningTotal >= maxConcurrent)
+            return;
+        if (!hasSlot((*it)->location, (*it)->locationLimit)) {
+            ++it;
+            continue;
+        }
+
+        const std::shared_ptr<Ticket> ticket = *it;
+        queue.erase(it);
+        ticket->started = true;
+        runningTotal++;
+        running[ticket->location]++;
+
+        const auto waited = std::chrono::steady_clock::now() - ticket->queuedAt;
+        totalQueueTime += waited;
+        dequeuedTickets++;
+        MetricHandler::incrementMetric("cgi_queue_wait_ms",
+                                       std::chrono::duration_cast<std::chrono::milliseconds>(waited).count());
+
+        // a start that fails cancels the ticket and gives the slot back, which clears ticket->start while it runs.
+        // it is moved out first, and as starting can dispatch recursively the iterator is not reused
+        const StartCallback start = std::move(ticket->start);
+        ticket->start = nullptr;
+        if (start)
+            start();
+        it = queue.begin();
+    }
+}
+
+void CgiProcessManager::watch(const pid_t pid, const std::shared_ptr<Ticket> &ticket, ExitCallback onExit) {
+    Process process;
+    process.location = ticket->location;
+    process.onExit = std::move(onExit);
+    // the slot belongs to the process now
+    ticket->started = false;
+    ticket->start = nullptr;
+
+#ifdef SYS_pidfd_open
+    process.pidfd = static_cast<int>(syscall(SYS_pidfd_open, pid, 0));
+#endif
+    if (process.pidfd >= 0) {
+        fcntl(process.pidfd, F_SETFD, FD_CLOEXEC);
+        FdHandler::addFd(process.pidfd, POLLIN, [pid](const int fd, const short events) {
+            (void) events;
+            int status = 0;
+            if (waitpid(pid, &status, WNOHANG) == 0)
+                return false;
+            // closed after reaping, otherwise a process started from the queue could get the same fd number
+            processes[pid].pidfd = -1;
+            reap(pid, status);
+            close(fd);
+            return true;
+        });
+    } else if (pollCallbackId == -1)
+        pollCallbackId = static_cast<ssize_t>(CallbackHandler::registerCallback(pollExitedProcesses));
+
+    processes[pid] = std::move(process);
+}
+
+bool CgiProcessManager::pollExitedProcesses() {
+    std::vector<std::pair<pid_t, int> > exited;
+    for (const auto &[pid, process]: processes) {
+        int status = 0;
+        if (process.pidfd == -1 && waitpid(pid, &status, WNOHANG) == pid)
+            exited.emplace_back(pid, status);
+    }
+    for (const auto &[pid, status]: exited)
+        reap(pid, status);
+    return false;
+}
+
+void CgiProcessManager::reap(const pid_t pid, const int status) {
+    const auto it = processes.find(pid);
+    if (it == processes.end())
+        return;
+
+    const Process process = std::move(it->second);
+    processes.erase(it);
+    Logger::log(LogLevel::DEBUG, "CGI process " + std::to_string(pid) + " reaped");
+    if (process.onExit)
+        process.onExit(status);
+    release(process.location);
+}
+
+void CgiProcessManager::abandon(const pid_t pid) {
+    const auto it = processes.find(pid);
+    if (it == processes.end())
+        return;
+    it->second.onExit = nullptr;
+    it->second.killAt = std::time(nullptr) + CGI_KILL_TIMEOUT;
+    kill(pid, SIGTERM);
+    if (killCallbackId == -1)
+        killCallbackId = static_cast<ssize_t>(CallbackHandler::registerCallback(killAbandonedProcesses));
+}
+
+// a process is only removed once it was reaped, so its pid can't belong to another process yet.
+// the kill is noticed through the pidfd like any other exit and gives the slot back
+bool CgiProcessManager::killAbandonedProcesses() {
+    const std::time_t now = std::time(nullptr);
+    if (now == lastKillCheck)
+        return false;
+    lastKillCheck = now;
+
+    for (auto &[pid, process]: processes) {
+        if (process.killAt == 0 || now < process.killAt)
+            continue;
+        process.killAt = 0;
+        Logger::log(LogLevel::WARNING, "CGI process " + std::to_string(pid) + " ignored SIGTERM, killing it");
+        MetricHandler::incrementMetric("cgi_killed", 1);
+        kill(pid, SIGKILL);
+    }
+    return false;
+}
+
+void CgiProcessManager::clear() {
+    for (auto &[pid, process]: processes) {
+        if (process.pidfd >= 0) {
+            FdHandler::removeFd(process.pidfd);
+            close(process.pidfd);
+        }
+        kill(pid, SIGKILL);
+        waitpid(pid, nullptr, 0);
+    }
+    processes.clear();
+    queue.clear();
+    running.clear();
+    runningTotal = 0;
+    if (pollCallbackId != -1) {
+        CallbackHandler::unregisterCallback(pollCallbackId);
+        pollCallbackId = -1;
+    }
+    if (killCallbackId != -1) {
+        CallbackHandler::unregisterCallback(killCallbackId);
+        killCallbackId = -1;
+    }
+}
+
+size_t CgiProcessManager::getRetryAfter() {
+    return std::max<size_t>(1, (getAverageQueueMs() + 999) / 1000);
+}
+
+size_t CgiProcessManager::getAverageQueueMs() {
+    if (dequeuedTickets == 0)
+        return 0;
+    return std::chrono::duration_cast<std::chrono::milliseconds>(totalQueueTime).count() / dequeuedTickets;
+}
@@ -0,0 +1,98 @@
+//
+// Created by Emil Ebert on 18.10.26.
+//
+
+#ifndef CGIPROCESSMANAGER_H
+#define CGIPROCESSMANAGER_H
+
+#include <string>
+#include <deque>
+#include <unordered_map>
+#include <functional>
+#include <memory>
+#include <chrono>
+#include <ctime>
+#include <sys/types.h>
+
+// limits how many cgi processes run at once, globally and per location, and reaps them when they exit.
+// requests over the limit wait in one FIFO queue, a full queue is answered with 503
+class CgiProcessManager {
+public:
+    using StartCallback = std::function<void()>;
+    using ExitCallback = std::function<void(int status)>;
+
+    struct Ticket {
+        std::string location;
+        size_t locationLimit = 0;
+        StartCallback start;
+        std::chrono::steady_clock::time_point queuedAt;
+        bool started = false;
+    };
+
+private:
+    struct Process {
+        int pidfd = -1;
+        std::string location;
+        ExitCallback onExit;
+        // set once the process is abandoned, it gets SIGKILL if it is still running then
+        std::time_t killAt = 0;
+    };
+
+    static size_t maxConcurrent;
+    static size_t maxQueueSize;
+    static size_t runningTotal;
+    static std::unordered_map<std::string, size_t> running;
+    static std::deque<std::shared_ptr<Ticket> > queue;
+    static std::unordered_map<pid_t, Process> processes;
+    // processes without a pidfd are waited for once per loop
+    static ssize_t pollCallbackId;
+    // checks the deadlines of abandoned processes once per second
+    static ssize_t killCallbackId;
+    static std::time_t lastKillCheck;
+
+    static size_t maxQueueDepth;
+    static size_t dequeuedTickets;
+    static std::chrono::steady_clock::duration totalQueueTime;
+
+    static bool hasSlot(const std::string &location, size_t locationLimit);
+
+    static void release(const std::string &location);
+
+    static void dispatch();
+
+    static void reap(pid_t pid, int status);
+
+    static bool pollExitedProcesses();
+
+    static bool killAbandonedProcesses();
+
+public:
+    // 0 as max concurrent disables the global limit
+    static void configure(size_t maxConcurrent, size_t queueSize);
+
+    // returns nullptr if the queue is full, a started ticket owns a slot until its process is watched or released
+    static std::shared_ptr<Ticket> admit(const std::string &location, size_t locationLimit, StartCallback start);
+
+    // the owner of a queued ticket is gone, a started ticket gives its slot back
+    static void cancel(const std::shared_ptr<Ticket> &ticket);
+
+    // the slot of a started ticket is freed when pid exits
+    static void watch(pid_t pid, const std::shared_ptr<Ticket> &ticket, ExitCallback onExit);
+
+    // the owner of pid is gone, the process is terminated and still reaped.
+    // one that ignores SIGTERM is killed after CGI_KILL_TIMEOUT seconds, so it can't hold its slot forever
+    static void abandon(pid_t pid);
+
+    static void clear();
+
+    // seconds a client should wait before retrying a rejected request
+    static size_t getRetryAfter();
+
+    static size_t getRunningCount() { return runningTotal; }
+    static size_t getQueueDepth() { return queue.size(); }
+    static size_t getMaxQueueDepth() { return maxQueueDepth; }
+    static size_t getAverageQueueMs();
+};
+
+
+#endif //CGIPROCESSMANAGER_H
@@ -0,0 +1,48 @@
+//
+// Created by Emil Ebert on 18.10.26.
+//
+
+#include "CgiResponseBuilder.h"
+
+#include <common/Logger.h>
+#include <server/buffer/MemoryBudget.h>
+#include <webserv.h>
+
+size_t CgiResponseBuilder::getPendingBytes() const {
+    const auto &body = parser.getResult().body;
+    return body->getSize() - body->getReadPos() + body->getReadBufferSize();
+}
+
+size_t CgiResponseBuilder::getStreamWatermark() {
+    return MemoryBudget::isAboveWatermark() ? BUFFER_SLICE_SIZE : CGI_STREAM_BUFFER_SIZE;
+}
+
+HttpResponse CgiResponseBuilder::createResponse(const std::string &errorMessage) const {
+    if (!parser.hasHeaders())
+        return HttpResponse::html(HttpResponse::BAD_GATEWAY, errorMessage);
+
+    const auto &[headers, body, setCookies] = parser.getResult();
+    int statusCode = HttpResponse::OK;
+    if (const auto it = headers.find("Status"); it != headers.end()) {
+        try {
+            statusCode = std::stoi(it->second.substr(0, 3));
+        } catch (...) {
+            Logger::log(LogLevel::WARNING, "Invalid Status header from cgi backend: " + it->second);
+        }
+    }
+
+    HttpResponse response(statusCode);
+    for (const auto &[name, value]: headers) {
+        if (name != "Status")
+            response.setHeader(name, value);
+    }
+    for (const auto &cookie: setCookies)
+        response.addSetCookie(cookie);
+
+    // the script knows its length, otherwise the body is chunked while it is produced
+    if (parser.getContentLength() != -1)
+        response.setLengthDelimitedBody(body, parser.getContentLength());
+    else
+        response.enableChunkedEncoding(body);
+    return response;
+}
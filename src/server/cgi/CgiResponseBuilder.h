@@ -0,0 +1,56 @@
+//
+// Created by Emil Ebert on 18.10.26.
+//
+
+#ifndef CGIRESPONSEBUILDER_H
+#define CGIRESPONSEBUILDER_H
+
+#include <string>
+#include <parser/cgi/CgiParser.h>
+#include <server/response/HttpResponse.h>
+
+// collects the output of a cgi script (headers, empty line, body) that arrives in pieces from a backend
+class CgiResponseBuilder {
+private:
+    CgiParser parser;
+
+public:
+    // returns true once the headers are complete
+    bool append(const char *data, size_t length) { return parser.parse(data, length); }
+
+    // the backend finished its output
+    void finish() { parser.finish(); }
+
+    [[nodiscard]] bool hasHeaders() const { return parser.hasHeaders(); }
+
+    [[nodiscard]] bool isComplete() const { return parser.isComplete(); }
+
+    [[nodiscard]] bool hasError() const { return parser.hasError(); }
+
+    [[nodiscard]] bool isTruncated() const { return parser.isTruncated(); }
+
+    // body bytes that were produced but not sent to the client yet
+    [[nodiscard]] size_t getPendingBytes() const;
+
+    // the backend is not read while more than this is pending, less is buffered while memory is running out
+    [[nodiscard]] static size_t getStreamWatermark();
+
+    // body bytes that went from the backend to the client without being buffered
+    void skipBody(const size_t length) { parser.skipBody(length); }
+
+    [[nodiscard]] size_t getRemainingBody() const { return parser.getRemainingBody(); }
+
+    [[nodiscard]] const std::shared_ptr<SmartBuffer> &getBody() const { return parser.getResult().body; }
+
+    void copyBody(const size_t limit) { parser.copyBody(limit); }
+
+    [[nodiscard]] const std::string *getBodyCopy() const { return parser.getBodyCopy(); }
+
+    [[nodiscard]] bool hasSetCookie() const { return !parser.getResult().setCookies.empty(); }
+
+    // a 502 if the backend never finished its headers, the body can still be streaming
+    [[nodiscard]] HttpResponse createResponse(const std::string &errorMessage) const;
+};
+
+
+#endif //CGIRESPONSEBUILDER_H
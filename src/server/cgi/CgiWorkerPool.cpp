@@ -0,0 +1,414 @@
+//
+// Created by Emil Ebert on 18.10.26.
+//
+
+#include "CgiWorkerPool.h"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <algorithm>
+#include <filesystem>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <common/Logger.h>
+#include <server/FdHandler.h>
+#include <server/handler/CallbackHandler.h>
+#include <server/handler/MetricHandler.h>
+
+// the request body is only read while less than this is waiting to be sent to the worker
+#define CGI_WORKER_WRITE_BUFFER_LIMIT (64 * 1024)
+// seconds no worker is started after one could not be started or exited before it served a request
+#define CGI_WORKER_SPAWN_BACKOFF 5
+
+// reads SCGI requests from fd 0 and forks the interpreter for every script, so nothing a script imports or changes
+// stays for the next one. the output goes back over fd 0 as 4 byte big endian length frames whenever the script
+// flushes or the buffer is full, a frame of length 0 ends a response
+static const char *PYTHON_WORKER = R"PY(
+import atexit, io, os, runpy, struct, sys, traceback
+environment = dict(os.environ)
+def receive(length):
+    data = b''
+    while len(data) < length:
+        chunk = os.read(0, length - len(data))
+        if not chunk:
+            sys.exit(0)
+        data += chunk
+    return data
+def send(data):
+    view = memoryview(data)
+    while view:
+        view = view[os.write(0, view):]
+class Output(io.RawIOBase):
+    def writable(self):
+        return True
+    def write(self, data):
+        send(struct.pack('>I', len(data)) + bytes(data))
+        return len(data)
+def run(script, headers, body):
+    os.environ.clear()
+    os.environ.update(environment)
+    os.environ.update(headers)
+    os.chdir(os.path.dirname(script))
+    sys.stdin = io.TextIOWrapper(io.BytesIO(body), encoding='utf-8', errors='replace')
+    sys.stdout = io.TextIOWrapper(io.BufferedWriter(Output(), 65536), encoding='utf-8')
+    sys.argv = [script]
+    sys.path[0] = os.path.dirname(script)
+    try:
+        runpy.run_path(script, run_name='__main__')
+    except SystemExit:
+        pass
+    except BaseException:
+        traceback.print_exc()
+    atexit._run_exitfuncs()
+    sys.stdout.flush()
+while True:
+    length = b''
+    while not length.endswith(b':'):
+        length += receive(1)
+    fields = receive(int(length[:-1]) + 1)[:-1].split(b'\0')
+    headers = {fields[i].decode('latin-1'): fields[i + 1].decode('latin-1') for i in range(0, len(fields) - 1, 2)}
+    body = receive(int(headers['CONTENT_LENGTH']))
+    script = headers.pop('WEBSERV_SCRIPT_PATH')
+    pid = os.fork()
+    if pid == 0:
+        try:
+            run(script, headers, body)
+        finally:
+            os._exit(0)
+    os.waitpid(pid, 0)
+    send(struct.pack('>I', 0))
+)PY";
+
+std::map<std::string, std::unique_ptr<CgiWorkerPool> > CgiWorkerPool::pools;
+
+CgiWorkerPool::CgiWorkerPool(std::string interpreter, const RouteConfig &route,
+                             const size_t requestTimeout): interpreter(std::move(interpreter)),
+                                                           minWorkers(route.cgi_workers_min),
+                                                           maxWorkers(std::max<size_t>(1, route.cgi_workers_max)),
+                                                           maxRequestsPerWorker(route.cgi_worker_max_requests),
+                                                           idleTimeout(route.cgi_worker_idle_timeout),
+                                                           requestTimeout(requestTimeout) {
+    callbackId = CallbackHandler::registerCallback([this]() {
+        maintain();
+        dispatch();
+        return false;
+    });
+}
+
+CgiWorkerPool::~CgiWorkerPool() {
+    CallbackHandler::unregisterCallback(callbackId);
+    for (const auto &worker: workers) {
+        FdHandler::removeFd(worker->fd);
+        close(worker->fd);
+        kill(-worker->pid, SIGTERM);
+        exitedWorkers.push_back(worker->pid);
+    }
+    for (const pid_t pid: exitedWorkers)
+        waitpid(pid, nullptr, 0);
+}
+
+CgiWorkerPool &CgiWorkerPool::get(const std::string &interpreter, const RouteConfig &route,
+                                  const size_t requestTimeout) {
+    const std::string key = interpreter + " " + route.location;
+    auto it = pools.find(key);
+    if (it == pools.end())
+        it = pools.emplace(key, std::make_unique<CgiWorkerPool>(interpreter, route, requestTimeout)).first;
+    return *it->second;
+}
+
+void CgiWorkerPool::clear() {
+    pools.clear();
+}
+
+bool CgiWorkerPool::isSupported(const std::string &interpreter) {
+    return std::filesystem::path(interpreter).filename().string().rfind("python", 0) == 0;
+}
+
+size_t CgiWorkerPool::getBusyWorkerCount() const {
+    return std::count_if(workers.begin(), workers.end(), [](const std::unique_ptr<Worker> &worker) {
+        return worker->request != nullptr;
+    });
+}
+
+void CgiWorkerPool::submit(const std::shared_ptr<CgiWorkerRequest> &request) {
+    queue.push_back(request);
+    maxQueueDepth = std::max(maxQueueDepth, queue.size());
+    MetricHandler::incrementMetric("cgi_worker_requests", 1);
+    dispatch();
+    if (std::find(queue.begin(), queue.end(), request) != queue.end())
+        MetricHandler::incrementMetric("cgi_worker_queued", 1);
+}
+
+void CgiWorkerPool::cancel(const std::shared_ptr<CgiWorkerRequest> &request) {
+    request->cancel();
+    if (const auto it = std::find(queue.begin(), queue.end(), request); it != queue.end())
+        queue.erase(it);
+    // a paused worker has to drain the rest of the output
+    resume(request);
+}
+
+void CgiWorkerPool::resume(const std::shared_ptr<CgiWorkerRequest> &request) const {
+    for (const auto &worker: workers) {
+        if (worker->request == request)
+            updateEvents(*worker);
+    }
+}
+
+void CgiWorkerPool::dispatch() {
+    while (!queue.empty()) {
+        Worker *worker = nullptr;
+        for (const auto &current: workers) {
+            if (!current->request) {
+                worker = current.get();
+                break;
+            }
+        }
+        if (!worker && workers.size() < maxWorkers)
+            worker = spawnWorker();
+        if (!worker && workers.empty()) {
+            const auto request = queue.front();
+            queue.pop_front();
+            request->fail(HttpResponse::html(HttpResponse::INTERNAL_SERVER_ERROR,
+                                             "CGI Error: Could not start worker"));
+            continue;
+        }
+        if (!worker)
+            return;
+
+        const auto request = queue.front();
+        queue.pop_front();
+        start(*worker, request);
+    }
+}
+
+// a broken interpreter would otherwise be forked again for every queued request and every tick
+CgiWorkerPool::Worker *CgiWorkerPool::spawnWorker() {
+    if (std::time(nullptr) - lastFailedSpawn < CGI_WORKER_SPAWN_BACKOFF)
+        return nullptr;
+
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0) {
+        Logger::log(LogLevel::ERROR, "Failed to create socketpair for CGI worker");
+        lastFailedSpawn = std::time(nullptr);
+        return nullptr;
+    }
+
+    const pid_t pid = fork();
+    if (pid < 0) {
+        close(fds[0]);
+        close(fds[1]);
+        Logger::log(LogLevel::ERROR, "Failed to fork CGI worker");
+        lastFailedSpawn = std::time(nullptr);
+        return nullptr;
+    }
+
+    if (pid == 0) {
+        // the worker leads a process group, so a timeout kills the forked script together with it
+        setpgid(0, 0);
+        // the worker outlives requests, so it must not hold client sockets or other fds of the server
+        dup2(fds[1], STDIN_FILENO);
+        dup2(STDERR_FILENO, STDOUT_FILENO);
+#ifdef __linux__
+        close_range(3, ~0U, 0);
+#else
+        for (int fd = 3; fd < getdtablesize(); fd++)
+            close(fd);
+#endif
+        char *const argv[] = {
+            const_cast<char *>(interpreter.c_str()), const_cast<char *>("-c"), const_cast<char *>(PYTHON_WORKER),
+            nullptr
+        };
+        execv(interpreter.c_str(), argv);
+        _exit(EXIT_FAILURE);
+    }
+
+    // set by both sides, a kill of the group must not depend on the child being scheduled first
+    setpgid(pid, pid);
+    close(fds[1]);
+    if (fcntl(fds[0], F_SETFL, O_NONBLOCK) == -1 || fcntl(fds[0], F_SETFD, FD_CLOEXEC) == -1) {
+        close(fds[0]);
+        kill(pid, SIGKILL);
+        exitedWorkers.push_back(pid);
+        lastFailedSpawn = std::time(nullptr);
+        return nullptr;
+    }
+
+    workers.push_back(std::make_unique<Worker>());
+    Worker *worker = workers.back().get();
+    worker->pid = pid;
+    worker->fd = fds[0];
+    worker->idleSince = std::time(nullptr);
+    spawnedWorkers++;
+    MetricHandler::incrementMetric("cgi_worker_spawns", 1);
+    Logger::log(LogLevel::DEBUG, "Started CGI worker " + std::to_string(pid) + " for " + interpreter);
+
+    FdHandler::addFd(worker->fd, POLLIN, [this, worker](const int fd, const short events) {
+        (void) fd;
+        return onEvent(*worker, events);
+    });
+    return worker;
+}
+
+void CgiWorkerPool::start(Worker &worker, const std::shared_ptr<CgiWorkerRequest> &request) {
+    worker.request = request;
+    worker.busySince = std::time(nullptr);
+    worker.writeBuffer += request->header;
+    writeBody(worker);
+    updateEvents(worker);
+}
+
+bool CgiWorkerPool::onEvent(Worker &worker, const short events) {
+    if ((events & (POLLIN | POLLHUP | POLLERR)) && !readFrames(worker)) {
+        // scripts run in their own process, so a worker that exits before its first request could not start
+        if (worker.requestsServed == 0) {
+            Logger::log(LogLevel::ERROR, "CGI worker for " + interpreter + " exited before serving a request, "
+                                         "no worker is started for " + std::to_string(CGI_WORKER_SPAWN_BACKOFF) +
+                                         " seconds");
+            lastFailedSpawn = std::time(nullptr);
+        }
+        removeWorker(worker, "Worker exited", false);
+        return true;
+    }
+
+    if (!worker.request && maxRequestsPerWorker > 0 && worker.requestsServed >= maxRequestsPerWorker) {
+        recycledWorkers++;
+        MetricHandler::incrementMetric("cgi_worker_recycled", 1);
+        removeWorker(worker, "Worker recycled", false);
+        return true;
+    }
+
+    writeBody(worker);
+    if (!worker.writeBuffer.empty()) {
+        const ssize_t bytesSent = send(worker.fd, worker.writeBuffer.data(), worker.writeBuffer.size(),
+                                       MSG_NOSIGNAL);
+        if (bytesSent < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+            removeWorker(worker, "Failed to write to worker", false);
+            return true;
+        }
+        if (bytesSent > 0)
+            worker.writeBuffer.erase(0, bytesSent);
+    }
+
+    updateEvents(worker);
+    return false;
+}
+
+// one read per event, so a fast script can't fill the response body before the worker is paused
+bool CgiWorkerPool::readFrames(Worker &worker) {
+    char buffer[65536];
+    const ssize_t bytesRead = read(worker.fd, buffer, sizeof(buffer));
+    if (bytesRead > 0)
+        worker.readBuffer.append(buffer, bytesRead);
+    const bool closed = bytesRead == 0 || (bytesRead < 0 && errno != EAGAIN && errno != EWOULDBLOCK);
+
+    size_t offset = 0;
+    const std::string &data = worker.readBuffer;
+    while (data.size() - offset >= 4) {
+        const auto *header = reinterpret_cast<const unsigned char *>(data.data() + offset);
+        const size_t length = (static_cast<size_t>(header[0]) << 24) | (header[1] << 16) | (header[2] << 8) |
+                              header[3];
+        if (data.size() - offset < 4 + length)
+            break;
+
+        if (length == 0)
+            finishRequest(worker);
+        else if (worker.request && !worker.request->isCancelled())
+            worker.request->append(data.data() + offset + 4, length);
+        offset += 4 + length;
+    }
+    worker.readBuffer.erase(0, offset);
+
+    return !closed;
+}
+
+void CgiWorkerPool::writeBody(Worker &worker) const {
+    if (!worker.request || worker.writeBuffer.size() >= CGI_WORKER_WRITE_BUFFER_LIMIT)
+        return;
+
+    CgiWorkerRequest &request = *worker.request;
+    const std::shared_ptr<SmartBuffer> &body = request.httpRequest->body;
+    if (request.bodySent >= request.httpRequest->totalBodySize)
+        return;
+
+    body->read(CGI_WORKER_WRITE_BUFFER_LIMIT / 2);
+    for (const SliceView &slice: body->getReadSlices()) {
+        const size_t length = std::min(slice.size(), request.httpRequest->totalBodySize - request.bodySent);
+        worker.writeBuffer.append(slice.data(), length);
+        request.bodySent += length;
+    }
+    body->cleanReadBuffer(body->getReadBufferSize());
+}
+
+void CgiWorkerPool::finishRequest(Worker &worker) {
+    if (!worker.request)
+        return;
+    const std::shared_ptr<CgiWorkerRequest> request = std::move(worker.request);
+    worker.request = nullptr;
+    worker.requestsServed++;
+    worker.idleSince = std::time(nullptr);
+    totalRequests++;
+
+    request->finish();
+}
+
+void CgiWorkerPool::removeWorker(Worker &worker, const std::string &reason, const bool unregister) {
+    Logger::log(LogLevel::DEBUG, "Stopping CGI worker " + std::to_string(worker.pid) + ": " + reason);
+    if (worker.request) {
+        Logger::log(LogLevel::ERROR, "CGI worker " + std::to_string(worker.pid) + " failed: " + reason);
+        const auto request = std::move(worker.request);
+        worker.request = nullptr;
+        request->fail(HttpResponse::html(HttpResponse::BAD_GATEWAY, "CGI Error: " + reason));
+    }
+
+    if (unregister)
+        FdHandler::removeFd(worker.fd);
+    close(worker.fd);
+    exitedWorkers.push_back(worker.pid);
+    workers.remove_if([&worker](const std::unique_ptr<Worker> &current) {
+        return current.get() == &worker;
+    });
+}
+
+// the output of a streamed response is not read while the client is behind, the script blocks once the socket is full
+void CgiWorkerPool::updateEvents(const Worker &worker) const {
+    const auto &request = worker.request;
+    const bool hasBody = request && request->bodySent < request->httpRequest->totalBodySize;
+    const bool paused = request && request->hasResponded() && !request->isCancelled() &&
+                        request->output.getPendingBytes() > CgiResponseBuilder::getStreamWatermark();
+    short events = paused ? 0 : POLLIN;
+    if (!worker.writeBuffer.empty() || hasBody)
+        events |= POLLOUT;
+    FdHandler::setEvents(worker.fd, events);
+}
+
+void CgiWorkerPool::maintain() {
+    // once per second is enough for second based timeouts, a crashing interpreter is held back by spawnWorker
+    const std::time_t now = std::time(nullptr);
+    if (now == lastMaintained)
+        return;
+    lastMaintained = now;
+
+    exitedWorkers.erase(std::remove_if(exitedWorkers.begin(), exitedWorkers.end(), [](const pid_t pid) {
+        return waitpid(pid, nullptr, WNOHANG) != 0;
+    }), exitedWorkers.end());
+
+    for (auto it = workers.begin(); it != workers.end();) {
+        Worker &worker = **it++;
+        if (worker.request && requestTimeout > 0 && now - worker.busySince > static_cast<long>(requestTimeout)) {
+            kill(-worker.pid, SIGKILL);
+            removeWorker(worker, "Script timed out", true);
+            continue;
+        }
+        if (!worker.request && workers.size() > minWorkers && now - worker.idleSince > static_cast<long>(
+                idleTimeout)) {
+            removeWorker(worker, "Worker idle", true);
+        }
+    }
+
+    while (workers.size() < minWorkers && spawnWorker()) {
+    }
+}
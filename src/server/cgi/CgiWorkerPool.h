@@ -0,0 +1,113 @@
+//
+// Created by Emil Ebert on 18.10.26.
+//
+
+#ifndef CGIWORKERPOOL_H
+#define CGIWORKERPOOL_H
+
+#include <string>
+#include <list>
+#include <map>
+#include <deque>
+#include <vector>
+#include <memory>
+#include <ctime>
+#include <sys/types.h>
+#include <config/config.h>
+
+#include "CgiWorkerRequest.h"
+
+// pre-forked interpreter processes that stay alive between requests, so the interpreter only starts once.
+// requests are SCGI framed over a socketpair, the worker forks for every script and answers with length prefixed
+// frames of the script output, which are streamed to the client as they arrive
+class CgiWorkerPool {
+private:
+    struct Worker {
+        pid_t pid = -1;
+        int fd = -1;
+        std::shared_ptr<CgiWorkerRequest> request;
+        std::string writeBuffer;
+        std::string readBuffer;
+        size_t requestsServed = 0;
+        std::time_t idleSince = 0;
+        std::time_t busySince = 0;
+    };
+
+    static std::map<std::string, std::unique_ptr<CgiWorkerPool> > pools;
+
+    const std::string interpreter;
+    const size_t minWorkers;
+    const size_t maxWorkers;
+    const size_t maxRequestsPerWorker;
+    const size_t idleTimeout;
+    const size_t requestTimeout;
+    std::list<std::unique_ptr<Worker> > workers;
+    std::deque<std::shared_ptr<CgiWorkerRequest> > queue;
+    // exited or closed workers that still have to be waited for
+    std::vector<pid_t> exitedWorkers;
+    size_t callbackId;
+    std::time_t lastMaintained = 0;
+    // no worker is started for CGI_WORKER_SPAWN_BACKOFF seconds after a failed one
+    std::time_t lastFailedSpawn = 0;
+
+    size_t totalRequests = 0;
+    size_t spawnedWorkers = 0;
+    size_t recycledWorkers = 0;
+    size_t maxQueueDepth = 0;
+
+public:
+    CgiWorkerPool(std::string interpreter, const RouteConfig &route, size_t requestTimeout);
+
+    ~CgiWorkerPool();
+
+    // one pool per interpreter and location, the first request creates it
+    static CgiWorkerPool &get(const std::string &interpreter, const RouteConfig &route, size_t requestTimeout);
+
+    static const std::map<std::string, std::unique_ptr<CgiWorkerPool> > &getPools() { return pools; }
+
+    static void clear();
+
+    // only interpreters with a worker loop can be pre-forked, others fall back to one process per request
+    static bool isSupported(const std::string &interpreter);
+
+    void submit(const std::shared_ptr<CgiWorkerRequest> &request);
+
+    void cancel(const std::shared_ptr<CgiWorkerRequest> &request);
+
+    // the client took some of the streamed output, the worker of request is read again
+    void resume(const std::shared_ptr<CgiWorkerRequest> &request) const;
+
+    [[nodiscard]] size_t getWorkerCount() const { return workers.size(); }
+    [[nodiscard]] size_t getBusyWorkerCount() const;
+    [[nodiscard]] size_t getQueueDepth() const { return queue.size(); }
+    [[nodiscard]] size_t getMaxQueueDepth() const { return maxQueueDepth; }
+    [[nodiscard]] size_t getTotalRequests() const { return totalRequests; }
+    [[nodiscard]] size_t getSpawnedWorkers() const { return spawnedWorkers; }
+    [[nodiscard]] size_t getRecycledWorkers() const { return recycledWorkers; }
+
+private:
+    void dispatch();
+
+    Worker *spawnWorker();
+
+    void start(Worker &worker, const std::shared_ptr<CgiWorkerRequest> &request);
+
+    bool onEvent(Worker &worker, short events);
+
+    bool readFrames(Worker &worker);
+
+    void writeBody(Worker &worker) const;
+
+    void finishRequest(Worker &worker);
+
+    // fails the running request and closes the worker, unregister must be false inside its own fd callback
+    void removeWorker(Worker &worker, const std::string &reason, bool unregister);
+
+    void updateEvents(const Worker &worker) const;
+
+    // keeps minWorkers alive, reaps idle and hanging workers and waits for exited ones
+    void maintain();
+};
+
+
+#endif //CGIWORKERPOOL_H
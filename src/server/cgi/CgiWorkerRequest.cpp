@@ -0,0 +1,63 @@
+//
+// Created by Emil Ebert on 18.10.26.
+//
+
+#include "CgiWorkerRequest.h"
+
+CgiWorkerRequest::CgiWorkerRequest(std::shared_ptr<HttpRequest> httpRequest,
+                                   const std::unordered_map<std::string, std::string> &environment,
+                                   Callback onResponse, FinishCallback onFinish): onResponse(std::move(onResponse)),
+                                                         onFinish(std::move(onFinish)),
+                                                         httpRequest(std::move(httpRequest)),
+                                                         header(encodeHeader(environment,
+                                                                             this->httpRequest->totalBodySize)) {
+}
+
+// CONTENT_LENGTH has to be the first header, SCGI must be present
+std::string CgiWorkerRequest::encodeHeader(const std::unordered_map<std::string, std::string> &environment,
+                                           const size_t contentLength) {
+    std::string headers;
+    headers.append("CONTENT_LENGTH").append(1, '\0').append(std::to_string(contentLength)).append(1, '\0');
+    headers.append("SCGI").append(1, '\0').append("1").append(1, '\0');
+    for (const auto &[name, value]: environment) {
+        if (name == "CONTENT_LENGTH" || name.find('\0') != std::string::npos || value.find('\0') != std::string::npos)
+            continue;
+        headers.append(name).append(1, '\0').append(value).append(1, '\0');
+    }
+    return std::to_string(headers.size()) + ":" + headers + ",";
+}
+
+void CgiWorkerRequest::append(const char *data, const size_t length) {
+    if (!output.append(data, length) || responded)
+        return;
+    responded = true;
+    if (onResponse)
+        onResponse(output.createResponse("CGI Error: Could not parse output"));
+}
+
+void CgiWorkerRequest::finish() {
+    output.finish();
+    end(output.createResponse("CGI Error: Could not parse output"));
+}
+
+void CgiWorkerRequest::fail(const HttpResponse &response) {
+    output.finish();
+    end(response);
+}
+
+void CgiWorkerRequest::end(const HttpResponse &response) {
+    const Callback responseCallback = std::move(onResponse);
+    const FinishCallback finishCallback = std::move(onFinish);
+    onResponse = nullptr;
+    onFinish = nullptr;
+    if (!responded && responseCallback)
+        responseCallback(response);
+    responded = true;
+    if (finishCallback)
+        finishCallback();
+}
+
+void CgiWorkerRequest::cancel() {
+    onResponse = nullptr;
+    onFinish = nullptr;
+}
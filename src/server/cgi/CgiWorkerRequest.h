@@ -0,0 +1,64 @@
+//
+// Created by Emil Ebert on 18.10.26.
+//
+
+#ifndef CGIWORKERREQUEST_H
+#define CGIWORKERREQUEST_H
+
+#include <string>
+#include <memory>
+#include <functional>
+#include <unordered_map>
+#include <parser/http/HttpRequest.h>
+#include <server/cgi/CgiResponseBuilder.h>
+
+// one cgi request handed to a pre-forked worker, shared between the pool and the RequestHandler waiting for it
+class CgiWorkerRequest {
+public:
+    typedef std::function<void(const HttpResponse &response)> Callback;
+    typedef std::function<void()> FinishCallback;
+
+private:
+    Callback onResponse;
+    FinishCallback onFinish;
+    bool responded = false;
+
+public:
+    const std::shared_ptr<HttpRequest> httpRequest;
+    // SCGI netstring with the cgi environment, sent before the request body
+    const std::string header;
+    CgiResponseBuilder output;
+    size_t bodySent = 0;
+
+    // onResponse gets the response as soon as the headers of the script are there, its body streams until onFinish
+    CgiWorkerRequest(std::shared_ptr<HttpRequest> httpRequest,
+                     const std::unordered_map<std::string, std::string> &environment, Callback onResponse,
+                     FinishCallback onFinish);
+
+    // output of the script, the response starts once its headers are complete
+    void append(const char *data, size_t length);
+
+    // the script ended, a script that never finished its headers is answered with 502
+    void finish();
+
+    // the worker failed, a response that already started is cut off
+    void fail(const HttpResponse &response);
+
+    // the handler went away, the worker finishes the script but the output is thrown away
+    void cancel();
+
+    // nobody waits for the output anymore
+    [[nodiscard]] bool isCancelled() const { return !onFinish; }
+
+    [[nodiscard]] bool hasResponded() const { return responded; }
+
+    static std::string encodeHeader(const std::unordered_map<std::string, std::string> &environment,
+                                    size_t contentLength);
+
+private:
+    // answers with response unless the headers were already sent, then tells the handler the body is over
+    void end(const HttpResponse &response);
+};
+
+
+#endif //CGIWORKERREQUEST_H
@@ -0,0 +1,474 @@
+//
+// Created by Emil Ebert on 18.10.26.
+//
+
+#include "FastCgiPool.h"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <webserv.h>
+#include <common/Logger.h>
+#include <server/FdHandler.h>
+#include <server/handler/CallbackHandler.h>
+#include <server/handler/MetricHandler.h>
+
+#define FCGI_VERSION_1 1
+#define FCGI_BEGIN_REQUEST 1
+#define FCGI_END_REQUEST 3
+#define FCGI_PARAMS 4
+#define FCGI_STDIN 5
+#define FCGI_STDOUT 6
+#define FCGI_STDERR 7
+#define FCGI_GET_VALUES 9
+#define FCGI_GET_VALUES_RESULT 10
+#define FCGI_RESPONDER 1
+#define FCGI_KEEP_CONN 1
+#define FCGI_REQUEST_COMPLETE 0
+#define FCGI_CANT_MPX_CONN 1
+#define FCGI_HEADER_LENGTH 8
+#define FCGI_MAX_CONTENT_LENGTH 65535
+// stdin is only read from the request body while less than this is waiting to be sent
+#define FCGI_WRITE_BUFFER_LIMIT (64 * 1024)
+
+std::map<std::string, std::unique_ptr<FastCgiPool> > FastCgiPool::pools;
+
+static size_t elapsedMs(const std::chrono::steady_clock::time_point since) {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - since).count();
+}
+
+FastCgiPool::FastCgiPool(std::string address, const size_t maxConnections): address(std::move(address)),
+                                                                             maxConnections(
+                                                                                 std::max<size_t>(1, maxConnections)) {
+    callbackId = CallbackHandler::registerCallback([this]() {
+        closeIdleConnections();
+        dispatch();
+        return false;
+    });
+}
+
+FastCgiPool::~FastCgiPool() {
+    CallbackHandler::unregisterCallback(callbackId);
+    for (const auto &connection: connections) {
+        FdHandler::removeFd(connection->fd);
+        close(connection->fd);
+    }
+}
+
+FastCgiPool &FastCgiPool::get(const std::string &address, const size_t maxConnections) {
+    auto it = pools.find(address);
+    if (it == pools.end())
+        it = pools.emplace(address, std::make_unique<FastCgiPool>(address, maxConnections)).first;
+    return *it->second;
+}
+
+void FastCgiPool::clear() {
+    pools.clear();
+}
+
+size_t FastCgiPool::getIdleConnectionCount() const {
+    return std::count_if(connections.begin(), connections.end(), [](const std::unique_ptr<Connection> &connection) {
+        return connection->connected && connection->requests.empty();
+    });
+}
+
+size_t FastCgiPool::getActiveRequestCount() const {
+    size_t count = 0;
+    for (const auto &connection: connections)
+        count += connection->requests.size();
+    return count;
+}
+
+void FastCgiPool::submit(const std::shared_ptr<FastCgiRequest> &request) {
+    request->queuedAt = std::chrono::steady_clock::now();
+    queue.push_back(request);
+    maxQueueDepth = std::max(maxQueueDepth, queue.size());
+    MetricHandler::incrementMetric("fastcgi_requests", 1);
+    dispatch();
+    if (std::find(queue.begin(), queue.end(), request) != queue.end())
+        MetricHandler::incrementMetric("fastcgi_queued", 1);
+}
+
+void FastCgiPool::cancel(const std::shared_ptr<FastCgiRequest> &request) {
+    request->cancel();
+    if (const auto it = std::find(queue.begin(), queue.end(), request); it != queue.end())
+        queue.erase(it);
+}
+
+void FastCgiPool::dispatch() {
+    while (!queue.empty()) {
+        Connection *connection = findConnection();
+        if (!connection && connections.size() < maxConnections) {
+            connection = openConnection();
+            if (!connection) {
+                const auto request = queue.front();
+                queue.pop_front();
+                failedRequests++;
+                MetricHandler::incrementMetric("fastcgi_errors", 1);
+                request->complete(HttpResponse::html(HttpResponse::BAD_GATEWAY,
+                                                     "FastCGI Error: Could not connect to backend"));
+                continue;
+            }
+        }
+        if (!connection)
+            return;
+
+        const auto request = queue.front();
+        queue.pop_front();
+        start(*connection, request);
+    }
+}
+
+// idle connections first, a multiplexing backend gets more requests on the least busy connection
+FastCgiPool::Connection *FastCgiPool::findConnection() const {
+    Connection *best = nullptr;
+    for (const auto &connection: connections) {
+        if (connection->requests.empty())
+            return connection.get();
+        if (multiplexing && connection->requests.size() < maxRequestsPerConnection &&
+            (!best || connection->requests.size() < best->requests.size()))
+            best = connection.get();
+    }
+    return best;
+}
+
+FastCgiPool::Connection *FastCgiPool::openConnection() {
+    const int fd = connectSocket();
+    if (fd < 0)
+        return nullptr;
+
+    connections.push_back(std::make_unique<Connection>());
+    Connection *connection = connections.back().get();
+    connection->fd = fd;
+    Logger::log(LogLevel::DEBUG, "Opened FastCGI connection to " + address);
+    MetricHandler::incrementMetric("fastcgi_connections_opened", 1);
+
+    // asks whether the backend can handle more than one request per connection, again after it was restarted
+    if (connections.size() == 1) {
+        const std::string names = FastCgiRequest::encodeParams({{"FCGI_MPXS_CONNS", ""}, {"FCGI_MAX_REQS", ""}});
+        appendRecord(connection->writeBuffer, FCGI_GET_VALUES, 0, names.data(), names.size());
+    }
+
+    FdHandler::addFd(fd, POLLIN | POLLOUT, [this, connection](const int fd, const short events) {
+        (void) fd;
+        return onEvent(*connection, events);
+    });
+    return connection;
+}
+
+int FastCgiPool::connectSocket() const {
+    int fd = -1;
+    int result = -1;
+
+    if (address.rfind("unix:", 0) == 0) {
+        sockaddr_un socketAddress{};
+        const std::string path = address.substr(5);
+        if (path.size() >= sizeof(socketAddress.sun_path)) {
+            Logger::log(LogLevel::ERROR, "FastCGI socket path is too long: " + path);
+            return -1;
+        }
+        socketAddress.sun_family = AF_UNIX;
+        std::strncpy(socketAddress.sun_path, path.c_str(), sizeof(socketAddress.sun_path) - 1);
+
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd >= 0 && fcntl(fd, F_SETFL, O_NONBLOCK) == 0 && fcntl(fd, F_SETFD, FD_CLOEXEC) == 0)
+            result = connect(fd, reinterpret_cast<sockaddr *>(&socketAddress), sizeof(socketAddress));
+    } else {
+        const size_t colon = address.rfind(':');
+        if (colon == std::string::npos) {
+            Logger::log(LogLevel::ERROR, "Invalid FastCGI address: " + address);
+            return -1;
+        }
+
+        addrinfo hints{};
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        addrinfo *info = nullptr;
+        if (getaddrinfo(address.substr(0, colon).c_str(), address.substr(colon + 1).c_str(), &hints, &info) != 0 ||
+            !info) {
+            Logger::log(LogLevel::ERROR, "Failed to resolve FastCGI address: " + address);
+            return -1;
+        }
+
+        fd = socket(info->ai_family, info->ai_socktype, info->ai_protocol);
+        if (fd >= 0 && fcntl(fd, F_SETFL, O_NONBLOCK) == 0 && fcntl(fd, F_SETFD, FD_CLOEXEC) == 0)
+            result = connect(fd, info->ai_addr, info->ai_addrlen);
+        freeaddrinfo(info);
+    }
+
+    if (fd < 0 || (result < 0 && errno != EINPROGRESS)) {
+        Logger::log(LogLevel::ERROR, "Failed to connect to FastCGI backend " + address + ": " + strerror(errno));
+        if (fd >= 0)
+            close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+void FastCgiPool::start(Connection &connection, const std::shared_ptr<FastCgiRequest> &request) {
+    // without multiplexing there is only one request per connection, so the id is always 1
+    uint16_t id = 1;
+    if (multiplexing) {
+        while (connection.requests.count(connection.nextId) || connection.nextId == 0)
+            connection.nextId++;
+        id = connection.nextId++;
+    }
+
+    request->id = id;
+    request->startedAt = std::chrono::steady_clock::now();
+    totalQueueMs += elapsedMs(request->queuedAt);
+    connection.requests[id] = request;
+
+    const char begin[8] = {0, FCGI_RESPONDER, FCGI_KEEP_CONN, 0, 0, 0, 0, 0};
+    appendRecord(connection.writeBuffer, FCGI_BEGIN_REQUEST, id, begin, sizeof(begin));
+    for (size_t offset = 0; offset < request->params.size(); offset += FCGI_MAX_CONTENT_LENGTH) {
+        const size_t length = std::min<size_t>(FCGI_MAX_CONTENT_LENGTH, request->params.size() - offset);
+        appendRecord(connection.writeBuffer, FCGI_PARAMS, id, request->params.data() + offset, length);
+    }
+    appendRecord(connection.writeBuffer, FCGI_PARAMS, id, nullptr, 0);
+    updateEvents(connection);
+}
+
+bool FastCgiPool::onEvent(Connection &connection, const short events) {
+    if (!connection.connected) {
+        int error = 0;
+        socklen_t length = sizeof(error);
+        if (getsockopt(connection.fd, SOL_SOCKET, SO_ERROR, &error, &length) < 0)
+            error = errno;
+        if (error != 0) {
+            failConnection(connection, std::string("Could not connect to backend: ") + strerror(error), false);
+            return true;
+        }
+        if (!(events & POLLOUT))
+            return false;
+        connection.connected = true;
+    }
+
+    // what the backend sent before an error or hangup is still read
+    if ((events & (POLLIN | POLLHUP | POLLERR)) && !readRecords(connection)) {
+        failConnection(connection, "Backend closed the connection", false);
+        return true;
+    }
+    if (events & POLLERR) {
+        failConnection(connection, "Connection error", false);
+        return true;
+    }
+
+    writeStdin(connection);
+    if (!connection.writeBuffer.empty()) {
+        const ssize_t bytesSent = send(connection.fd, connection.writeBuffer.data(), connection.writeBuffer.size(),
+                                       MSG_NOSIGNAL);
+        if (bytesSent < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+            failConnection(connection, "Failed to write to backend", false);
+            return true;
+        }
+        if (bytesSent > 0)
+            connection.writeBuffer.erase(0, bytesSent);
+    }
+
+    updateEvents(connection);
+    return false;
+}
+
+void FastCgiPool::writeStdin(Connection &connection) {
+    for (const auto &[id, request]: connection.requests) {
+        if (request->stdinDone || connection.writeBuffer.size() >= FCGI_WRITE_BUFFER_LIMIT)
+            continue;
+
+        const std::shared_ptr<SmartBuffer> &body = request->httpRequest->body;
+        if (request->stdinSent >= request->httpRequest->totalBodySize) {
+            appendRecord(connection.writeBuffer, FCGI_STDIN, id, nullptr, 0);
+            request->stdinDone = true;
+            continue;
+        }
+        body->read(FCGI_WRITE_BUFFER_LIMIT / 2);
+        // every slice of the body becomes one record
+        size_t length = 0;
+        for (const SliceView &slice: body->getReadSlices()) {
+            appendRecord(connection.writeBuffer, FCGI_STDIN, id, slice.data(), slice.size());
+            length += slice.size();
+        }
+        body->cleanReadBuffer(length);
+        request->stdinSent += length;
+    }
+}
+
+bool FastCgiPool::readRecords(Connection &connection) {
+    char buffer[65536];
+    bool closed = false;
+    while (true) {
+        const ssize_t bytesRead = read(connection.fd, buffer, sizeof(buffer));
+        if (bytesRead > 0) {
+            connection.readBuffer.append(buffer, bytesRead);
+            if (static_cast<size_t>(bytesRead) == sizeof(buffer))
+                continue;
+            break;
+        }
+        if (bytesRead == 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+            closed = true;
+        break;
+    }
+
+    size_t offset = 0;
+    const std::string &data = connection.readBuffer;
+    while (data.size() - offset >= FCGI_HEADER_LENGTH) {
+        const auto *header = reinterpret_cast<const unsigned char *>(data.data() + offset);
+        const int type = header[1];
+        const uint16_t id = (header[2] << 8) | header[3];
+        const size_t contentLength = (header[4] << 8) | header[5];
+        const size_t recordLength = FCGI_HEADER_LENGTH + contentLength + header[6];
+        if (data.size() - offset < recordLength)
+            break;
+
+        const char *content = data.data() + offset + FCGI_HEADER_LENGTH;
+        offset += recordLength;
+
+        if (type == FCGI_STDOUT) {
+            if (const auto it = connection.requests.find(id); it != connection.requests.end())
+                it->second->onStdout(content, contentLength);
+        } else if (type == FCGI_STDERR) {
+            Logger::log(LogLevel::WARNING, "FastCGI " + address + ": " + std::string(content, contentLength));
+        } else if (type == FCGI_END_REQUEST && contentLength >= 8) {
+            finishRequest(connection, id, static_cast<unsigned char>(content[4]));
+        } else if (type == FCGI_GET_VALUES_RESULT) {
+            readValues(std::string(content, contentLength));
+        }
+    }
+    connection.readBuffer.erase(0, offset);
+
+    return !closed;
+}
+
+void FastCgiPool::finishRequest(Connection &connection, const uint16_t id, const int protocolStatus) {
+    const auto it = connection.requests.find(id);
+    if (it == connection.requests.end())
+        return;
+    const std::shared_ptr<FastCgiRequest> request = it->second;
+    connection.requests.erase(it);
+    if (connection.requests.empty())
+        connection.idleSince = std::time(nullptr);
+
+    const size_t latency = elapsedMs(request->startedAt);
+    totalRequests++;
+    totalLatencyMs += latency;
+    MetricHandler::incrementMetric("fastcgi_latency_ms", latency);
+
+    if (protocolStatus != FCGI_REQUEST_COMPLETE) {
+        if (protocolStatus == FCGI_CANT_MPX_CONN)
+            multiplexing = false;
+        failedRequests++;
+        MetricHandler::incrementMetric("fastcgi_errors", 1);
+        request->complete(HttpResponse::html(HttpResponse::BAD_GATEWAY,
+                                             "FastCGI Error: Request rejected with status " +
+                                             std::to_string(protocolStatus)));
+        return;
+    }
+    request->complete(request->createResponse());
+}
+
+static size_t readLength(const std::string &content, size_t &offset) {
+    if (offset >= content.size())
+        return 0;
+    const auto *bytes = reinterpret_cast<const unsigned char *>(content.data() + offset);
+    if (!(bytes[0] & 0x80)) {
+        offset += 1;
+        return bytes[0];
+    }
+    if (offset + 4 > content.size()) {
+        offset = content.size();
+        return 0;
+    }
+    offset += 4;
+    return ((bytes[0] & 0x7f) << 24) | (bytes[1] << 16) | (bytes[2] << 8) | bytes[3];
+}
+
+void FastCgiPool::readValues(const std::string &content) {
+    size_t offset = 0;
+    while (offset < content.size()) {
+        const size_t nameLength = readLength(content, offset);
+        const size_t valueLength = readLength(content, offset);
+        if (offset + nameLength + valueLength > content.size())
+            break;
+        const std::string name = content.substr(offset, nameLength);
+        const std::string value = content.substr(offset + nameLength, valueLength);
+        offset += nameLength + valueLength;
+
+        if (name == "FCGI_MPXS_CONNS")
+            multiplexing = value == "1";
+        else if (name == "FCGI_MAX_REQS" && !value.empty() && value.find_first_not_of("0123456789") == std::string::npos)
+            maxRequestsPerConnection = std::clamp<size_t>(std::stoul(value), 1, FASTCGI_MAX_MULTIPLEXED);
+    }
+    if (multiplexing && maxRequestsPerConnection == 1)
+        maxRequestsPerConnection = FASTCGI_MAX_MULTIPLEXED;
+    Logger::log(LogLevel::DEBUG, "FastCGI " + address + " multiplexing: " + (multiplexing ? "on" : "off"));
+}
+
+void FastCgiPool::failConnection(Connection &connection, const std::string &reason, const bool unregister) {
+    if (!connection.requests.empty()) {
+        Logger::log(LogLevel::ERROR, "FastCGI " + address + ": " + reason);
+        MetricHandler::incrementMetric("fastcgi_errors", connection.requests.size());
+    }
+
+    const auto requests = std::move(connection.requests);
+    for (const auto &[id, request]: requests) {
+        totalRequests++;
+        failedRequests++;
+        request->complete(HttpResponse::html(HttpResponse::BAD_GATEWAY, "FastCGI Error: " + reason));
+    }
+
+    if (unregister)
+        FdHandler::removeFd(connection.fd);
+    close(connection.fd);
+    connections.remove_if([&connection](const std::unique_ptr<Connection> &current) {
+        return current.get() == &connection;
+    });
+}
+
+void FastCgiPool::updateEvents(const Connection &connection) const {
+    bool wantsWrite = !connection.connected || !connection.writeBuffer.empty();
+    for (const auto &[id, request]: connection.requests)
+        wantsWrite = wantsWrite || !request->stdinDone;
+    FdHandler::setEvents(connection.fd, wantsWrite ? POLLIN | POLLOUT : POLLIN);
+}
+
+void FastCgiPool::closeIdleConnections() {
+    // the timeout is in seconds, so once per second is enough
+    const std::time_t now = std::time(nullptr);
+    if (now == lastChecked)
+        return;
+    lastChecked = now;
+
+    for (auto it = connections.begin(); it != connections.end();) {
+        Connection &connection = **it++;
+        if (connection.connected && connection.requests.empty() && now - connection.idleSince >
+            FASTCGI_KEEPALIVE_TIMEOUT) {
+            Logger::log(LogLevel::DEBUG, "Closing idle FastCGI connection to " + address);
+            FdHandler::removeFd(connection.fd);
+            close(connection.fd);
+            connections.remove_if([&connection](const std::unique_ptr<Connection> &current) {
+                return current.get() == &connection;
+            });
+        }
+    }
+}
+
+void FastCgiPool::appendRecord(std::string &out, const int type, const uint16_t id, const char *content,
+                               const size_t length) {
+    const size_t padding = (8 - length % 8) % 8;
+    const char header[FCGI_HEADER_LENGTH] = {
+        FCGI_VERSION_1, static_cast<char>(type),
+        static_cast<char>(id >> 8), static_cast<char>(id & 0xff),
+        static_cast<char>(length >> 8), static_cast<char>(length & 0xff),
+        static_cast<char>(padding), 0
+    };
+    out.append(header, sizeof(header));
+    if (length > 0)
+        out.append(content, length);
+    out.append(padding, '\0');
+}
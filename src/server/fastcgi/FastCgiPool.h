@@ -0,0 +1,109 @@
+//
+// Created by Emil Ebert on 18.10.26.
+//
+
+#ifndef FASTCGIPOOL_H
+#define FASTCGIPOOL_H
+
+#include <string>
+#include <list>
+#include <map>
+#include <deque>
+#include <memory>
+#include <ctime>
+#include <sys/types.h>
+
+#include "FastCgiRequest.h"
+
+// keep-alive connections to one FastCGI backend (unix:/path or host:port).
+// requests are queued while every connection is busy, multiplexing is used if the backend reports FCGI_MPXS_CONNS
+class FastCgiPool {
+private:
+    struct Connection {
+        int fd = -1;
+        bool connected = false;
+        std::string writeBuffer;
+        std::string readBuffer;
+        std::map<uint16_t, std::shared_ptr<FastCgiRequest> > requests;
+        uint16_t nextId = 1;
+        std::time_t idleSince = 0;
+    };
+
+    static std::map<std::string, std::unique_ptr<FastCgiPool> > pools;
+
+    const std::string address;
+    const size_t maxConnections;
+    std::list<std::unique_ptr<Connection> > connections;
+    std::deque<std::shared_ptr<FastCgiRequest> > queue;
+    size_t callbackId;
+    std::time_t lastChecked = 0;
+    bool multiplexing = false;
+    size_t maxRequestsPerConnection = 1;
+
+    size_t totalRequests = 0;
+    size_t failedRequests = 0;
+    size_t totalLatencyMs = 0;
+    size_t totalQueueMs = 0;
+    size_t maxQueueDepth = 0;
+
+public:
+    FastCgiPool(std::string address, size_t maxConnections);
+
+    ~FastCgiPool();
+
+    // the first location using an address decides the connection limit of its pool
+    static FastCgiPool &get(const std::string &address, size_t maxConnections);
+
+    static const std::map<std::string, std::unique_ptr<FastCgiPool> > &getPools() { return pools; }
+
+    static void clear();
+
+    void submit(const std::shared_ptr<FastCgiRequest> &request);
+
+    void cancel(const std::shared_ptr<FastCgiRequest> &request);
+
+    [[nodiscard]] size_t getConnectionCount() const { return connections.size(); }
+    [[nodiscard]] size_t getIdleConnectionCount() const;
+    [[nodiscard]] size_t getActiveRequestCount() const;
+    [[nodiscard]] size_t getQueueDepth() const { return queue.size(); }
+    [[nodiscard]] size_t getMaxQueueDepth() const { return maxQueueDepth; }
+    [[nodiscard]] size_t getTotalRequests() const { return totalRequests; }
+    [[nodiscard]] size_t getFailedRequests() const { return failedRequests; }
+    [[nodiscard]] size_t getAverageLatencyMs() const { return totalRequests ? totalLatencyMs / totalRequests : 0; }
+    [[nodiscard]] size_t getAverageQueueMs() const { return totalRequests ? totalQueueMs / totalRequests : 0; }
+    [[nodiscard]] bool isMultiplexing() const { return multiplexing; }
+
+private:
+    void dispatch();
+
+    Connection *findConnection() const;
+
+    Connection *openConnection();
+
+    int connectSocket() const;
+
+    void start(Connection &connection, const std::shared_ptr<FastCgiRequest> &request);
+
+    bool onEvent(Connection &connection, short events);
+
+    void writeStdin(Connection &connection);
+
+    bool readRecords(Connection &connection);
+
+    void finishRequest(Connection &connection, uint16_t id, int protocolStatus);
+
+    void readValues(const std::string &content);
+
+    // fails the requests of the connection and closes it, unregister must be false inside its own fd callback
+    void failConnection(Connection &connection, const std::string &reason, bool unregister);
+
+    void updateEvents(const Connection &connection) const;
+
+    // errors and hangups are handled in onEvent, this only closes connections idle for too long
+    void closeIdleConnections();
+
+    static void appendRecord(std::string &out, int type, uint16_t id, const char *content, size_t length);
+};
+
+
+#endif //FASTCGIPOOL_H
@@ -0,0 +1,47 @@
+//
+// Created by Emil Ebert on 18.10.26.
+//
+
+#include "FastCgiRequest.h"
+
+FastCgiRequest::FastCgiRequest(std::shared_ptr<HttpRequest> httpRequest,
+                               const std::unordered_map<std::string, std::string> &environment,
+                               Callback onComplete): onComplete(std::move(onComplete)),
+                                                     httpRequest(std::move(httpRequest)),
+                                                     params(encodeParams(environment)) {
+}
+
+static void appendLength(std::string &out, const size_t length) {
+    if (length < 128) {
+        out += static_cast<char>(length);
+        return;
+    }
+    out += static_cast<char>(((length >> 24) & 0x7f) | 0x80);
+    out += static_cast<char>((length >> 16) & 0xff);
+    out += static_cast<char>((length >> 8) & 0xff);
+    out += static_cast<char>(length & 0xff);
+}
+
+std::string FastCgiRequest::encodeParams(const std::unordered_map<std::string, std::string> &environment) {
+    std::string out;
+    for (const auto &[name, value]: environment) {
+        appendLength(out, name.size());
+        appendLength(out, value.size());
+        out += name;
+        out += value;
+    }
+    return out;
+}
+
+HttpResponse FastCgiRequest::createResponse() {
+    output.finish();
+    return output.createResponse("FastCGI Error: Incomplete response");
+}
+
+void FastCgiRequest::complete(const HttpResponse &response) {
+    if (!onComplete)
+        return;
+    const Callback callback = std::move(onComplete);
+    onComplete = nullptr;
+    callback(response);
+}
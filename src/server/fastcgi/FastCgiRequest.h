@@ -0,0 +1,53 @@
+//
+// Created by Emil Ebert on 18.10.26.
+//
+
+#ifndef FASTCGIREQUEST_H
+#define FASTCGIREQUEST_H
+
+#include <string>
+#include <memory>
+#include <chrono>
+#include <functional>
+#include <unordered_map>
+#include <parser/http/HttpRequest.h>
+#include <server/response/HttpResponse.h>
+#include <server/cgi/CgiResponseBuilder.h>
+
+// one request sent to a FastCGI backend, shared between the pool and the RequestHandler waiting for it
+class FastCgiRequest {
+public:
+    typedef std::function<void(const HttpResponse &response)> Callback;
+
+private:
+    Callback onComplete;
+    CgiResponseBuilder output;
+
+public:
+    const std::shared_ptr<HttpRequest> httpRequest;
+    // PARAMS stream encoded as FastCGI name-value pairs, without the record framing
+    const std::string params;
+    uint16_t id = 0;
+    size_t stdinSent = 0;
+    bool stdinDone = false;
+    std::chrono::steady_clock::time_point queuedAt;
+    std::chrono::steady_clock::time_point startedAt;
+
+    FastCgiRequest(std::shared_ptr<HttpRequest> httpRequest,
+                   const std::unordered_map<std::string, std::string> &environment, Callback onComplete);
+
+    // STDOUT of the backend, the same format as the output of a cgi script
+    void onStdout(const char *data, size_t length) { output.append(data, length); }
+
+    [[nodiscard]] HttpResponse createResponse();
+
+    void complete(const HttpResponse &response);
+
+    // the handler went away, the output is still read but thrown away
+    void cancel() { onComplete = nullptr; }
+
+    static std::string encodeParams(const std::unordered_map<std::string, std::string> &environment);
+};
+
+
+#endif //FASTCGIREQUEST_H
@@ -0,0 +1,115 @@
+//
+// Created by Emil Ebert on 18.10.26.
+//
+
+#include "FileWatcher.h"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <common/Logger.h>
+#include <server/FdHandler.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+int FileWatcher::inotifyFd = -1;
+std::unordered_map<int, FileWatcher::Watch> FileWatcher::watches;
+std::unordered_map<std::string, int> FileWatcher::directoryWatches;
+
+bool FileWatcher::init() {
+#ifdef __linux__
+    if (inotifyFd >= 0)
+        return true;
+
+    inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotifyFd < 0) {
+        Logger::log(LogLevel::ERROR, "Failed to create inotify instance");
+        return false;
+    }
+
+    FdHandler::addFd(inotifyFd, POLLIN, [](const int fd, const short events) {
+        return onEvent(fd, events);
+    });
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool FileWatcher::watch(const std::string &directory, const std::function<void(const std::string &)> &callback) {
+#ifdef __linux__
+    if (!init())
+        return false;
+
+    if (const auto it = directoryWatches.find(directory); it != directoryWatches.end()) {
+        watches[it->second].callbacks.push_back(callback);
+        return true;
+    }
+
+    const int wd = inotify_add_watch(inotifyFd, directory.c_str(),
+                                     IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB | IN_CREATE | IN_DELETE | IN_MOVED_FROM |
+                                     IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF);
+    if (wd < 0) {
+        Logger::log(LogLevel::WARNING, "Failed to watch directory: " + directory);
+        return false;
+    }
+
+    Logger::log(LogLevel::DEBUG, "Watching directory: " + directory);
+    directoryWatches[directory] = wd;
+    watches[wd].directory = directory;
+    watches[wd].callbacks.push_back(callback);
+    return true;
+#else
+    (void) directory;
+    (void) callback;
+    return false;
+#endif
+}
+
+bool FileWatcher::onEvent(const int fd, const short events) {
+#ifdef __linux__
+    (void) events;
+    alignas(inotify_event) char buffer[8192];
+
+    while (true) {
+        const ssize_t length = read(fd, buffer, sizeof(buffer));
+        if (length <= 0)
+            return false;
+
+        for (ssize_t offset = 0; offset < length;) {
+            const auto *event = reinterpret_cast<const inotify_event *>(buffer + offset);
+            offset += sizeof(inotify_event) + event->len;
+
+            const auto it = watches.find(event->wd);
+            if (it == watches.end())
+                continue;
+
+            if (event->mask & IN_IGNORED) {
+                directoryWatches.erase(it->second.directory);
+                for (const auto &callback: it->second.callbacks)
+                    callback("");
+                watches.erase(it);
+                continue;
+            }
+
+            const std::string name = event->len > 0 ? std::string(event->name) : "";
+            for (const auto &callback: it->second.callbacks)
+                callback(name);
+        }
+    }
+#else
+    (void) fd;
+    (void) events;
+    return false;
+#endif
+}
+
+void FileWatcher::clear() {
+    if (inotifyFd >= 0) {
+        FdHandler::removeFd(inotifyFd);
+        close(inotifyFd);
+        inotifyFd = -1;
+    }
+    watches.clear();
+    directoryWatches.clear();
+}
@@ -0,0 +1,39 @@
+//
+// Created by Emil Ebert on 18.10.26.
+//
+
+#ifndef FILEWATCHER_H
+#define FILEWATCHER_H
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <functional>
+
+// notifies about changes inside watched directories, backed by inotify on linux.
+// the callback receives the name of the changed entry, or an empty name if the directory itself went away
+class FileWatcher {
+private:
+    struct Watch {
+        std::string directory;
+        std::vector<std::function<void(const std::string &)> > callbacks;
+    };
+
+    static int inotifyFd;
+    static std::unordered_map<int, Watch> watches;
+    static std::unordered_map<std::string, int> directoryWatches;
+
+public:
+    // returns false if the directory can't be watched, callers have to validate their data themselves then
+    static bool watch(const std::string &directory, const std::function<void(const std::string &)> &callback);
+
+    static void clear();
+
+private:
+    static bool init();
+
+    static bool onEvent(int fd, short events);
+};
+
+
+#endif //FILEWATCHER_H
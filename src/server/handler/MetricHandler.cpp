@@ -16,13 +16,15 @@ std::unordered_map<std::string, size_t> &MetricHandler::getAllFullMetric() {
     return lastFullMetrics;
 }
 
-void MetricHandler::resetMetrics() {
+bool MetricHandler::resetMetrics() {
     if (std::time(nullptr) - lastResetTime > RESET_INTERVAL) {
         for (auto metric : metrics)
             lastFullMetrics[metric.first] = metric.second;
         metrics.clear();
         lastResetTime = std::time(nullptr);
+        return true;
     }
+    return false;
 }
 
 std::time_t MetricHandler::getLastResetTime() {
@@ -23,7 +23,8 @@ public:
 
     static std::unordered_map<std::string, size_t>& getAllFullMetric();
 
-    static void resetMetrics();
+    // returns true when the window was rolled and the full metrics changed
+    static bool resetMetrics();
 
     static std::time_t getLastResetTime();
 };
@@ -0,0 +1,61 @@
+//
+// Created by Emil Ebert on 18.10.26.
+//
+
+#include "MetricStream.h"
+
+#include <algorithm>
+#include <webserv.h>
+#include <server/handler/MetricHandler.h>
+
+std::vector<std::weak_ptr<SmartBuffer> > MetricStream::subscribers;
+std::string MetricStream::lastFrame;
+
+HttpResponse MetricStream::subscribe() {
+    const auto body = std::make_shared<SmartBuffer>();
+    body->setStreaming(true);
+    if (!lastFrame.empty())
+        body->append(lastFrame.data(), lastFrame.size());
+
+    HttpResponse response(HttpResponse::OK);
+    response.enableChunkedEncoding(body);
+    response.setHeader("Content-Type", "text/event-stream");
+    response.setHeader("Cache-Control", "no-cache");
+    response.setHeader("Access-Control-Allow-Origin", "*");
+
+    removeClosedSubscribers();
+    subscribers.push_back(body);
+    return response;
+}
+
+void MetricStream::publish(const std::string &data) {
+    lastFrame = "data: " + data + "\n\n";
+    removeClosedSubscribers();
+
+    for (const auto &subscriber: subscribers) {
+        const auto body = subscriber.lock();
+        // a subscriber that did not read the previous frames yet skips this one instead of buffering it
+        const size_t pending = body->getSize() - body->getReadPos() + body->getReadBufferSize();
+        if (pending > METRIC_STREAM_MAX_PENDING) {
+            MetricHandler::incrementMetric("metric_stream_skipped", 1);
+            continue;
+        }
+        body->append(lastFrame.data(), lastFrame.size());
+    }
+}
+
+size_t MetricStream::getSubscriberCount() {
+    removeClosedSubscribers();
+    return subscribers.size();
+}
+
+void MetricStream::clear() {
+    subscribers.clear();
+    lastFrame.clear();
+}
+
+void MetricStream::removeClosedSubscribers() {
+    subscribers.erase(std::remove_if(subscribers.begin(), subscribers.end(), [](const std::weak_ptr<SmartBuffer> &body) {
+        return body.expired();
+    }), subscribers.end());
+}
@@ -0,0 +1,36 @@
+//
+// Created by Emil Ebert on 18.10.26.
+//
+
+#ifndef METRICSTREAM_H
+#define METRICSTREAM_H
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <server/buffer/SmartBuffer.h>
+#include <server/response/HttpResponse.h>
+
+// server-sent events for the metrics. every subscriber gets a streaming body that never ends,
+// a published frame is serialized once and appended to all of them.
+// the bodies are only referenced weakly, so a closed connection drops its subscription
+class MetricStream {
+private:
+    static std::vector<std::weak_ptr<SmartBuffer> > subscribers;
+    static std::string lastFrame;
+
+public:
+    static HttpResponse subscribe();
+
+    static void publish(const std::string &data);
+
+    static size_t getSubscriberCount();
+
+    static void clear();
+
+private:
+    static void removeClosedSubscribers();
+};
+
+
+#endif //METRICSTREAM_H
@@ -0,0 +1,178 @@
+//
+// Created by Emil Ebert on 18.10.26.
+//
+
+#include "SystemStats.h"
+
+#include <cstdlib>
+#include <algorithm>
+#include <ctime>
+#include <fstream>
+#include <sstream>
+#include <unistd.h>
+#include <sys/statvfs.h>
+#ifdef __APPLE__
+#include <mach/mach.h>
+#include <sys/sysctl.h>
+#endif
+#include <webserv.h>
+#include <parser/json/JsonValue.h>
+#include <server/handler/CallbackHandler.h>
+
+std::shared_ptr<const PrerenderedResponse> SystemStats::response;
+SystemStats::CpuTimes SystemStats::lastCpuTimes;
+std::chrono::steady_clock::time_point SystemStats::lastSample;
+std::chrono::steady_clock::time_point SystemStats::lastAccess;
+int SystemStats::callbackId = -1;
+
+HttpResponse SystemStats::createResponse() {
+    const auto now = std::chrono::steady_clock::now();
+    lastAccess = now;
+
+    // the sampler is only running while someone asks for the stats, the first request after a pause samples itself
+    if (!response || (callbackId == -1 && now - lastSample >= std::chrono::milliseconds(SYSTEM_STATS_INTERVAL_MS)))
+        sample();
+    if (callbackId == -1)
+        callbackId = static_cast<int>(CallbackHandler::registerCallback(onTick));
+
+    HttpResponse result(HttpResponse::OK);
+    result.setPrerendered(response);
+    return result;
+}
+
+void SystemStats::clear() {
+    if (callbackId != -1)
+        CallbackHandler::unregisterCallback(callbackId);
+    callbackId = -1;
+    response.reset();
+    lastCpuTimes = {};
+}
+
+bool SystemStats::onTick() {
+    const auto now = std::chrono::steady_clock::now();
+    if (now - lastAccess > std::chrono::seconds(SYSTEM_STATS_IDLE_TIMEOUT)) {
+        callbackId = -1;
+        return true;
+    }
+
+    if (now - lastSample >= std::chrono::milliseconds(SYSTEM_STATS_INTERVAL_MS))
+        sample();
+    return false;
+}
+
+bool SystemStats::readCpuTimes(CpuTimes &times) {
+#ifdef __linux__
+    std::ifstream stat("/proc/stat");
+    std::string label;
+    if (!(stat >> label) || label != "cpu")
+        return false;
+
+    // user nice system idle iowait irq softirq steal, guest time is already part of user
+    uint64_t values[8] = {};
+    for (uint64_t &value: values)
+        if (!(stat >> value))
+            return false;
+
+    times.total = 0;
+    for (const uint64_t value: values)
+        times.total += value;
+    times.idle = values[3] + values[4];
+    return true;
+#else
+    (void) times;
+    return false;
+#endif
+}
+
+double SystemStats::getCpuLoad() {
+    CpuTimes current;
+    if (!readCpuTimes(current)) {
+        double load[1];
+        const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        if (getloadavg(load, 1) != 1 || cpus <= 0)
+            return 0.0;
+        return std::min(load[0] / static_cast<double>(cpus) * 100.0, 100.0);
+    }
+
+    // the first sample only knows the times since boot
+    const CpuTimes previous = lastCpuTimes;
+    lastCpuTimes = current;
+    const uint64_t total = current.total - previous.total;
+    const uint64_t idle = current.idle - previous.idle;
+    if (total == 0)
+        return 0.0;
+    return static_cast<double>(total - idle) / static_cast<double>(total) * 100.0;
+}
+
+static void readMemory(uint64_t &total, uint64_t &used) {
+    total = 0;
+    used = 0;
+#ifdef __linux__
+    std::ifstream meminfo("/proc/meminfo");
+    std::string line;
+    uint64_t available = 0;
+    while (std::getline(meminfo, line)) {
+        std::istringstream fields(line);
+        std::string name;
+        uint64_t value = 0;
+        fields >> name >> value;
+        if (name == "MemTotal:")
+            total = value * 1024;
+        else if (name == "MemAvailable:")
+            available = value * 1024;
+    }
+    used = total > available ? total - available : 0;
+#elif defined(__APPLE__)
+    int64_t memory = 0;
+    size_t length = sizeof(memory);
+    int mib[2] = {CTL_HW, HW_MEMSIZE};
+    if (sysctl(mib, 2, &memory, &length, nullptr, 0) != 0)
+        return;
+    total = static_cast<uint64_t>(memory);
+
+    vm_statistics64_data_t vmStats;
+    mach_msg_type_number_t count = HOST_VM_INFO64_COUNT;
+    if (host_statistics64(mach_host_self(), HOST_VM_INFO64, reinterpret_cast<host_info64_t>(&vmStats), &count) !=
+        KERN_SUCCESS)
+        return;
+    const uint64_t free = static_cast<uint64_t>(vmStats.free_count) * static_cast<uint64_t>(getpagesize());
+    used = total > free ? total - free : 0;
+#endif
+}
+
+static JsonValue::JsonObject createUsage(const uint64_t total, const uint64_t used) {
+    JsonValue::JsonObject usage;
+    usage["total"] = std::make_shared<JsonValue>(static_cast<ssize_t>(total));
+    usage["used"] = std::make_shared<JsonValue>(static_cast<ssize_t>(used));
+    return usage;
+}
+
+void SystemStats::sample() {
+    lastSample = std::chrono::steady_clock::now();
+
+    JsonValue::JsonObject jsonObj;
+    // json numbers are integers here, so the load is a rounded percentage
+    jsonObj["cpu_load"] = std::make_shared<JsonValue>(static_cast<ssize_t>(getCpuLoad() + 0.5));
+    jsonObj["cpu_count"] = std::make_shared<JsonValue>(static_cast<ssize_t>(sysconf(_SC_NPROCESSORS_ONLN)));
+
+    uint64_t memoryTotal;
+    uint64_t memoryUsed;
+    readMemory(memoryTotal, memoryUsed);
+    jsonObj["memory"] = std::make_shared<JsonValue>(createUsage(memoryTotal, memoryUsed));
+
+    struct statvfs disk = {};
+    if (statvfs("/", &disk) == 0)
+        jsonObj["disk"] = std::make_shared<JsonValue>(createUsage(
+            static_cast<uint64_t>(disk.f_blocks) * disk.f_frsize,
+            static_cast<uint64_t>(disk.f_blocks - disk.f_bfree) * disk.f_frsize));
+    else
+        jsonObj["disk"] = std::make_shared<JsonValue>(createUsage(0, 0));
+
+    jsonObj["sampled_at"] = std::make_shared<JsonValue>(static_cast<ssize_t>(std::time(nullptr)));
+
+    HttpResponse base(HttpResponse::OK);
+    base.setHeader("Content-Type", "application/json");
+    base.setHeader("Access-Control-Allow-Origin", "*");
+    base.setHeader("Cache-Control", "no-store");
+    response = base.prerender(JsonValue(jsonObj).toString());
+}
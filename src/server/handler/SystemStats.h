@@ -0,0 +1,45 @@
+//
+// Created by Emil Ebert on 18.10.26.
+//
+
+#ifndef SYSTEMSTATS_H
+#define SYSTEMSTATS_H
+
+#include <memory>
+#include <chrono>
+#include <cstdint>
+#include <server/response/HttpResponse.h>
+
+// cpu, memory and disk usage of the host for the /system endpoint.
+// the values are sampled by a callback every SYSTEM_STATS_INTERVAL_MS and rendered once per sample,
+// the sampler stops when nobody asked for the stats for SYSTEM_STATS_IDLE_TIMEOUT seconds
+class SystemStats {
+private:
+    struct CpuTimes {
+        uint64_t total = 0;
+        uint64_t idle = 0;
+    };
+
+    static std::shared_ptr<const PrerenderedResponse> response;
+    static CpuTimes lastCpuTimes;
+    static std::chrono::steady_clock::time_point lastSample;
+    static std::chrono::steady_clock::time_point lastAccess;
+    static int callbackId;
+
+public:
+    static HttpResponse createResponse();
+
+    static void clear();
+
+private:
+    static void sample();
+
+    static bool onTick();
+
+    static bool readCpuTimes(CpuTimes &times);
+
+    static double getCpuLoad();
+};
+
+
+#endif //SYSTEMSTATS_H
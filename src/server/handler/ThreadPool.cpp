@@ -0,0 +1,189 @@
+//
+// Created by Emil Ebert on 18.10.26.
+//
+
+#include "ThreadPool.h"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <cstdint>
+#include <common/Logger.h>
+#include <server/FdHandler.h>
+#include <server/handler/MetricHandler.h>
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
+
+std::vector<std::thread> ThreadPool::threads;
+std::mutex ThreadPool::mutex;
+std::condition_variable ThreadPool::condition;
+std::deque<std::shared_ptr<ThreadPool::Task> > ThreadPool::pending;
+std::deque<std::shared_ptr<ThreadPool::Task> > ThreadPool::completed;
+bool ThreadPool::stopping = false;
+int ThreadPool::notifyFd = -1;
+int ThreadPool::notifyWriteFd = -1;
+size_t ThreadPool::runningTasks = 0;
+size_t ThreadPool::maxQueueDepth = 0;
+
+void ThreadPool::configure(const size_t threadCount) {
+    clear();
+
+#ifdef __linux__
+    notifyFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    notifyWriteFd = notifyFd;
+#else
+    int fds[2];
+    if (pipe(fds) == 0) {
+        for (const int fd: fds) {
+            fcntl(fd, F_SETFL, O_NONBLOCK);
+            fcntl(fd, F_SETFD, FD_CLOEXEC);
+        }
+        notifyFd = fds[0];
+        notifyWriteFd = fds[1];
+    }
+#endif
+    if (notifyFd < 0) {
+        Logger::log(LogLevel::ERROR, "Failed to create the thread pool notification fd");
+        return;
+    }
+    FdHandler::addFd(notifyFd, POLLIN, [](const int fd, const short events) {
+        return onNotify(fd, events);
+    });
+
+    for (size_t i = 0; i < threadCount; i++)
+        threads.emplace_back(workerLoop);
+    Logger::log(LogLevel::DEBUG, "Thread pool started with " + std::to_string(threadCount) + " threads");
+}
+
+std::shared_ptr<ThreadPool::Task> ThreadPool::submit(Work work, Done done) {
+    auto task = std::make_shared<Task>();
+    task->work = std::move(work);
+    task->done = std::move(done);
+    MetricHandler::incrementMetric("thread_pool_tasks", 1);
+
+    if (threads.empty()) {
+        task->work();
+        complete(task);
+        return task;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        pending.push_back(task);
+        maxQueueDepth = std::max(maxQueueDepth, pending.size());
+    }
+    condition.notify_one();
+    return task;
+}
+
+void ThreadPool::cancel(const std::shared_ptr<Task> &task) {
+    if (!task)
+        return;
+    std::lock_guard<std::mutex> lock(mutex);
+    task->cancelled = true;
+}
+
+void ThreadPool::workerLoop() {
+    while (true) {
+        std::shared_ptr<Task> task;
+        bool skip;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            condition.wait(lock, [] { return stopping || !pending.empty(); });
+            if (stopping)
+                return;
+            task = pending.front();
+            pending.pop_front();
+            skip = task->cancelled;
+            if (!skip)
+                runningTasks++;
+        }
+
+        // the logger is not thread safe, so failures are left for done to notice
+        if (!skip) {
+            try {
+                task->work();
+            } catch (...) {
+            }
+            std::lock_guard<std::mutex> lock(mutex);
+            runningTasks--;
+        }
+        // even a skipped task goes back to the loop, so whatever it holds is released there
+        complete(std::move(task));
+    }
+}
+
+void ThreadPool::complete(std::shared_ptr<Task> task) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        completed.push_back(std::move(task));
+    }
+    notify();
+}
+
+void ThreadPool::notify() {
+#ifdef __linux__
+    const uint64_t one = 1;
+    (void) !write(notifyWriteFd, &one, sizeof(one));
+#else
+    (void) !write(notifyWriteFd, "", 1);
+#endif
+}
+
+bool ThreadPool::onNotify(const int fd, const short events) {
+    (void) events;
+    char buffer[64];
+    while (read(fd, buffer, sizeof(buffer)) > 0) {
+    }
+
+    std::deque<std::shared_ptr<Task> > finished;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        finished.swap(completed);
+    }
+    for (const auto &task: finished) {
+        if (task->cancelled)
+            continue;
+        try {
+            task->done();
+        } catch (std::exception &e) {
+            Logger::log(LogLevel::ERROR, "Thread pool task failed to complete: " + std::string(e.what()));
+        }
+    }
+    return false;
+}
+
+void ThreadPool::clear() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+        pending.clear();
+    }
+    condition.notify_all();
+    for (std::thread &thread: threads)
+        thread.join();
+    threads.clear();
+
+    std::lock_guard<std::mutex> lock(mutex);
+    completed.clear();
+    stopping = false;
+    runningTasks = 0;
+    if (notifyFd >= 0) {
+        FdHandler::removeFd(notifyFd);
+        close(notifyFd);
+    }
+    if (notifyWriteFd >= 0 && notifyWriteFd != notifyFd)
+        close(notifyWriteFd);
+    notifyFd = -1;
+    notifyWriteFd = -1;
+}
+
+size_t ThreadPool::getQueueDepth() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return pending.size();
+}
+
+size_t ThreadPool::getRunningCount() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return runningTasks;
+}
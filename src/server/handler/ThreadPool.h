@@ -0,0 +1,71 @@
+//
+// Created by Emil Ebert on 18.10.26.
+//
+
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <deque>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+// runs blocking work like filesystem calls on worker threads, so a slow disk only stalls the request waiting for it.
+// the work must not touch anything of the event loop, its completion runs on the loop once an eventfd wakes it up
+class ThreadPool {
+public:
+    using Work = std::function<void()>;
+    using Done = std::function<void()>;
+
+    struct Task {
+        Work work;
+        Done done;
+        // set on the loop, the work is skipped if it did not start yet and done is never called
+        bool cancelled = false;
+    };
+
+private:
+    static std::vector<std::thread> threads;
+    static std::mutex mutex;
+    static std::condition_variable condition;
+    static std::deque<std::shared_ptr<Task> > pending;
+    static std::deque<std::shared_ptr<Task> > completed;
+    static bool stopping;
+    // the workers signal finished tasks here, it is polled like any other fd. an eventfd is both ends at once
+    static int notifyFd;
+    static int notifyWriteFd;
+    static size_t runningTasks;
+    static size_t maxQueueDepth;
+
+    static void workerLoop();
+
+    static void complete(std::shared_ptr<Task> task);
+
+    static void notify();
+
+    static bool onNotify(int fd, short events);
+
+public:
+    // 0 threads runs the work on the loop, but still completes it asynchronously
+    static void configure(size_t threadCount);
+
+    // done runs on the loop after work finished on a worker
+    static std::shared_ptr<Task> submit(Work work, Done done);
+
+    // the owner of the task is gone, running work still finishes but its result is dropped
+    static void cancel(const std::shared_ptr<Task> &task);
+
+    // stops and joins the workers, queued work is dropped
+    static void clear();
+
+    static size_t getThreadCount() { return threads.size(); }
+    static size_t getQueueDepth();
+    static size_t getRunningCount();
+    static size_t getMaxQueueDepth() { return maxQueueDepth; }
+};
+
+
+#endif //THREADPOOL_H
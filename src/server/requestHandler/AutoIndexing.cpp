@@ -14,6 +14,10 @@
 #include <iomanip>
 #include <string>
 #include <filesystem>
+#include <cerrno>
+#include <cstring>
+#include <parser/json/JsonValue.h>
+#include <server/handler/MetricHandler.h>
 
 
 static std::string formatSize(off_t sizeInBytes) {
@@ -52,93 +56,252 @@ static std::string formatSize(off_t sizeInBytes) {
     return sizeStr + " " + units[unitIndex];
 }
 
-HttpResponse RequestHandler::handleAutoIndex(const std::string &path) {
-    Logger::log(LogLevel::DEBUG, "Auto indexing path: " + path);
+// value of name in the query string, empty if it is missing
+static std::string getQueryParameter(const std::string &query, const std::string &name) {
+    std::istringstream stream(query);
+    std::string pair;
+    while (std::getline(stream, pair, '&')) {
+        const size_t equals = pair.find('=');
+        if (pair.compare(0, equals, name) == 0)
+            return equals == std::string::npos ? "" : pair.substr(equals + 1);
+    }
+    return "";
+}
 
-    if (access(path.c_str(), R_OK) == -1)
-        return HttpResponse::html(HttpResponse::StatusCode::FORBIDDEN);
+// a missing value counts as 0
+static bool parseCount(const std::string &value, size_t &count) {
+    count = 0;
+    if (value.empty())
+        return true;
+    if (value.size() > 18 || value.find_first_not_of("0123456789") != std::string::npos)
+        return false;
+    count = std::stoull(value);
+    return true;
+}
 
-    DIR *dir = opendir(path.c_str());
-    if (!dir)
-        return HttpResponse::html(HttpResponse::StatusCode::NOT_FOUND);
+static std::string escapeHtml(const std::string &text) {
+    std::string escaped;
+    escaped.reserve(text.size());
+    for (const char c: text) {
+        switch (c) {
+            case '&': escaped += "&amp;";
+                break;
+            case '<': escaped += "&lt;";
+                break;
+            case '>': escaped += "&gt;";
+                break;
+            case '"': escaped += "&quot;";
+                break;
+            default: escaped += c;
+        }
+    }
+    return escaped;
+}
 
-    typedef std::pair<std::string, struct stat> Entry;
-    std::vector<Entry> entries;
-    struct dirent *entry;
+static std::string renderHead(const AutoIndexStream &stream) {
+    std::ostringstream head;
+    if (stream.json) {
+        head << "{\"path\":" << JsonValue(stream.uriPath).toString()
+                << ",\"total\":" << stream.listing->entries.size()
+                << ",\"offset\":" << stream.offset
+                << ",\"limit\":" << stream.limit
+                << ",\"entries\":[";
+        return head.str();
+    }
+
+    head << "<!DOCTYPE html>\n";
+    head << "<html lang=\"en\">\n";
+    head << "<head>\n";
+    head << "  <meta charset=\"UTF-8\" />\n";
+    head << "  <title>Directory Listing</title>\n";
+    head << "  <script src=\"https://cdn.tailwindcss.com\"></script>\n";
+    head << "</head>\n";
+    head << "<body class=\"min-h-screen flex flex-col bg-gray-50\">\n";
+    head << "  <main class=\"flex-grow container mx-auto px-16 py-16 flex flex-col items-center justify-center\">\n";
+    head << "    <h2 class=\"text-4xl font-extrabold text-gray-900 mb-2\">Directory Listing</h2>\n";
+    head << "    <p class=\"text-lg text-gray-600 mb-8 text-center\">\n";
+    head << "      Below is the list of files and directories in the current directory.\n";
+    head << "    </p>\n";
+    head <<
+            "    <table class=\"min-w-full text-sm divide-y divide-gray-300 shadow bg-white rounded-lg overflow-hidden\">\n";
+    head << "      <thead class=\"bg-gray-100\">\n";
+    head << "        <tr>\n";
+    head << "          <th class=\"text-left px-6 py-3 font-semibold\">Name</th>\n";
+    head << "          <th class=\"text-left px-6 py-3 font-semibold\">Last Modified</th>\n";
+    head << "          <th class=\"text-left px-6 py-3 font-semibold\">Size</th>\n";
+    head << "        </tr>\n";
+    head << "      </thead>\n";
+    head << "      <tbody class=\"divide-y divide-gray-200\">\n";
+    head << "      <tr>  <td class=\"px-6 py-4\"><a href=\"" << escapeHtml(stream.uriPath) <<
+            "../\" class=\"text-indigo-600 hover:underline\">../</a></td>"
+            "  <td class=\"px-6 py-4 text-gray-500\">-</td>  <td class=\"px-6 py-4 text-gray-500\">-</td>  </tr>\n";
+    return head.str();
+}
+
+static std::string renderFooter(const AutoIndexStream &stream) {
+    if (stream.json)
+        return "]}";
 
-    while ((entry = readdir(dir)) != nullptr) {
-        std::string name = entry->d_name;
-        if (name == ".") continue;
+    std::ostringstream footer;
+    footer << "      </tbody>\n";
+    footer << "</table>\n";
+    if (stream.limit > 0) {
+        const size_t total = stream.listing->entries.size();
+        footer << "    <p class=\"mt-6 space-x-6\">";
+        if (stream.offset > 0)
+            footer << "<a href=\"?offset=" << (stream.offset > stream.limit ? stream.offset - stream.limit : 0)
+                    << "&amp;limit=" << stream.limit << "\" class=\"text-indigo-600 hover:underline\">Previous</a>";
+        if (stream.end < total)
+            footer << "<a href=\"?offset=" << stream.end << "&amp;limit=" << stream.limit
+                    << "\" class=\"text-indigo-600 hover:underline\">Next</a>";
+        footer << "</p>\n";
+    }
+    footer << "</main>\n";
+    footer << "</body>\n</html>";
+    return footer.str();
+}
+
+// renders the entries [first, last) of the listing and stops early once the batch is large enough, last is set
+// to the first entry that was not rendered then. it stats every entry, so it runs on the thread pool
+static std::string renderEntries(const AutoIndexStream &stream, const size_t first, size_t &last) {
+    const int directoryFd = open(stream.directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    const size_t begin = std::min(stream.offset, stream.listing->entries.size());
+    std::string rendered;
+    // entries are often written together, so the formatted time of the last one is reused
+    std::time_t formattedMinute = -1;
+    char timebuf[64] = "-";
 
-        std::string fullPath = path + "/" + name;
-        struct stat fileStat;
-        if (stat(fullPath.c_str(), &fileStat) == -1)
+    size_t i = first;
+    for (; i < last && rendered.size() < AUTOINDEX_BATCH_MAX_BYTES; i++) {
+        const DirectoryEntry &entry = stream.listing->entries[i];
+        // an entry removed since the listing was read is still shown, just without its size and time
+        struct stat info{};
+        const bool found = directoryFd >= 0 && fstatat(directoryFd, entry.name.c_str(), &info, 0) == 0;
+        const bool directory = found ? S_ISDIR(info.st_mode) : entry.directory;
+
+        if (stream.json) {
+            if (i != begin)
+                rendered += ",";
+            rendered += "{\"name\":" + JsonValue(entry.name).toString();
+            rendered += directory ? ",\"type\":\"directory\"" : ",\"type\":\"file\"";
+            if (found && !directory)
+                rendered += ",\"size\":" + std::to_string(info.st_size);
+            if (found)
+                rendered += ",\"mtime\":" + std::to_string(info.st_mtime);
+            rendered += "}";
             continue;
+        }
 
-        if (S_ISDIR(fileStat.st_mode))
-            name += "/";
+        if (!found) {
+            std::strcpy(timebuf, "-");
+            formattedMinute = -1;
+        } else if (info.st_mtime / 60 != formattedMinute) {
+            std::tm mtime{};
+            localtime_r(&info.st_mtime, &mtime);
+            std::strftime(timebuf, sizeof(timebuf), "%Y-%m-%d %H:%M", &mtime);
+            formattedMinute = info.st_mtime / 60;
+        }
 
-        entries.push_back(std::make_pair(name, fileStat));
+        const std::string name = escapeHtml(entry.name) + (directory ? "/" : "");
+        rendered += "      <tr>  <td class=\"px-6 py-4\"><a href=\"" + escapeHtml(stream.uriPath) + name +
+                "\" class=\"text-indigo-600 hover:underline\">" + name + "</a></td>";
+        rendered += "  <td class=\"px-6 py-4 text-gray-500\">" + std::string(timebuf) + "</td>";
+        rendered += "  <td class=\"px-6 py-4 text-gray-500\">" +
+                (found && !directory ? formatSize(info.st_size) : std::string("-")) + "</td>  </tr>\n";
     }
-    closedir(dir);
+    if (directoryFd >= 0)
+        close(directoryFd);
+    last = i;
+    return rendered;
+}
 
-    std::sort(entries.begin(), entries.end(), [](const Entry &a, const Entry &b) {
-        return a.first < b.first;
-    });
+HttpResponse RequestHandler::handleAutoIndex(const std::string &path) {
+    Logger::log(LogLevel::DEBUG, "Auto indexing path: " + path);
 
-    std::ostringstream html;
-
-    html << "<!DOCTYPE html>\n";
-    html << "<html lang=\"en\">\n";
-    html << "<head>\n";
-    html << "  <meta charset=\"UTF-8\" />\n";
-    html << "  <title>Directory Listing</title>\n";
-    html << "  <script src=\"https://cdn.tailwindcss.com\"></script>\n";
-    html << "</head>\n";
-    html << "<body class=\"min-h-screen flex flex-col bg-gray-50\">\n";
-    html << "  <main class=\"flex-grow container mx-auto px-16 py-16 flex flex-col items-center justify-center\">\n";
-    html << "    <h2 class=\"text-4xl font-extrabold text-gray-900 mb-2\">Directory Listing</h2>\n";
-    html << "    <p class=\"text-lg text-gray-600 mb-8 text-center\">\n";
-    html << "      Below is the list of files and directories in the current directory.\n";
-    html << "    </p>\n";
-    html <<
-            "    <table class=\"min-w-full text-sm divide-y divide-gray-300 shadow bg-white rounded-lg overflow-hidden\">\n";
-    html << "      <thead class=\"bg-gray-100\">\n";
-    html << "        <tr>\n";
-    html << "          <th class=\"text-left px-6 py-3 font-semibold\">Name</th>\n";
-    html << "          <th class=\"text-left px-6 py-3 font-semibold\">Last Modified</th>\n";
-    html << "          <th class=\"text-left px-6 py-3 font-semibold\">Size</th>\n";
-    html << "        </tr>\n";
-    html << "      </thead>\n";
-
-    for (std::vector<Entry>::const_iterator it = entries.begin(); it != entries.end(); ++it) {
-        const std::string &name = it->first;
-        const struct stat &info = it->second;
-
-        std::ostringstream sizeStr;
-        if (S_ISDIR(info.st_mode))
-            sizeStr << "-";
-        else
-            sizeStr << formatSize(info.st_size);
-
-        char timebuf[64];
-        std::tm *mtime = std::localtime(&info.st_mtime);
-        std::strftime(timebuf, sizeof(timebuf), "%Y-%m-%d %H:%M", mtime);
-
-        html << "      <tbody class=\"divide-y divide-gray-200\">\n";
-        html << "      <tr>";
-        html << "  <td class=\"px-6 py-4\"><a href=\"" << request->getPath() << "/" << name <<
-                "\" class=\"text-indigo-600 hover:underline\">" << name << "</a></td>";
-        html << "  <td class=\"px-6 py-4 text-gray-500\">" << timebuf << "</td>";
-        html << "  <td class=\"px-6 py-4 text-gray-500\">" << sizeStr.str() << "</td>";
-        html << "  </tr>\n";
+    // the listing is read on the thread pool together with the other lookups when the request went there
+    if (!directoryListing) {
+        directoryListing = DirectoryCache::find(path);
+        struct stat directory{};
+        const bool cached = directoryListing && stat(path.c_str(), &directory) == 0 &&
+                            DirectoryCache::isCurrent(*directoryListing, directory);
+        if (!cached) {
+            directoryListing = DirectoryCache::read(path);
+            DirectoryCache::store(path, directoryListing);
+        }
+        MetricHandler::incrementMetric(cached ? "autoindex_cache_hits" : "autoindex_cache_misses", 1);
     }
+    if (directoryListing->error == EACCES)
+        return HttpResponse::html(HttpResponse::StatusCode::FORBIDDEN);
+    if (directoryListing->error != 0)
+        return HttpResponse::html(HttpResponse::StatusCode::NOT_FOUND);
+
+    const std::string query = request->getQueryString();
+    const std::string format = getQueryParameter(query, "format");
+    size_t offset;
+    size_t limit;
+    if ((!format.empty() && format != "html" && format != "json") ||
+        !parseCount(getQueryParameter(query, "offset"), offset) ||
+        !parseCount(getQueryParameter(query, "limit"), limit))
+        return HttpResponse::html(HttpResponse::StatusCode::BAD_REQUEST);
 
-    html << "</table>\n";
-    html << "</body>\n</html>";
+    const auto stream = std::make_shared<AutoIndexStream>();
+    stream->listing = directoryListing;
+    stream->directory = path;
+    stream->uriPath = request->getPath();
+    if (stream->uriPath.empty() || stream->uriPath.back() != '/')
+        stream->uriPath += "/";
+    stream->json = format == "json";
+    stream->offset = offset;
+    stream->limit = limit;
+    const size_t total = directoryListing->entries.size();
+    stream->next = std::min(offset, total);
+    stream->end = limit == 0 ? total : std::min(total, stream->next + limit);
+    stream->body = std::make_shared<SmartBuffer>(static_cast<size_t>(AUTOINDEX_BODY_MEMORY_SIZE));
+
+    const std::string head = renderHead(*stream);
+    stream->body->append(head.data(), head.size());
 
     HttpResponse response(HttpResponse::StatusCode::OK);
-    response.setHeader("Content-Type", "text/html");
-    response.setBody(html.str());
+    response.setHeader("Content-Type", stream->json ? "application/json" : "text/html");
+    response.enableChunkedEncoding(stream->body);
+    // HEAD drops the body, so there is nothing to render
+    if (request->method == HEAD)
+        return response;
+
+    stream->body->setStreaming(true);
+    autoIndex = stream;
+    renderAutoIndex();
     return response;
 }
+
+void RequestHandler::renderAutoIndex() {
+    AutoIndexStream &stream = *autoIndex;
+    const std::shared_ptr<SmartBuffer> &body = stream.body;
+    const size_t pending = body->getSize() - body->getReadPos() + body->getReadBufferSize();
+    if (fileTask || !body->isStreaming() || pending > AUTOINDEX_MAX_PENDING)
+        return;
+
+    if (stream.next >= stream.end) {
+        const std::string footer = renderFooter(stream);
+        body->append(footer.data(), footer.size());
+        body->setStreaming(false);
+        return;
+    }
+
+    const size_t first = stream.next;
+    const auto last = std::make_shared<size_t>(std::min(stream.end, first + AUTOINDEX_BATCH_SIZE));
+    const auto rendered = std::make_shared<std::string>();
+    fileTask = ThreadPool::submit([state = autoIndex, first, last, rendered] {
+        *rendered = renderEntries(*state, first, *last);
+    }, [this, last, rendered] {
+        fileTask.reset();
+        autoIndex->body->append(rendered->data(), rendered->size());
+        autoIndex->next = *last;
+        renderAutoIndex();
+    });
+}
+
+void RequestHandler::resumeAutoIndex() {
+    if (autoIndex)
+        renderAutoIndex();
+}
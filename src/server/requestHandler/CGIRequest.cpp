@@ -4,9 +4,17 @@
 #include <fcntl.h>
 #include <csignal>
 #include <filesystem>
+#include <cstring>
+#include <spawn.h>
 #include <server/FdHandler.h>
+#include <arpa/inet.h>
+#include <sys/ioctl.h>
+#include <sys/uio.h>
+#include <cerrno>
 
 #include "common/Logger.h"
+#include "webserv.h"
+#include "server/handler/MetricHandler.h"
 #include "RequestHandler.h"
 #include "server/ClientConnection.h"
 
@@ -22,133 +30,230 @@ bool RequestHandler::validateCgiEnvironment() const {
     return true;
 }
 
+// close on exec, the child only keeps the ends that are duplicated onto stdin and stdout
 static bool setupPipes(int input_pipe[2], int output_pipe[2]) {
-    if (pipe(input_pipe) < 0 || pipe(output_pipe) < 0) {
+    if (pipe(input_pipe) < 0) {
+        Logger::log(LogLevel::ERROR, "Failed to create pipes for CGI");
+        return false;
+    }
+    if (pipe(output_pipe) < 0) {
+        close(input_pipe[0]);
+        close(input_pipe[1]);
         Logger::log(LogLevel::ERROR, "Failed to create pipes for CGI");
         return false;
     }
 
+    for (const int fd: {input_pipe[0], input_pipe[1], output_pipe[0], output_pipe[1]})
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
     return true;
 }
 
-void RequestHandler::configureCgiChildProcess(int input_pipe[2], int output_pipe[2]) const {
-    const std::string filePath = getFilePath();
-    dup2(input_pipe[0], STDIN_FILENO);
-    dup2(output_pipe[1], STDOUT_FILENO);
-    //int devNull = open("/dev/null", O_WRONLY);
-    //dup2(devNull, STDERR_FILENO);
-    //close(devNull);
-
-    close(input_pipe[0]);
-    close(input_pipe[1]);
-    close(output_pipe[0]);
-    close(output_pipe[1]);
-
-    std::unordered_map<std::string, std::string> env;
-    std::string scriptFileName = std::filesystem::path(filePath).filename().string();
+std::vector<std::string> RequestHandler::createRequestEnvironment(const std::string &scriptFileName) const {
+    std::vector<std::string> env;
+    env.reserve(request->headers.size() + 9);
 
     for (const auto &header: request->headers) {
-        std::string name = header.first;
-        std::string value = header.second;
-
-        std::string envName = "HTTP_";
-        for (char c: name) {
-            if (c == '-') {
-                envName += '_';
-            } else {
-                envName += std::toupper(c);
-            }
-        }
-
-        env[envName] = value;
+        std::string variable = "HTTP_";
+        for (const char c: header.first)
+            variable += c == '-' ? '_' : static_cast<char>(std::toupper(c));
+        variable += '=';
+        variable += header.second;
+        env.push_back(std::move(variable));
     }
 
-    env["QUERY_STRING"] = request->getQueryString();
-    env["REQUEST_METHOD"] = request->getMethodString();
-    env["CONTENT_TYPE"] = request->getHeader("Content-Type");
-    env["CONTENT_LENGTH"] = std::to_string(request->totalBodySize);
-    env["SERVER_PROTOCOL"] = "HTTP/1.1";
-    env["SERVER_SOFTWARE"] = "Webserv/1.0";
-    env["GATEWAY_INTERFACE"] = "CGI/1.1";
-    env["SERVER_NAME"] = serverConfig.host;
-    env["SERVER_PORT"] = std::to_string(serverConfig.port);
-    env["PATH_INFO"] = request->getPath();
-    env["SCRIPT_NAME"] = request->getPath();
-    env["REQUEST_URI"] = request->getUri();
-    env["SCRIPT_FILENAME"] = scriptFileName;
-    env["REDIRECT_STATUS"] = "200";
+    env.push_back("QUERY_STRING=" + request->getQueryString());
+    env.push_back("REQUEST_METHOD=" + request->getMethodString());
+    env.push_back("CONTENT_TYPE=" + request->getHeader("Content-Type"));
+    env.push_back("CONTENT_LENGTH=" + std::to_string(request->totalBodySize));
+    env.push_back("PATH_INFO=" + request->getPath());
+    env.push_back("SCRIPT_NAME=" + request->getPath());
+    env.push_back("REQUEST_URI=" + request->getUri());
+    env.push_back("SCRIPT_FILENAME=" + scriptFileName);
+    return env;
+}
+
+std::unordered_map<std::string, std::string> RequestHandler::createCgiEnvironment(
+    const std::string &scriptFileName) const {
+    std::unordered_map<std::string, std::string> env;
+
+    const auto add = [&env](const std::string &variable) {
+        const size_t separator = variable.find('=');
+        env[variable.substr(0, separator)] = variable.substr(separator + 1);
+    };
+    for (const auto &variable: matchedRoute->cgi_environment)
+        add(variable);
+    for (const auto &variable: createRequestEnvironment(scriptFileName))
+        add(variable);
+    return env;
+}
 
+pid_t RequestHandler::spawnCgiProcess(int input_pipe[2], int output_pipe[2]) const {
+    const std::filesystem::path filePath = getFilePath();
+    const std::string scriptFileName = filePath.filename().string();
+    const std::string directory = filePath.parent_path().string();
 
+    // the static part of the environment is prebuilt per route, only the request part is created here
+    const std::vector<std::string> requestEnvironment = createRequestEnvironment(scriptFileName);
     std::vector<char *> envp;
-    for (const auto &[fst, snd]: env) {
-        std::string envVar = fst + "=" + snd;
-        envp.push_back(strdup(envVar.data()));
-    }
+    envp.reserve(matchedRoute->cgi_environment.size() + requestEnvironment.size() + 1);
+    for (const auto &variable: matchedRoute->cgi_environment)
+        envp.push_back(const_cast<char *>(variable.c_str()));
+    for (const auto &variable: requestEnvironment)
+        envp.push_back(const_cast<char *>(variable.c_str()));
     envp.push_back(nullptr);
 
-    std::filesystem::path path = filePath;
-    std::string parentPath = path.parent_path().string();
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, input_pipe[0], STDIN_FILENO);
+    posix_spawn_file_actions_adddup2(&actions, output_pipe[1], STDOUT_FILENO);
+    if (!directory.empty())
+        posix_spawn_file_actions_addchdir_np(&actions, directory.c_str());
+#ifdef __GLIBC__
+#if __GLIBC_PREREQ(2, 34)
+    // client sockets and files of other requests are not close on exec
+    posix_spawn_file_actions_addclosefrom_np(&actions, STDERR_FILENO + 1);
+#endif
+#endif
 
-    chdir(parentPath.c_str());
+    char *const argv[] = {const_cast<char *>(cgiPath.c_str()), const_cast<char *>(scriptFileName.c_str()), nullptr};
+    pid_t pid = -1;
+    const int result = posix_spawn(&pid, cgiPath.c_str(), &actions, nullptr, argv, envp.data());
+    posix_spawn_file_actions_destroy(&actions);
+
+    if (result != 0) {
+        Logger::log(LogLevel::ERROR, "Failed to execute CGI script: " + scriptFileName + " with interpreter: " +
+                                     cgiPath + " (" + strerror(result) + ")");
+        return -1;
+    }
+    return pid;
+}
 
+void RequestHandler::onCgiProcessExit(const int status) {
+    cgiProcessId = -1;
+    cgiExitStatus = status;
+    if (WIFEXITED(status) && WEXITSTATUS(status) == 1)
+        Logger::log(LogLevel::ERROR, "CGI process exited with code: 1");
+    else
+        Logger::log(LogLevel::DEBUG, "CGI process exited");
+
+    // the output ended before the headers were complete and the exit code decides the error
+    if (cgiOutputFd == -1 && !cgiResponseStarted && client->cgiProcessStart != 0)
+        setResponse(createCgiErrorResponse());
+}
 
-    char *const argv[] = {const_cast<char *>(cgiPath.c_str()), const_cast<char *>(scriptFileName.c_str()), nullptr};
-    execve(cgiPath.c_str(), argv, envp.data());
+HttpResponse RequestHandler::createCgiErrorResponse() const {
+    if (cgiExitStatus && WIFEXITED(*cgiExitStatus) && WEXITSTATUS(*cgiExitStatus) == 1)
+        return HttpResponse::html(HttpResponse::StatusCode::INTERNAL_SERVER_ERROR,
+                                  "CGI Error: Process exited with code 1");
+    return cgiOutput.createResponse("CGI Error: Could not parse output");
+}
 
-    Logger::log(LogLevel::ERROR, "Failed to execute CGI script: " + scriptFileName + " with interpreter: " + cgiPath);
-    _exit(EXIT_FAILURE);
+std::optional<HttpResponse> RequestHandler::runCgi() {
+    if (matchedRoute->cgi_workers_max > 0 && CgiWorkerPool::isSupported(cgiPath))
+        return handleCgiWorker();
+    return handleCgi();
 }
 
-void RequestHandler::cleanupCgiProcess(const pid_t pid) const {
-    int status = 0;
-    const pid_t result = waitpid(pid, &status, WNOHANG);
+// GET requests of cached locations are answered from CgiCache, concurrent misses wait for the first one
+std::optional<HttpResponse> RequestHandler::handleCachedCgi() {
+    std::vector<std::string> headerValues;
+    for (const auto &name: matchedRoute->cgi_cache_key)
+        headerValues.push_back(request->getHeader(name));
+    cgiCacheKey = CgiCache::createKey(request->getHeader("Host"), request->uri, headerValues);
 
-    if (result == 0) {
-        kill(pid, SIGTERM);
-        return;
+    if (auto cached = CgiCache::get(cgiCacheKey)) {
+        MetricHandler::incrementMetric("cgi_cache_hits", 1);
+        return cached;
     }
 
-    if (WIFEXITED(status)) {
-        if (const int exitCode = WEXITSTATUS(status); exitCode == 1) {
-            Logger::log(LogLevel::ERROR, "CGI process exited with code: " + std::to_string(exitCode));
-            const HttpResponse response = HttpResponse::html(HttpResponse::StatusCode::INTERNAL_SERVER_ERROR,
-                                                             "CGI Error: Process exited with code " + std::to_string(
-                                                                 exitCode));
-            setResponse(response);
+    if (CgiCache::isPending(cgiCacheKey)) {
+        client->cgiProcessStart = std::time(nullptr);
+        cgiCacheWaiterId = CgiCache::wait(cgiCacheKey, [this](const bool cached) {
+            cgiCacheWaiterId.reset();
+            // cgi_timeout already answered with 504
+            if (client->cgiProcessStart == 0)
+                return;
+            std::optional<HttpResponse> response = cached ? CgiCache::get(cgiCacheKey) : std::nullopt;
+            if (!response)
+                response = runCgi();
+            if (response)
+                setResponse(*response);
+        });
+        return std::nullopt;
+    }
+
+    MetricHandler::incrementMetric("cgi_cache_misses", 1);
+    CgiCache::lock(cgiCacheKey);
+    cgiCacheLeader = true;
+    cgiOutput.copyBody(CgiCache::getMaxEntrySize());
+    auto response = runCgi();
+    if (response) {
+        cgiCacheLeader = false;
+        CgiCache::abort(cgiCacheKey);
+    }
+    return response;
+}
+
+void RequestHandler::completeCachedCgi(const CgiResponseBuilder &output) {
+    if (!cgiCacheLeader)
+        return;
+    cgiCacheLeader = false;
+    CgiCache::complete(cgiCacheKey, output, matchedRoute->cgi_cache);
+}
+
+// every cgi process needs a slot, without one the request waits in the queue of CgiProcessManager
+std::optional<HttpResponse> RequestHandler::handleCgi() {
+    const std::string location = serverConfig.host + ":" + std::to_string(serverConfig.port) + " " +
+                                 matchedRoute->location;
+    cgiTicket = CgiProcessManager::admit(location, matchedRoute->cgi_max_concurrent, [this]() {
+        // cgi_timeout already answered with 504 while the request was waiting
+        if (client->cgiProcessStart == 0) {
+            CgiProcessManager::cancel(cgiTicket);
             return;
         }
+        if (const auto response = startCgi())
+            setResponse(*response);
+    });
 
-        Logger::log(LogLevel::DEBUG, "CGI process exited successfully");
+    if (!cgiTicket) {
+        HttpResponse response = HttpResponse::html(HttpResponse::StatusCode::SERVICE_UNAVAILABLE,
+                                                   "CGI Error: Too many requests");
+        response.setHeader("Retry-After", std::to_string(CgiProcessManager::getRetryAfter()));
+        return response;
     }
+
+    client->cgiProcessStart = std::time(nullptr);
+    if (!cgiTicket->started)
+        return std::nullopt;
+    return startCgi();
 }
 
-std::optional<HttpResponse> RequestHandler::handleCgi() {
+std::optional<HttpResponse> RequestHandler::startCgi() {
     int input_pipe[2]; // Parent -> Child
     int output_pipe[2]; // Child -> Parent
 
     if (!setupPipes(input_pipe, output_pipe)) {
+        CgiProcessManager::cancel(cgiTicket);
         return HttpResponse::html(HttpResponse::StatusCode::INTERNAL_SERVER_ERROR,
                                   "CGI Error: Could not create pipes");
     }
 
-    const pid_t pid = fork();
+    const pid_t pid = spawnCgiProcess(input_pipe, output_pipe);
     if (pid < 0) {
         close(input_pipe[0]);
         close(input_pipe[1]);
         close(output_pipe[0]);
         close(output_pipe[1]);
-        Logger::log(LogLevel::ERROR, "Failed to fork process for CGI");
+        CgiProcessManager::cancel(cgiTicket);
         return HttpResponse::html(HttpResponse::StatusCode::INTERNAL_SERVER_ERROR,
-                                  "CGI Error: Could not fork process");
-    }
-
-
-    if (pid == 0) {
-        configureCgiChildProcess(input_pipe, output_pipe);
+                                  "CGI Error: Could not start process");
     }
     Logger::log(LogLevel::DEBUG, "CGI started with PID: " + std::to_string(pid));
 
     cgiProcessId = pid;
+    CgiProcessManager::watch(pid, cgiTicket, [this](const int status) {
+        onCgiProcessExit(status);
+    });
 
     close(input_pipe[0]);
     close(output_pipe[1]);
@@ -163,8 +268,6 @@ std::optional<HttpResponse> RequestHandler::handleCgi() {
         return 1;
     }
 
-    client->cgiProcessStart = std::time(nullptr);
-
     FdHandler::addFd(cgiInputFd, POLLOUT | POLLHUP, [this](const int fd, const short events) {
         (void) fd;
         (void) events;
@@ -174,33 +277,39 @@ std::optional<HttpResponse> RequestHandler::handleCgi() {
             return true;
         }
 
-        if (request->body->isStillWriting())
-            return false;
-
-
-        // TODO: magic number, look at max bytes for pipes to write
-        request->body->read(30000);
-
         if (static_cast<size_t>(bytesWrittenToCgi) >= request->totalBodySize) {
             Logger::log(LogLevel::DEBUG, "Finished writing to CGI process");
             close(fd);
+            cgiInputFd = -1;
             return true;
         }
 
-        const std::string readBuffer = request->body->getReadBuffer();
-        if (!readBuffer.empty()) {
-            const ssize_t written = write(fd, readBuffer.data(),
-                                          std::min(readBuffer.length(), static_cast<size_t>(60000)));
-            if (written <= 0) {
-                Logger::log(LogLevel::ERROR, "Failed to write to CGI process");
-                close(fd);
-                return true;
-            }
-            bytesWrittenToCgi += written;
-            request->body->cleanReadBuffer(written);
+        ssize_t written;
+        if (canSpliceRequestBody()) {
+            if (static_cast<size_t>(bytesWrittenToCgi) >= request->body->getSize())
+                return false;
+            written = spliceRequestBodyToCgi(fd);
+        } else {
+            // TODO: magic number, look at max bytes for pipes to write
+            request->body->read(30000);
+            if (request->body->getReadBufferSize() == 0)
+                return false;
+            iovec iov[BUFFER_MAX_IOVECS];
+            const size_t count = request->body->getReadIovecs(iov, BUFFER_MAX_IOVECS);
+            written = writev(fd, iov, static_cast<int>(count));
+            if (written > 0)
+                request->body->cleanReadBuffer(written);
         }
 
-
+        if (written < 0 && errno == EAGAIN)
+            return false;
+        if (written <= 0) {
+            Logger::log(LogLevel::ERROR, "Failed to write to CGI process");
+            close(fd);
+            cgiInputFd = -1;
+            return true;
+        }
+        bytesWrittenToCgi += written;
         return false;
     });
     cgiOutputFd = output_pipe[0];
@@ -210,56 +319,247 @@ std::optional<HttpResponse> RequestHandler::handleCgi() {
         return 1;
     }
 
-    FdHandler::addFd(output_pipe[0], POLLIN | POLLHUP, [pid, this](int fd, short events) {
+    FdHandler::addFd(output_pipe[0], POLLIN | POLLHUP, [this](const int fd, const short events) {
         (void) events;
 
-        ssize_t bytesRead = 0;
-        char buffer[60000];
-        bytesRead = read(fd, buffer, sizeof(buffer) - 1);
+        // the client is slower than the script, the pipe fills up and blocks the script until it caught up
+        if (cgiResponseStarted && cgiOutput.getPendingBytes() > CgiResponseBuilder::getStreamWatermark()) {
+            pauseCgiOutput(fd);
+            return false;
+        }
+
+        if (cgiSpliceRemaining > 0 || !cgiSpliceFraming.empty() || canSpliceCgiOutput()) {
+            if (client->shouldClose)
+                return false;
+            if (spliceCgiOutput(fd)) {
+                if (cgiSpliceRemaining > 0 || !cgiSpliceFraming.empty() || !cgiOutput.isComplete())
+                    return false;
+                finishCgiOutput(fd);
+                return true;
+            }
+        }
+
+        char buffer[16384];
+        const ssize_t bytesRead = read(fd, buffer, sizeof(buffer));
         if (bytesRead == -1)
             return false;
-        if (bytesRead >= 0) {
-            buffer[bytesRead] = '\0';
+
+        if (bytesRead > 0 && cgiOutput.append(buffer, bytesRead) && !cgiResponseStarted) {
+            // the response starts as soon as the headers are there, the body follows while it is produced
+            const time_t processStart = client->cgiProcessStart;
+            setResponse(cgiOutput.createResponse("CGI Error: Could not parse output"));
+            client->cgiProcessStart = processStart;
+            cgiResponseStarted = true;
         }
-        if ((cgiParser.parse(buffer, bytesRead)) || bytesRead == 0) {
-            close(fd);
-            const auto result = cgiParser.getResult();
-            HttpResponse response(HttpResponse::StatusCode::OK);
-            for (const auto &header: result.headers) {
-                if (header.first == "Status") {
-                    const int statusCode = std::stoi(header.second.substr(0, 3));
-                    response.setStatus(statusCode);
-                } else if (!header.first.empty())
-                    response.setHeader(header.first, header.second);
+
+        if (bytesRead > 0 && !cgiOutput.isComplete() && !cgiOutput.hasError())
+            return false;
+
+        finishCgiOutput(fd);
+        return true;
+    });
+    return std::nullopt;
+}
+
+// the pipe is not polled until the client took some of the output, the script blocks once the pipe is full
+void RequestHandler::pauseCgiOutput(const int fd) {
+    if (!cgiOutputPaused)
+        MetricHandler::incrementMetric("cgi_output_paused", 1);
+    cgiOutputPaused = true;
+    FdHandler::setEvents(fd, 0);
+}
+
+void RequestHandler::resumeCgiOutput() {
+    if (cgiWorkerRequest)
+        cgiWorkerPool->resume(cgiWorkerRequest);
+    if (!cgiOutputPaused || cgiOutputFd < 0 || cgiOutput.getPendingBytes() > CgiResponseBuilder::getStreamWatermark() / 2)
+        return;
+    cgiOutputPaused = false;
+    FdHandler::setEvents(cgiOutputFd, POLLIN | POLLHUP);
+}
+
+void RequestHandler::finishCgiOutput(const int fd) {
+    cgiOutput.finish();
+    completeCachedCgi(cgiOutput);
+    close(fd);
+    cgiOutputFd = -1;
+    if (cgiResponseStarted) {
+        client->cgiProcessStart = 0;
+        if (cgiOutput.isTruncated()) {
+            Logger::log(LogLevel::ERROR, "CGI process output is shorter than its Content-Length");
+            client->keepAlive = false;
+        }
+        return;
+    }
+
+    Logger::log(LogLevel::ERROR, "CGI process error parsing output");
+    // a running process is waited for, its exit code decides between 500 and 502
+    if (cgiProcessId == -1 && client->cgiProcessStart != 0)
+        setResponse(createCgiErrorResponse());
+}
+
+// a request body that was spilled to a tmp file and not read yet goes to the script inside the kernel
+bool RequestHandler::canSpliceRequestBody() const {
+#ifdef __linux__
+    const auto &body = request->body;
+    return body->isFileBuffer() && body->getFd() >= 0 && body->getReadPos() == 0 && body->getReadBufferSize() == 0;
+#else
+    return false;
+#endif
+}
+
+ssize_t RequestHandler::spliceRequestBodyToCgi(const int fd) const {
+#ifdef __linux__
+    loff_t offset = bytesWrittenToCgi;
+    return splice(request->body->getFd(), &offset, fd, nullptr, request->body->getSize() - bytesWrittenToCgi,
+                  SPLICE_F_NONBLOCK | SPLICE_F_MOVE);
+#else
+    (void) fd;
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+// once the buffered part of the body is sent, the rest goes from the pipe to the socket inside the kernel
+bool RequestHandler::canSpliceCgiOutput() const {
+#ifdef __linux__
+    const auto &response = client->getResponse();
+    return cgiResponseStarted && !cgiCacheLeader && response && response->alreadySendHeader && !response->getEncoder() &&
+           response->getBody() == cgiOutput.getBody() &&
+           cgiOutput.getPendingBytes() == 0 && cgiOutput.getRemainingBody() > 0;
+#else
+    return false;
+#endif
+}
+
+// returns false if the pipe has nothing to splice, it is read normally then to notice the end of the output.
+// a full client socket shows up as EAGAIN and pauses the pipe until the client took some of the data
+bool RequestHandler::spliceCgiOutput(const int fd) {
+#ifdef __linux__
+    if (!sendCgiSpliceFraming()) {
+        if (!client->shouldClose)
+            pauseCgiOutput(fd);
+        return true;
+    }
+
+    const bool chunked = client->getResponse()->isChunkedEncoding();
+    if (cgiSpliceRemaining == 0) {
+        int available = 0;
+        if (ioctl(fd, FIONREAD, &available) < 0 || available <= 0)
+            return false;
+
+        cgiSpliceRemaining = std::min(static_cast<size_t>(available), cgiOutput.getRemainingBody());
+        if (chunked) {
+            char chunkHeader[32];
+            cgiSpliceFraming.assign(chunkHeader, snprintf(chunkHeader, sizeof(chunkHeader), "%zx\r\n",
+                                                          cgiSpliceRemaining));
+            if (!sendCgiSpliceFraming()) {
+                if (!client->shouldClose)
+                    pauseCgiOutput(fd);
+                return true;
             }
-            for (const auto& cookie: result.setCookies)
-                response.addSetCookie(cookie);
-            response.enableChunkedEncoding(result.body);
-            setResponse(response);
-            cleanupCgiProcess(pid);
-            return true;
         }
+    }
 
-        if (cgiParser.hasError()) {
-            close(fd);
-            cleanupCgiProcess(pid);
-            Logger::log(LogLevel::ERROR, "CGI process error parsing error");
-            const HttpResponse response = HttpResponse::html(HttpResponse::StatusCode::INTERNAL_SERVER_ERROR,
-                                                             "CGI Error: Could not parse output");
-            setResponse(response);
-            return true;
+    const ssize_t moved = splice(fd, nullptr, client->fd, nullptr, cgiSpliceRemaining,
+                                 SPLICE_F_NONBLOCK | SPLICE_F_MOVE | SPLICE_F_MORE);
+    if (moved < 0 && errno == EAGAIN) {
+        pauseCgiOutput(fd);
+        return true;
+    }
+    if (moved <= 0) {
+        Logger::log(LogLevel::ERROR, "Failed to splice CGI output to client: " + std::string(strerror(errno)));
+        client->shouldClose = true;
+        return true;
+    }
+
+    cgiSpliceRemaining -= moved;
+    cgiOutput.skipBody(moved);
+    MetricHandler::incrementMetric("bytes_send", moved);
+    MetricHandler::incrementMetric("cgi_spliced_bytes", moved);
+    if (cgiSpliceRemaining == 0 && chunked) {
+        cgiSpliceFraming = "\r\n";
+        if (!sendCgiSpliceFraming() && !client->shouldClose)
+            pauseCgiOutput(fd);
+    }
+    return true;
+#else
+    (void) fd;
+    return false;
+#endif
+}
+
+// returns false while framing is left, the connection is closed on errors other than a full socket
+bool RequestHandler::sendCgiSpliceFraming() {
+    while (!cgiSpliceFraming.empty()) {
+        const int flags = MSG_NOSIGNAL | (cgiSpliceRemaining > 0 ? MSG_MORE : 0);
+        const ssize_t sent = send(client->fd, cgiSpliceFraming.data(), cgiSpliceFraming.size(), flags);
+        if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return false;
+        if (sent <= 0) {
+            Logger::log(LogLevel::ERROR, "Failed to write chunk to client");
+            client->shouldClose = true;
+            return false;
         }
+        MetricHandler::incrementMetric("bytes_send", sent);
+        cgiSpliceFraming.erase(0, sent);
+    }
+    return true;
+}
 
+std::optional<HttpResponse> RequestHandler::handleCgiWorker() {
+    const std::string filePath = std::filesystem::absolute(getFilePath()).lexically_normal().string();
+    std::unordered_map<std::string, std::string> env = createCgiEnvironment(
+        std::filesystem::path(filePath).filename().string());
+    env["WEBSERV_SCRIPT_PATH"] = filePath;
 
-        if (events & POLLHUP) {
-            Logger::log(LogLevel::ERROR, "CGI process error reading");
-            const HttpResponse response = HttpResponse::html(HttpResponse::StatusCode::OK,
-                                                             "CGI Error: Could not parse output");
-            setResponse(response);
-            return true;
+    cgiWorkerPool = &CgiWorkerPool::get(cgiPath, matchedRoute.value(), serverConfig.cgi_timeout);
+    cgiWorkerRequest = std::make_shared<CgiWorkerRequest>(request, env, [this](const HttpResponse &response) {
+        // cgi_timeout already answered with 504
+        if (client->cgiProcessStart == 0)
+            return;
+        // the body is streamed, cgi_timeout still applies until the script finished
+        const time_t processStart = client->cgiProcessStart;
+        setResponse(response);
+        client->cgiProcessStart = processStart;
+        cgiResponseStarted = true;
+    }, [this]() {
+        const CgiResponseBuilder &output = cgiWorkerRequest->output;
+        completeCachedCgi(output);
+        if (!cgiResponseStarted)
+            return;
+        client->cgiProcessStart = 0;
+        if (output.isTruncated()) {
+            Logger::log(LogLevel::ERROR, "CGI worker output is shorter than its Content-Length");
+            client->keepAlive = false;
         }
+    });
+    if (cgiCacheLeader)
+        cgiWorkerRequest->output.copyBody(CgiCache::getMaxEntrySize());
 
-        return false;
+    client->cgiProcessStart = std::time(nullptr);
+    cgiWorkerPool->submit(cgiWorkerRequest);
+    return std::nullopt;
+}
+
+std::optional<HttpResponse> RequestHandler::handleFastCgi() {
+    const std::string filePath = std::filesystem::absolute(getFilePath()).lexically_normal().string();
+    std::unordered_map<std::string, std::string> env = createCgiEnvironment(filePath);
+    env["DOCUMENT_ROOT"] = std::filesystem::absolute(!matchedRoute->root.empty()
+                                                         ? matchedRoute->root
+                                                         : serverConfig.root).lexically_normal().string();
+    env["REMOTE_ADDR"] = inet_ntoa(client->clientAddr.sin_addr);
+    env["REMOTE_PORT"] = std::to_string(ntohs(client->clientAddr.sin_port));
+
+    fastCgiPool = &FastCgiPool::get(matchedRoute->fastcgi_pass, matchedRoute->fastcgi_connections);
+    fastCgiRequest = std::make_shared<FastCgiRequest>(request, env, [this](const HttpResponse &response) {
+        // cgi_timeout already answered with 504
+        if (client->cgiProcessStart == 0)
+            return;
+        setResponse(response);
     });
+
+    client->cgiProcessStart = std::time(nullptr);
+    fastCgiPool->submit(fastCgiRequest);
     return std::nullopt;
 }
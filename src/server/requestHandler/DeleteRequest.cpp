@@ -1,17 +1,18 @@
 #include "RequestHandler.h"
 #include <sys/stat.h>
+#include <cerrno>
 #include <unistd.h>
 #include <filesystem>
 #include <common/SessionManager.h>
 #include <server/ClientConnection.h>
 
-HttpResponse RequestHandler::handleDelete() const {
-    if (routePath.back() == '/' || std::filesystem::is_directory(routePath))
+// the file is removed on the thread pool, the checks before only use the lookups of the request
+std::optional<HttpResponse> RequestHandler::handleDelete() {
+    if (routePath.back() == '/' || isDirectory)
         return HttpResponse::html(HttpResponse::StatusCode::CONFLICT,
                                         "Cannot delete a directory");
 
-    struct stat fileStat{};
-    if (stat(routePath.c_str(), &fileStat) != 0 || S_ISDIR(fileStat.st_mode))
+    if (!isFile)
         return HttpResponse::html(HttpResponse::NOT_FOUND);
 
     client->sessionId = SessionManager::getSessionId(request->getHeader("Cookie"), client->isNewSession);
@@ -20,20 +21,26 @@ HttpResponse RequestHandler::handleDelete() const {
         return HttpResponse::html(HttpResponse::StatusCode::FORBIDDEN,
                                         "You do not own this file");
 
-
-
-    if (access(routePath.c_str(), W_OK) != 0)
-        return HttpResponse::html(HttpResponse::StatusCode::FORBIDDEN,
-                                        "No write permission");
-
-    try {
-        std::filesystem::remove(routePath);
+    const std::string path = routePath;
+    const auto error = std::make_shared<int>(0);
+    fileTask = ThreadPool::submit([path, error] {
+        if (access(path.c_str(), W_OK) != 0)
+            *error = EACCES;
+        else if (unlink(path.c_str()) != 0)
+            *error = errno;
+    }, [this, path, absolutePath, error] {
+        fileTask.reset();
+        if (*error == EACCES) {
+            setResponse(HttpResponse::html(HttpResponse::StatusCode::FORBIDDEN, "No write permission"));
+            return;
+        }
+        if (*error != 0) {
+            setResponse(HttpResponse::html(HttpResponse::StatusCode::INTERNAL_SERVER_ERROR));
+            return;
+        }
+        OpenFileCache::invalidate(path);
         SessionManager::removeFile(client->sessionId, absolutePath);
-    }catch (...) {
-        return HttpResponse::html(HttpResponse::StatusCode::INTERNAL_SERVER_ERROR);
-
-    }
-
-    HttpResponse response(HttpResponse::StatusCode::NO_CONTENT);
-    return response;
+        setResponse(HttpResponse(HttpResponse::StatusCode::NO_CONTENT));
+    });
+    return std::nullopt;
 }
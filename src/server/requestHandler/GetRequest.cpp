@@ -14,30 +14,213 @@
 #include <iomanip>
 #include <string>
 #include <filesystem>
+#include <cerrno>
+#include <server/cache/StaticFileCache.h>
+#include <server/handler/MetricHandler.h>
 
-static HttpResponse handleServeFile(const std::string &path) {
-    if (!std::filesystem::exists(path) || std::filesystem::is_directory(path))
+HttpResponse RequestHandler::handleServeFile(const std::string &path, const std::shared_ptr<const OpenFileInfo> &file) {
+    if (file->error == EACCES)
+        return HttpResponse::html(HttpResponse::FORBIDDEN);
+
+    if (!file->isFile())
         return HttpResponse::html(HttpResponse::NOT_FOUND);
 
-    if (access(path.c_str(), R_OK) != 0)
-        return HttpResponse::html(HttpResponse::FORBIDDEN);
+    // a precompressed sibling is sent as it is, but with the type of the original file
+    std::string servedPath = path;
+    std::shared_ptr<const OpenFileInfo> served = file;
+    std::string contentEncoding;
+    if (serverConfig.gzip_static)
+        contentEncoding = findPrecompressed(path, servedPath, served);
+    const bool compress = contentEncoding.empty() && shouldCompress(file->mimeType, served->st.st_size);
+    const std::string etag = compress ? "W/" + served->etag : served->etag;
+    const bool varies = serverConfig.gzip_static || (serverConfig.gzip && isCompressibleType(file->mimeType));
+
+    if (isNotModified(*served)) {
+        HttpResponse response(HttpResponse::StatusCode::NOT_MODIFIED);
+        response.removeBody();
+        response.setHeader("ETag", etag);
+        response.setHeader("Last-Modified", served->lastModified);
+        if (varies)
+            response.setHeader("Vary", "Accept-Encoding");
+        MetricHandler::incrementMetric("not_modified_responses", 1);
+        MetricHandler::incrementMetric("not_modified_bytes_saved", served->st.st_size);
+        return response;
+    }
+
+    HttpResponse response(HttpResponse::StatusCode::OK);
+    response.setHeader("Content-Type", file->mimeType);
+    response.setHeader("ETag", etag);
+    response.setHeader("Last-Modified", served->lastModified);
+    if (varies)
+        response.setHeader("Vary", "Accept-Encoding");
+    if (!contentEncoding.empty())
+        response.setHeader("Content-Encoding", contentEncoding);
+
+    // ranges refer to the bytes on disk, they are not offered for bodies compressed on the fly
+    if (!compress) {
+        response.setHeader("Accept-Ranges", "bytes");
+        const std::string range = request->getHeader("Range");
+        if (!range.empty() && matchesIfRange(*served)) {
+            const auto ranges = parseRange(range, served->st.st_size);
+            if (ranges.has_value())
+                return handleRangeRequest(response, *served, ranges.value());
+        }
+    }
+
+    const auto &cache = serverConfig.staticCache;
+    if (cache && cache->accepts(*served)) {
+        auto cached = cache->get(servedPath, *served, compress);
+        if (!cached)
+            cached = cache->put(servedPath, *served, response, compress ? serverConfig.gzip_comp_level : 0);
+        if (cached) {
+            if (compress) {
+                response.setHeader("Content-Encoding", "gzip");
+                MetricHandler::incrementMetric("gzip_responses", 1);
+                if (static_cast<size_t>(served->st.st_size) > cached->body.size())
+                    MetricHandler::incrementMetric("gzip_bytes_saved", served->st.st_size - cached->body.size());
+            }
+            response.setPrerendered(cached);
+            return response;
+        }
+    }
 
-    const int fd = open(path.c_str(), O_RDONLY);
+    const int fd = OpenFileCache::openFd(*served);
     if (fd < 0)
         return HttpResponse::html(HttpResponse::NOT_FOUND);
 
-    HttpResponse response(HttpResponse::StatusCode::OK);
-    response.enableChunkedEncoding(std::make_shared<SmartBuffer>(fd));
-    response.setHeader("Content-Type", RequestHandler::getMimeType(path));
+    // the body is compressed while it is sent, see RequestHandler::compressResponse
+    if (compress) {
+        response.enableChunkedEncoding(std::make_shared<SmartBuffer>(fd));
+        return response;
+    }
+
+    std::vector<FileSegment> segments;
+    if (served->st.st_size > 0)
+        segments.push_back({"", 0, static_cast<size_t>(served->st.st_size)});
+    response.setFileBody(fd, segments);
     return response;
 }
 
+// looks for path.br and path.gz, returns the Content-Encoding of the sibling that was found
+std::string RequestHandler::findPrecompressed(const std::string &path, std::string &servedPath,
+                                              std::shared_ptr<const OpenFileInfo> &served) const {
+    static const std::pair<const char *, const char *> encodings[] = {{"br", ".br"}, {"gzip", ".gz"}};
+
+    const std::string acceptEncoding = request->getHeader("Accept-Encoding");
+    if (acceptEncoding.empty())
+        return "";
+
+    for (const auto &[encoding, extension]: encodings) {
+        if (!acceptsEncoding(acceptEncoding, encoding))
+            continue;
+        const std::string siblingPath = path + extension;
+        auto sibling = lookupPath(siblingPath);
+        if (!sibling->isFile())
+            continue;
+        servedPath = siblingPath;
+        served = std::move(sibling);
+        MetricHandler::incrementMetric("gzip_static_hits", 1);
+        return encoding;
+    }
+    return "";
+}
+
+static std::string createBoundary() {
+    static unsigned long long counter = 0;
+    std::stringstream boundary;
+    boundary << std::hex << std::time(nullptr) << std::setw(8) << std::setfill('0') << ++counter;
+    return boundary.str();
+}
+
+static std::string formatContentRange(const ByteRange &range, const off_t fileSize) {
+    return "bytes " + std::to_string(range.first) + "-" + std::to_string(range.last) + "/" +
+           std::to_string(fileSize);
+}
+
+HttpResponse RequestHandler::handleRangeRequest(HttpResponse response, const OpenFileInfo &file,
+                                                const std::vector<ByteRange> &ranges) const {
+    MetricHandler::incrementMetric("range_requests", 1);
+    if (ranges.empty()) {
+        HttpResponse error = HttpResponse::html(HttpResponse::RANGE_NOT_SATISFIABLE);
+        error.setHeader("Content-Range", "bytes */" + std::to_string(file.st.st_size));
+        return error;
+    }
+
+    const int fd = OpenFileCache::openFd(file);
+    if (fd < 0)
+        return HttpResponse::html(HttpResponse::NOT_FOUND);
+
+    response.setStatus(HttpResponse::PARTIAL_CONTENT);
+    if (ranges.size() == 1) {
+        const ByteRange &range = ranges.front();
+        response.setHeader("Content-Range", formatContentRange(range, file.st.st_size));
+        response.setFileBody(fd, {{"", range.first, static_cast<size_t>(range.last - range.first + 1)}});
+        return response;
+    }
+
+    const std::string boundary = createBoundary();
+    std::vector<FileSegment> segments;
+    for (const auto &range: ranges) {
+        std::string prefix = "\r\n--" + boundary + "\r\n";
+        prefix += "Content-Type: " + response.getHeader("Content-Type") + "\r\n";
+        prefix += "Content-Range: " + formatContentRange(range, file.st.st_size) + "\r\n\r\n";
+        segments.push_back({prefix, range.first, static_cast<size_t>(range.last - range.first + 1)});
+    }
+    segments.push_back({"\r\n--" + boundary + "--\r\n", 0, 0});
+
+    response.setHeader("Content-Type", "multipart/byteranges; boundary=" + boundary);
+    response.setFileBody(fd, segments);
+    return response;
+}
+
+static bool etagMatches(const std::string &header, const std::string &etag) {
+    std::stringstream stream(header);
+    std::string candidate;
+    while (std::getline(stream, candidate, ',')) {
+        candidate.erase(0, candidate.find_first_not_of(" \t"));
+        candidate.erase(candidate.find_last_not_of(" \t") + 1);
+        if (candidate.rfind("W/", 0) == 0)
+            candidate.erase(0, 2);
+        if (candidate == "*" || candidate == etag)
+            return true;
+    }
+    return false;
+}
+
+// If-None-Match wins over If-Modified-Since, like described in RFC 9110 13.2.2
+bool RequestHandler::isNotModified(const OpenFileInfo &file) const {
+    const std::string ifNoneMatch = request->getHeader("If-None-Match");
+    if (!ifNoneMatch.empty())
+        return etagMatches(ifNoneMatch, file.etag);
+
+    const std::string ifModifiedSince = request->getHeader("If-Modified-Since");
+    if (ifModifiedSince.empty())
+        return false;
+
+    const auto since = parseHttpDate(ifModifiedSince);
+    return since.has_value() && file.st.st_mtime <= since.value();
+}
+
+// a range is only served if the representation If-Range refers to is still the current one
+bool RequestHandler::matchesIfRange(const OpenFileInfo &file) const {
+    const std::string ifRange = request->getHeader("If-Range");
+    if (ifRange.empty())
+        return true;
+    if (ifRange.rfind("W/", 0) == 0)
+        return false;
+    if (ifRange.front() == '"')
+        return ifRange == file.etag;
+
+    const auto date = parseHttpDate(ifRange);
+    return date.has_value() && date.value() == file.st.st_mtime;
+}
+
 HttpResponse RequestHandler::handleGet() {
     if (isDirectory) {
         Logger::log(LogLevel::DEBUG, "Route is a directory");
         if (hasValidIndexFile) {
             Logger::log(LogLevel::DEBUG, "Serving index file: " + indexFilePath);
-            return handleServeFile(indexFilePath);
+            return handleServeFile(indexFilePath, indexInfo);
         }
 
         if (!matchedRoute->autoindex) {
@@ -47,5 +230,5 @@ HttpResponse RequestHandler::handleGet() {
         return handleAutoIndex(routePath);
     }
 
-    return handleServeFile(routePath);
+    return handleServeFile(routePath, targetInfo);
 }
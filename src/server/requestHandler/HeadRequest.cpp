@@ -0,0 +1,28 @@
+#include "RequestHandler.h"
+#include <sys/stat.h>
+#include <filesystem>
+#include <common/SessionManager.h>
+#include <server/ClientConnection.h>
+
+// a HEAD on the target of an unfinished resumable upload tells its owner how many bytes are persisted,
+// everything else is answered like a GET and the body is dropped in setResponse
+HttpResponse RequestHandler::handleHead() {
+    struct stat partialStat{};
+    if (routePath.empty() || routePath.back() == '/' || isDirectory ||
+        stat(getPartialUploadPath(routePath).c_str(), &partialStat) != 0)
+        return handleGet();
+
+    client->sessionId = SessionManager::getSessionId(request->getHeader("Cookie"), client->isNewSession);
+    const std::string absolutePath =
+            std::filesystem::absolute(getPartialUploadPath(routePath)).lexically_normal().string();
+    if (!SessionManager::ownsFile(client->sessionId, absolutePath))
+        return handleGet();
+
+    HttpResponse response(HttpResponse::StatusCode::OK);
+    response.setHeader("Upload-Offset", std::to_string(partialStat.st_size));
+    if (partialStat.st_size > 0)
+        response.setHeader("Range", "bytes=0-" + std::to_string(partialStat.st_size - 1));
+    response.setHeader("Cache-Control", "no-store");
+    response.removeBody();
+    return response;
+}
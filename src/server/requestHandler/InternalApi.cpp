@@ -4,23 +4,22 @@
 
 #include "InternalApi.h"
 #include "../../parser/json/JsonParser.h"
-#ifdef __APPLE__
-#include <mach/mach.h>
-#include <sys/sysctl.h>
-#else
-#include <sys/sysinfo.h>
-#endif
 #include <server/ServerPool.h>
 #include <server/handler/MetricHandler.h>
-#include <sys/statvfs.h>
+#include <server/cache/OpenFileCache.h>
+#include <server/cache/StaticFileCache.h>
+#include <server/cache/DirectoryCache.h>
+#include <server/fastcgi/FastCgiPool.h>
+#include <server/cgi/CgiWorkerPool.h>
+#include <server/cgi/CgiProcessManager.h>
+#include <server/cache/CgiCache.h>
+#include <server/handler/SystemStats.h>
+#include <server/handler/MetricStream.h>
+#include <server/buffer/MemoryBudget.h>
+#include <server/handler/ThreadPool.h>
 #include <common/Logger.h>
 
-HttpResponse metrics(std::shared_ptr<HttpRequest> request) {
-    (void) request;
-    Logger::log(LogLevel::DEBUG, "Internal API: Metrics endpoint accessed");
-    HttpResponse response(200);
-    response.setHeader("Content-Type", "application/json");
-
+std::string InternalApi::createMetrics() {
     JsonValue::JsonObject jsonObj;
     jsonObj["connection_count"] = std::make_shared<JsonValue>(ServerPool::getClientCount());
 
@@ -28,23 +27,114 @@ HttpResponse metrics(std::shared_ptr<HttpRequest> request) {
     jsonObj["uptime"] = std::make_shared<JsonValue>(uptimeSeconds);
 
     jsonObj["last_update"] = std::make_shared<JsonValue>(MetricHandler::getLastResetTime());
+    jsonObj["open_file_cache_entries"] = std::make_shared<JsonValue>(static_cast<ssize_t>(OpenFileCache::size()));
+    jsonObj["static_cache_bytes"] = std::make_shared<JsonValue>(static_cast<ssize_t>(StaticFileCache::getTotalSize()));
+
+    JsonValue::JsonObject fastCgiPools;
+    for (const auto &[address, pool]: FastCgiPool::getPools()) {
+        JsonValue::JsonObject poolObj;
+        poolObj["connections"] = std::make_shared<JsonValue>(static_cast<ssize_t>(pool->getConnectionCount()));
+        poolObj["idle"] = std::make_shared<JsonValue>(static_cast<ssize_t>(pool->getIdleConnectionCount()));
+        poolObj["active"] = std::make_shared<JsonValue>(static_cast<ssize_t>(pool->getActiveRequestCount()));
+        poolObj["queue_depth"] = std::make_shared<JsonValue>(static_cast<ssize_t>(pool->getQueueDepth()));
+        poolObj["max_queue_depth"] = std::make_shared<JsonValue>(static_cast<ssize_t>(pool->getMaxQueueDepth()));
+        poolObj["requests"] = std::make_shared<JsonValue>(static_cast<ssize_t>(pool->getTotalRequests()));
+        poolObj["failed"] = std::make_shared<JsonValue>(static_cast<ssize_t>(pool->getFailedRequests()));
+        poolObj["avg_latency_ms"] = std::make_shared<JsonValue>(static_cast<ssize_t>(pool->getAverageLatencyMs()));
+        poolObj["avg_queue_ms"] = std::make_shared<JsonValue>(static_cast<ssize_t>(pool->getAverageQueueMs()));
+        poolObj["multiplexing"] = std::make_shared<JsonValue>(pool->isMultiplexing() ? 1 : 0);
+        fastCgiPools[address] = std::make_shared<JsonValue>(poolObj);
+    }
+    jsonObj["fastcgi_pools"] = std::make_shared<JsonValue>(fastCgiPools);
+
+    JsonValue::JsonObject cgiWorkerPools;
+    for (const auto &[name, pool]: CgiWorkerPool::getPools()) {
+        JsonValue::JsonObject poolObj;
+        poolObj["workers"] = std::make_shared<JsonValue>(static_cast<ssize_t>(pool->getWorkerCount()));
+        poolObj["busy"] = std::make_shared<JsonValue>(static_cast<ssize_t>(pool->getBusyWorkerCount()));
+        poolObj["queue_depth"] = std::make_shared<JsonValue>(static_cast<ssize_t>(pool->getQueueDepth()));
+        poolObj["max_queue_depth"] = std::make_shared<JsonValue>(static_cast<ssize_t>(pool->getMaxQueueDepth()));
+        poolObj["requests"] = std::make_shared<JsonValue>(static_cast<ssize_t>(pool->getTotalRequests()));
+        poolObj["spawned"] = std::make_shared<JsonValue>(static_cast<ssize_t>(pool->getSpawnedWorkers()));
+        poolObj["recycled"] = std::make_shared<JsonValue>(static_cast<ssize_t>(pool->getRecycledWorkers()));
+        cgiWorkerPools[name] = std::make_shared<JsonValue>(poolObj);
+    }
+    jsonObj["cgi_worker_pools"] = std::make_shared<JsonValue>(cgiWorkerPools);
+
+    JsonValue::JsonObject cgiProcesses;
+    cgiProcesses["running"] = std::make_shared<JsonValue>(static_cast<ssize_t>(CgiProcessManager::getRunningCount()));
+    cgiProcesses["queue_depth"] = std::make_shared<JsonValue>(static_cast<ssize_t>(CgiProcessManager::getQueueDepth()));
+    cgiProcesses["max_queue_depth"] = std::make_shared<JsonValue>(
+        static_cast<ssize_t>(CgiProcessManager::getMaxQueueDepth()));
+    cgiProcesses["avg_queue_ms"] = std::make_shared<JsonValue>(
+        static_cast<ssize_t>(CgiProcessManager::getAverageQueueMs()));
+    jsonObj["cgi_processes"] = std::make_shared<JsonValue>(cgiProcesses);
+
+    JsonValue::JsonObject cgiCache;
+    cgiCache["entries"] = std::make_shared<JsonValue>(static_cast<ssize_t>(CgiCache::getEntryCount()));
+    cgiCache["bytes"] = std::make_shared<JsonValue>(static_cast<ssize_t>(CgiCache::getSize()));
+    jsonObj["cgi_cache"] = std::make_shared<JsonValue>(cgiCache);
+
+    JsonValue::JsonObject autoindexCache;
+    autoindexCache["directories"] = std::make_shared<JsonValue>(static_cast<ssize_t>(DirectoryCache::getEntryCount()));
+    autoindexCache["bytes"] = std::make_shared<JsonValue>(static_cast<ssize_t>(DirectoryCache::getSize()));
+    jsonObj["autoindex_cache"] = std::make_shared<JsonValue>(autoindexCache);
+
+    JsonValue::JsonObject memory;
+    for (size_t i = 0; i < static_cast<size_t>(MemoryCategory::COUNT); i++) {
+        const auto category = static_cast<MemoryCategory>(i);
+        memory[MemoryBudget::getCategoryName(category)] = std::make_shared<JsonValue>(
+            static_cast<ssize_t>(MemoryBudget::getUsage(category)));
+    }
+    memory["total"] = std::make_shared<JsonValue>(static_cast<ssize_t>(MemoryBudget::getUsage()));
+    memory["limit"] = std::make_shared<JsonValue>(static_cast<ssize_t>(MemoryBudget::getLimit()));
+    memory["max_connection"] = std::make_shared<JsonValue>(static_cast<ssize_t>(ServerPool::getMaxClientBufferedBytes()));
+    jsonObj["memory"] = std::make_shared<JsonValue>(memory);
+
+    JsonValue::JsonObject threadPool;
+    threadPool["threads"] = std::make_shared<JsonValue>(static_cast<ssize_t>(ThreadPool::getThreadCount()));
+    threadPool["running"] = std::make_shared<JsonValue>(static_cast<ssize_t>(ThreadPool::getRunningCount()));
+    threadPool["queue_depth"] = std::make_shared<JsonValue>(static_cast<ssize_t>(ThreadPool::getQueueDepth()));
+    threadPool["max_queue_depth"] = std::make_shared<JsonValue>(static_cast<ssize_t>(ThreadPool::getMaxQueueDepth()));
+    jsonObj["thread_pool"] = std::make_shared<JsonValue>(threadPool);
+
+    jsonObj["metric_stream_subscribers"] = std::make_shared<JsonValue>(
+        static_cast<ssize_t>(MetricStream::getSubscriberCount()));
 
     for (const auto&[fst, snd] : MetricHandler::getAllFullMetric())
         jsonObj[fst] = std::make_shared<JsonValue>(static_cast<ssize_t>(snd));
 
+    return JsonValue(jsonObj).toString();
+}
 
-    auto metricsObj = std::make_shared<JsonValue>(jsonObj);
-
-    std::stringstream ss;
-    response.setBody(metricsObj->toString());
+HttpResponse metrics(std::shared_ptr<HttpRequest> request) {
+    (void) request;
+    Logger::log(LogLevel::DEBUG, "Internal API: Metrics endpoint accessed");
+    HttpResponse response(200);
+    response.setHeader("Content-Type", "application/json");
+    response.setBody(InternalApi::createMetrics());
     response.setHeader("Access-Control-Allow-Origin", "*");
     return response;
 }
 
+HttpResponse metricsStream(std::shared_ptr<HttpRequest> request) {
+    (void) request;
+    Logger::log(LogLevel::DEBUG, "Internal API: Metrics stream subscribed");
+    // frames are only published while someone listens, so the first subscriber renders a fresh one
+    if (MetricStream::getSubscriberCount() == 0)
+        MetricStream::publish(InternalApi::createMetrics());
+    return MetricStream::subscribe();
+}
+
+HttpResponse systemStats(std::shared_ptr<HttpRequest> request) {
+    (void) request;
+    Logger::log(LogLevel::DEBUG, "Internal API: System endpoint accessed");
+    return SystemStats::createResponse();
+}
 
-void InternalApi::registerRoutes(ServerConfig &serverConfig) {
-    serverConfig.routes.push_back({
-        .location = "/metrics",
+static RouteConfig createRoute(const std::string &location, const decltype(RouteConfig::internalHandler) &handler) {
+    return {
+        .location = location,
         .type = LocationType::PREFIX,
         .allowedMethods = {GET},
         .root = "",
@@ -54,8 +144,23 @@ void InternalApi::registerRoutes(ServerConfig &serverConfig) {
         .error_pages = {},
         .deny_all = false,
         .cgi_params = {},
+        .cgi_environment = {},
         .return_directive = {-1, ""},
-        .internalHandler = metrics,
+        .fastcgi_pass = "",
+        .fastcgi_connections = 0,
+        .cgi_workers_min = 0,
+        .cgi_workers_max = 0,
+        .cgi_worker_max_requests = 0,
+        .cgi_worker_idle_timeout = 0,
+        .cgi_max_concurrent = 0,
+        .cgi_cache = 0,
+        .cgi_cache_key = {},
+        .internalHandler = handler,
+    };
+}
 
-    });
+void InternalApi::registerRoutes(ServerConfig &serverConfig) {
+    serverConfig.routes.push_back(createRoute("/metrics", metrics));
+    serverConfig.routes.push_back(createRoute("/metrics/stream", metricsStream));
+    serverConfig.routes.push_back(createRoute("/system", systemStats));
 }
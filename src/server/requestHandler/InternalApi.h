@@ -11,6 +11,9 @@
 
 namespace InternalApi {
     void registerRoutes(ServerConfig &serverConfig);
+
+    // serialized metrics object, shared by /metrics and the /metrics/stream frames
+    std::string createMetrics();
 }
 
 
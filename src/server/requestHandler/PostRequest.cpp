@@ -2,7 +2,6 @@
 
 #include <sys/stat.h>
 #include <fstream>
-#include <regex>
 #include <filesystem>
 #include <common/Logger.h>
 #include <server/ClientConnection.h>
@@ -10,11 +9,31 @@
 #include <unistd.h>
 #include <sys/poll.h>
 #include <fcntl.h>
+#include <sys/uio.h>
 #include <common/SessionManager.h>
 #include <server/handler/CallbackHandler.h>
+#include <webserv.h>
+#ifdef __linux__
+#include <sys/vfs.h>
+#include <linux/magic.h>
+#endif
+
+// the part data was already read to find the boundaries, so copying it again inside the kernel only pays off
+// if the filesystem can share the blocks instead of copying them
+static bool canShareBlocks(const int fd) {
+#ifdef __linux__
+    struct statfs fileSystem{};
+    if (fd < 0 || fstatfs(fd, &fileSystem) != 0)
+        return false;
+    return fileSystem.f_type == BTRFS_SUPER_MAGIC || fileSystem.f_type == XFS_SUPER_MAGIC;
+#else
+    (void) fd;
+    return false;
+#endif
+}
 
 std::optional<HttpResponse> RequestHandler::handlePost() {
-    if (!std::filesystem::exists(routePath)) {
+    if (!targetInfo->exists() && !isDirectory) {
         return HttpResponse::html(HttpResponse::StatusCode::NOT_FOUND,
                                   "Target directory does not exist");
     }
@@ -48,6 +67,7 @@ std::optional<HttpResponse> RequestHandler::handlePostTestFile() {
 
     fileWriteFd = open(fullPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC,
                           S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH);
+    OpenFileCache::invalidate(fullPath.string());
     if (fileWriteFd == -1) {
         return HttpResponse::html(HttpResponse::StatusCode::INTERNAL_SERVER_ERROR,
                                   "Could not open file for writing");
@@ -60,9 +80,10 @@ std::optional<HttpResponse> RequestHandler::handlePostTestFile() {
         (void) events;
         request->body->read(60000);
 
-        const std::string readBuffer = request->body->getReadBuffer();
-        if (!readBuffer.empty()) {
-            const ssize_t writen = write(fd, readBuffer.data(), readBuffer.length());
+        if (request->body->getReadBufferSize() > 0) {
+            iovec iov[BUFFER_MAX_IOVECS];
+            const size_t count = request->body->getReadIovecs(iov, BUFFER_MAX_IOVECS);
+            const ssize_t writen = writev(fd, iov, static_cast<int>(count));
 
             if (writen <= 0) {
                 Logger::log(LogLevel::ERROR, "Failed to write to file: " + std::to_string(fd));
@@ -87,168 +108,174 @@ std::optional<HttpResponse> RequestHandler::handlePostTestFile() {
     return std::nullopt;
 }
 
+MultipartUpload::~MultipartUpload() {
+    if (fileFd >= 0)
+        close(fileFd);
+}
+
 std::optional<HttpResponse> RequestHandler::handlePostMultipart(const std::string &contentType) {
-    std::smatch match;
-    std::regex boundaryRegex("boundary\\s*=\\s*([^;]+)");
-    if (!std::regex_search(contentType, match, boundaryRegex)) {
+    const std::string boundary = MultipartParser::getBoundary(contentType);
+    if (boundary.empty())
         return HttpResponse::html(HttpResponse::StatusCode::BAD_REQUEST, "Missing boundary");
-    }
-
-    std::string boundary = "--" + match[1].str();
-    std::string endBoundary = boundary + "--";
 
-    auto state = std::make_shared<MultipartParseState>();
-    state->boundary = boundary;
-    state->endBoundary = endBoundary;
-    state->uploadedFiles = 0;
-    state->fileNames = std::vector<std::string>();
-    state->currentState = MultipartParseStateEnum::LOOKING_FOR_BOUNDARY;
+    multipartUpload = std::make_unique<MultipartUpload>(boundary);
+    multipartUpload->copyFileRange = canShareBlocks(request->body->getFd());
+    MultipartParser &parser = multipartUpload->parser;
+    parser.onPartBegin = [this](const MultipartPart &part) {
+        return beginMultipartFile(part);
+    };
+    parser.onPartData = [this](const char *data, const size_t length) {
+        return writeMultipartFile(data, length);
+    };
+    parser.onPartEnd = [this]() {
+        if (multipartUpload->fileFd < 0)
+            return true;
+        const bool flushed = flushMultipartFile();
+        close(multipartUpload->fileFd);
+        multipartUpload->fileFd = -1;
+        multipartUpload->uploadedFiles++;
+        return flushed;
+    };
+
+    // every loop iteration parses one chunk of the body, so large uploads don't block other clients
+    this->postRequestCallbackId = CallbackHandler::registerCallback([this]() {
+        const std::shared_ptr<SmartBuffer> &body = request->body;
+        body->read(UPLOAD_CHUNK_SIZE);
+
+        // the parser works on the slices of the body where they are
+        off_t fileOffset = body->getReadBufferFileOffset();
+        size_t parsed = 0;
+        for (const SliceView &slice: body->getReadSlices()) {
+            multipartUpload->chunk = slice.data();
+            multipartUpload->chunkSize = slice.size();
+            multipartUpload->chunkOffset = fileOffset;
+            if (!multipartUpload->parser.parse(slice.data(), slice.size()))
+                break;
+            parsed += slice.size();
+            if (fileOffset >= 0)
+                fileOffset += static_cast<off_t>(slice.size());
+        }
+        flushMultipartFile();
+        body->cleanReadBuffer(parsed);
 
-    state->parseBuffer = "";
+        if (!multipartUpload->parser.hasError() &&
+            (body->getReadPos() < body->getSize() || body->getReadBufferSize() > 0))
+            return false;
 
-    this->postRequestCallbackId = CallbackHandler::registerCallback([this, state]() {
-        // TODO: fix magic number 60000
-        request->body->read(60000);
-        std::string chunk = request->body->getReadBuffer();
+        finishMultipartUpload();
+        postRequestCallbackId = -1;
+        return true;
+    });
 
-        if (chunk.empty() && request->body->getReadPos() >= request->body->getSize()) {
-            if (state->fileWriteFd >= 0) {
-                close(state->fileWriteFd);
-                state->fileWriteFd = -1;
-            }
+    return std::nullopt;
+}
 
-            if (state->uploadedFiles == 0) {
-                setResponse(HttpResponse::html(HttpResponse::StatusCode::BAD_REQUEST,
-                                                       "No files found in request"));
-            } else {
-                setResponse(HttpResponse::html(HttpResponse::StatusCode::CREATED,
-                                                       "201 Created: " + std::to_string(state->uploadedFiles) +
-                                                       " file(s) uploaded successfully"));
-            }
+bool RequestHandler::beginMultipartFile(const MultipartPart &part) {
+    // form fields without a file are skipped, directories in the file name are dropped
+    const std::filesystem::path filename = std::filesystem::path(part.filename).filename();
+    if (filename.empty() || filename == "." || filename == "..")
+        return true;
 
-            return true;
-        }
+    const std::filesystem::path fullPath = std::filesystem::path(routePath) / filename;
+    multipartUpload->fileFd = open(fullPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                                   S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH);
+    OpenFileCache::invalidate(fullPath.string());
+    if (multipartUpload->fileFd == -1) {
+        Logger::log(LogLevel::ERROR, "Failed to open file for writing: " + filename.string());
+        return true;
+    }
 
-        state->parseBuffer.append(chunk);
-        request->body->cleanReadBuffer(chunk.length());
+    const std::string absolutePath = absolute(fullPath).lexically_normal().string();
+    client->sessionId = SessionManager::getSessionId(request->getHeader("Cookie"), client->isNewSession);
+    SessionManager::addUploadedFile(client->sessionId, absolutePath);
+    return true;
+}
 
-        processMultipartBuffer(state);
+bool RequestHandler::writeMultipartFile(const char *data, size_t length) {
+    MultipartUpload &upload = *multipartUpload;
+    if (upload.fileFd < 0)
+        return true;
 
-        return false;
-    });
+    copyMultipartFile(data, length);
+    if (length == 0)
+        return true;
 
-    return std::nullopt;
+    // data in the parsed slice stays valid until the tick ends, the parser's lookback does not
+    const bool inChunk = data >= upload.chunk && data + length <= upload.chunk + upload.chunkSize;
+    if (upload.pendingCount == BUFFER_MAX_IOVECS || !inChunk) {
+        if (!flushMultipartFile())
+            return false;
+    }
+    upload.pending[upload.pendingCount++] = {const_cast<char *>(data), length};
+    return inChunk || flushMultipartFile();
 }
 
-void RequestHandler::processMultipartBuffer(std::shared_ptr<MultipartParseState> state) {
-    while (!state->parseBuffer.empty()) {
-        switch (state->currentState) {
-            case MultipartParseStateEnum::LOOKING_FOR_BOUNDARY: {
-                size_t boundaryPos = state->parseBuffer.find(state->boundary);
-                if (boundaryPos == std::string::npos) {
-                    if (state->parseBuffer.size() > state->boundary.size()) {
-                        state->parseBuffer = state->parseBuffer.substr(
-                            state->parseBuffer.size() - state->boundary.size());
-                    }
-                    return;
-                }
-
-                if (boundaryPos + state->endBoundary.size() <= state->parseBuffer.size() &&
-                    state->parseBuffer.substr(boundaryPos, state->endBoundary.size()) == state->endBoundary) {
-                    state->parseBuffer.clear();
-                    return;
-                }
-
-                state->parseBuffer.erase(0, boundaryPos + state->boundary.size());
-
-                if (state->parseBuffer.size() >= 2 && state->parseBuffer.substr(0, 2) == "\r\n") {
-                    state->parseBuffer.erase(0, 2);
-                }
-
-                state->currentState = MultipartParseStateEnum::READING_HEADERS;
-                break;
-            }
-
-            case MultipartParseStateEnum::READING_HEADERS: {
-                size_t headersEnd = state->parseBuffer.find("\r\n\r\n");
-                if (headersEnd == std::string::npos) {
-                    return;
-                }
-
-                std::string headers = state->parseBuffer.substr(0, headersEnd);
-                state->parseBuffer.erase(0, headersEnd + 4);
-
-                std::smatch match;
-                std::regex filenameRegex("filename\\s*=\\s*\"([^\"]*)\"");
-                if (!std::regex_search(headers, match, filenameRegex) || match[1].str().empty()) {
-                    state->currentState = MultipartParseStateEnum::LOOKING_FOR_BOUNDARY;
-                    break;
-                }
-
-                std::string filename = match[1].str();
-                std::filesystem::path fullPath = std::filesystem::path(routePath) / filename;
-                state->fileNames.push_back(filename);
-
-                state->fileWriteFd = open(fullPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC,
-                                    S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH);
-
-                std::string absolutePath = absolute(fullPath).lexically_normal().string();
-                client->sessionId = SessionManager::getSessionId(request->getHeader("Cookie"), client->isNewSession);
-                SessionManager::addUploadedFile(client->sessionId, absolutePath);
-                if (state->fileWriteFd == -1) {
-                    Logger::log(LogLevel::ERROR, "Failed to open file for writing: " + filename);
-                    state->currentState = MultipartParseStateEnum::LOOKING_FOR_BOUNDARY;
-                    break;
-                }
-
-                state->currentState = MultipartParseStateEnum::READING_FILE_CONTENT;
-                break;
-            }
+bool RequestHandler::flushMultipartFile() {
+    MultipartUpload &upload = *multipartUpload;
+    iovec *iov = upload.pending;
+    size_t count = upload.pendingCount;
+    upload.pendingCount = 0;
+    while (count > 0 && upload.fileFd >= 0) {
+        ssize_t written = writev(upload.fileFd, iov, static_cast<int>(count));
+        if (written <= 0) {
+            Logger::log(LogLevel::ERROR, "Failed to write to file: " + std::to_string(upload.fileFd));
+            upload.writeFailed = true;
+            return false;
+        }
+        while (count > 0 && static_cast<size_t>(written) >= iov->iov_len) {
+            written -= static_cast<ssize_t>(iov->iov_len);
+            iov++;
+            count--;
+        }
+        if (count > 0) {
+            iov->iov_base = static_cast<char *>(iov->iov_base) + written;
+            iov->iov_len -= written;
+        }
+    }
+    return true;
+}
 
-            case MultipartParseStateEnum::READING_FILE_CONTENT: {
-                size_t nextBoundaryPos = state->parseBuffer.find(state->boundary);
-                if (nextBoundaryPos == std::string::npos) {
-                    size_t safeLength = state->parseBuffer.size() - state->boundary.size();
-                    if (safeLength > 0) {
-                        if (write(state->fileWriteFd, state->parseBuffer.data(), safeLength) <= 0) {
-                            Logger::log(LogLevel::ERROR, "Failed to write to file: " +
-                                                         std::to_string(state->fileWriteFd));
-                        }
-                        state->parseBuffer.erase(0, safeLength);
-                    }
-                    return;
-                }
-
-                size_t contentEnd = nextBoundaryPos;
-                if (contentEnd >= 2 && state->parseBuffer.substr(contentEnd - 2, 2) == "\r\n") {
-                    contentEnd -= 2;
-                }
-
-                if (contentEnd > 0) {
-                    pollfd pfd{};
-                    pfd.fd = state->fileWriteFd;
-                    pfd.events = POLLOUT;
-                    pfd.revents = 0;
-
-                    poll(&pfd, 1, 0);
-                    if (pfd.revents & POLLOUT) {
-                        if (write(state->fileWriteFd, state->parseBuffer.data(), contentEnd) <= 0) {
-                            Logger::log(LogLevel::ERROR, "Failed to write to file: " +
-                                                         std::to_string(state->fileWriteFd));
-                        }
-                    } else
-                        Logger::log(LogLevel::ERROR, "File descriptor not ready for writing: " +
-                                                     std::to_string(state->fileWriteFd));
-                }
-
-                close(state->fileWriteFd);
-                state->fileWriteFd = -1;
-                state->uploadedFiles++;
-
-                state->parseBuffer.erase(0, nextBoundaryPos);
-                state->currentState = MultipartParseStateEnum::LOOKING_FOR_BOUNDARY;
-                break;
-            }
+// part data that lies in a spilled body is copied from file to file by the kernel, whatever can't be copied
+// is left for write
+void RequestHandler::copyMultipartFile(const char *&data, size_t &length) {
+#ifdef __linux__
+    MultipartUpload &upload = *multipartUpload;
+    if (!upload.copyFileRange || upload.chunkOffset < 0 || data < upload.chunk ||
+        data + length > upload.chunk + upload.chunkSize)
+        return;
+
+    loff_t offset = upload.chunkOffset + (data - upload.chunk);
+    while (length > 0) {
+        const ssize_t copied = copy_file_range(request->body->getFd(), &offset, upload.fileFd, nullptr, length, 0);
+        if (copied <= 0) {
+            if (copied < 0 && (errno == EXDEV || errno == EINVAL || errno == ENOSYS || errno == EOPNOTSUPP))
+                upload.copyFileRange = false;
+            return;
         }
+        data += copied;
+        length -= copied;
     }
+#else
+    (void) data;
+    (void) length;
+#endif
+}
+
+void RequestHandler::finishMultipartUpload() {
+    const MultipartParser &parser = multipartUpload->parser;
+    const size_t uploadedFiles = multipartUpload->uploadedFiles;
+    const bool writeFailed = multipartUpload->writeFailed;
+    const bool complete = parser.isComplete();
+    multipartUpload.reset();
+
+    if (writeFailed)
+        setResponse(HttpResponse::html(HttpResponse::StatusCode::INTERNAL_SERVER_ERROR, "Failed to write to file"));
+    else if (!complete)
+        setResponse(HttpResponse::html(HttpResponse::StatusCode::BAD_REQUEST, "Malformed multipart body"));
+    else if (uploadedFiles == 0)
+        setResponse(HttpResponse::html(HttpResponse::StatusCode::BAD_REQUEST, "No files found in request"));
+    else
+        setResponse(HttpResponse::html(HttpResponse::StatusCode::CREATED,
+                                       "201 Created: " + std::to_string(uploadedFiles) +
+                                       " file(s) uploaded successfully"));
 }
@@ -1,29 +1,339 @@
 #include "RequestHandler.h"
-#include <fstream>
 #include <filesystem>
-#include <sstream>
-// TODO: refactor to smart buffer
-HttpResponse RequestHandler::handlePut() const {
-    // raw filename from URI
-    /*
-    std::string raw = request.uri.substr(request.uri.find_last_of('/') + 1);
-    std::string name = urlDecode(raw);
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <common/Logger.h>
+#include <common/SessionManager.h>
+#include <server/ClientConnection.h>
+#include <webserv.h>
 
-    namespace fs = std::filesystem;
-    fs::path route(routePath);
-    fs::path dir = route.parent_path();
-    fs::path out = dir / name;
+std::unordered_map<std::string, PartialUpload> RequestHandler::partialUploads;
 
-    std::ofstream ofs(out, std::ios::binary);
-    if (!ofs.is_open()) {
-        return HttpResponse(500);  // can’t open file
+PutUpload::~PutUpload() {
+    if (fd >= 0)
+        close(fd);
+    if (!tmpPath.empty())
+        unlink(tmpPath.c_str());
+    if (const auto it = RequestHandler::partialUploads.find(partialPath); it != RequestHandler::partialUploads.end())
+        it->second.writing = false;
+}
+
+std::optional<HttpResponse> RequestHandler::checkPutTarget() {
+    if (routePath.empty() || routePath.back() == '/' || isDirectory)
+        return HttpResponse::html(HttpResponse::StatusCode::CONFLICT, "Cannot replace a directory");
+
+    const std::filesystem::path target(routePath);
+    std::error_code error;
+    const std::filesystem::path directory = target.parent_path().empty() ? "." : target.parent_path();
+    if (!std::filesystem::is_directory(directory, error))
+        return HttpResponse::html(HttpResponse::StatusCode::CONFLICT, "Parent directory does not exist");
+
+    client->sessionId = SessionManager::getSessionId(request->getHeader("Cookie"), client->isNewSession);
+    const std::string absolutePath = std::filesystem::absolute(target).lexically_normal().string();
+    if (isFile && !SessionManager::ownsFile(client->sessionId, absolutePath))
+        return HttpResponse::html(HttpResponse::StatusCode::FORBIDDEN, "You do not own this file");
+
+    if (access(directory.c_str(), W_OK) != 0)
+        return HttpResponse::html(HttpResponse::StatusCode::FORBIDDEN, "No write permission");
+    return std::nullopt;
+}
+
+// the body is written into an unnamed file in the target directory and linked to its name once it is complete,
+// so readers never see a half written file. a large body was already spilled next to the target and is linked directly
+std::optional<HttpResponse> RequestHandler::handlePut() {
+    if (const std::optional<HttpResponse> response = checkPutTarget())
+        return response;
+
+    if (!request->getHeader("Content-Range").empty())
+        return handleResumableUpload();
+
+    putUpload = std::make_unique<PutUpload>();
+    putUpload->target = routePath;
+    putUpload->replaced = isFile;
+    // a body that was spilled next to the target is moved there instead of being copied
+    if (request->body->isFileBuffer()) {
+        if (request->body->moveTo(putUpload->target)) {
+            putUpload->moved = true;
+            return publishPutFile();
+        }
+        Logger::log(LogLevel::DEBUG, "Request body can't be moved to " + putUpload->target + ", copying it");
+    }
+    if (const std::optional<HttpResponse> response = preparePutFile())
+        return response;
+
+    if (request->totalBodySize == 0)
+        return publishPutFile();
+
+    writePutFile();
+    return std::nullopt;
+}
+
+std::optional<HttpResponse> RequestHandler::handlePatch() {
+    if (request->getHeader("Content-Range").empty())
+        return HttpResponse::html(HttpResponse::StatusCode::BAD_REQUEST, "Content-Range is required");
+
+    if (const std::optional<HttpResponse> response = checkPutTarget())
+        return response;
+    return handleResumableUpload();
+}
+
+// a piece of a resumable upload is written at its offset into a hidden partial file next to the target, which is
+// renamed to the target once every byte arrived. pieces may overlap what is already there, but can't leave holes.
+// every piece has to agree on the total, and a piece that arrives while another one is written is refused
+std::optional<HttpResponse> RequestHandler::handleResumableUpload() {
+    const std::optional<ContentRange> range = parseContentRange(request->getHeader("Content-Range"));
+    if (!range.has_value() || static_cast<size_t>(range->last - range->first + 1) != request->totalBodySize)
+        return HttpResponse::html(HttpResponse::StatusCode::BAD_REQUEST, "Invalid Content-Range");
+
+    const std::string partialPath = getPartialUploadPath(routePath);
+    const std::string absolutePath = std::filesystem::absolute(partialPath).lexically_normal().string();
+    struct stat partialStat{};
+    const bool resumed = stat(partialPath.c_str(), &partialStat) == 0;
+    if (resumed && !SessionManager::ownsFile(client->sessionId, absolutePath))
+        return HttpResponse::html(HttpResponse::StatusCode::FORBIDDEN, "You do not own this upload");
+
+    PartialUpload &partial = partialUploads[absolutePath];
+    if (partial.writing)
+        return HttpResponse::html(HttpResponse::StatusCode::CONFLICT, "Another piece of this upload is being written");
+    if (!resumed)
+        partial = {};
+    if (range->total >= 0 && partial.total >= 0 && range->total != partial.total)
+        return HttpResponse::html(HttpResponse::StatusCode::BAD_REQUEST, "Content-Range total does not match");
+    if (range->total >= 0)
+        partial.total = range->total;
+
+    const off_t persisted = resumed ? partialStat.st_size : 0;
+    if (range->first > persisted) {
+        HttpResponse response = HttpResponse::html(HttpResponse::StatusCode::RANGE_NOT_SATISFIABLE);
+        response.setHeader("Upload-Offset", std::to_string(persisted));
+        return response;
+    }
+
+    putUpload = std::make_unique<PutUpload>();
+    putUpload->target = routePath;
+    putUpload->replaced = isFile;
+    putUpload->offset = range->first;
+    putUpload->total = partial.total;
+    putUpload->fd = open(partialPath.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    if (putUpload->fd < 0) {
+        Logger::log(LogLevel::ERROR, "Failed to open partial upload " + partialPath + ": " + strerror(errno));
+        putUpload.reset();
+        if (!resumed)
+            partialUploads.erase(absolutePath);
+        return HttpResponse::html(HttpResponse::StatusCode::INTERNAL_SERVER_ERROR, "Could not open file for writing");
+    }
+    putUpload->partialPath = absolutePath;
+    partial.writing = true;
+    if (!resumed)
+        SessionManager::addUploadedFile(client->sessionId, absolutePath);
+
+    writePutFile();
+    return std::nullopt;
+}
+
+HttpResponse RequestHandler::finishResumableUpload(const bool synced) {
+    PutUpload &upload = *putUpload;
+    struct stat partialStat{};
+    if (!synced || fstat(upload.fd, &partialStat) != 0) {
+        Logger::log(LogLevel::ERROR, "Failed to sync partial upload " + upload.partialPath);
+        putUpload.reset();
+        return HttpResponse::html(HttpResponse::StatusCode::INTERNAL_SERVER_ERROR, "Failed to write to file");
+    }
+
+    const off_t persisted = partialStat.st_size;
+    if (upload.total < 0 || persisted < upload.total) {
+        putUpload.reset();
+        HttpResponse response = HttpResponse::html(HttpResponse::StatusCode::ACCEPTED);
+        response.setHeader("Upload-Offset", std::to_string(persisted));
+        response.setHeader("Range", "bytes=0-" + std::to_string(persisted - 1));
+        return response;
     }
 
-    ofs.write(request.body.data(), request.body.size());
-    if (ofs.fail()) {
-        return HttpResponse(500);  // write error
+    // an earlier piece may have claimed a longer file
+    if (persisted > upload.total && ftruncate(upload.fd, upload.total) != 0) {
+        putUpload.reset();
+        return HttpResponse::html(HttpResponse::StatusCode::INTERNAL_SERVER_ERROR, "Failed to write to file");
     }
+    if (rename(upload.partialPath.c_str(), upload.target.c_str()) != 0) {
+        Logger::log(LogLevel::ERROR, "Failed to publish upload " + upload.target + ": " + strerror(errno));
+        putUpload.reset();
+        return HttpResponse::html(HttpResponse::StatusCode::INTERNAL_SERVER_ERROR, "Failed to publish file");
+    }
+
+    SessionManager::removeFile(client->sessionId, upload.partialPath);
+    partialUploads.erase(upload.partialPath);
+    upload.moved = true;
+    return publishPutFile();
+}
+
+std::optional<HttpResponse> RequestHandler::preparePutFile() {
+    if (!openPutFile(*putUpload)) {
+        putUpload.reset();
+        return HttpResponse::html(HttpResponse::StatusCode::INTERNAL_SERVER_ERROR, "Could not open file for writing");
+    }
+
+#ifdef __linux__
+    // reserving the whole file up front keeps it contiguous and fails early if the disk is too small
+    if (request->totalBodySize > 0 &&
+        fallocate(putUpload->fd, 0, 0, static_cast<off_t>(request->totalBodySize)) != 0 && errno == ENOSPC) {
+        putUpload.reset();
+        return HttpResponse::html(HttpResponse::StatusCode::INSUFFICIENT_STORAGE);
+    }
+#endif
+    return std::nullopt;
+}
+
+bool RequestHandler::openPutFile(PutUpload &upload) const {
+    const std::filesystem::path target(upload.target);
+    const std::filesystem::path directory = target.parent_path().empty() ? "." : target.parent_path();
+    constexpr mode_t mode = S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH;
+
+#ifdef O_TMPFILE
+    upload.fd = open(directory.c_str(), O_TMPFILE | O_WRONLY | O_CLOEXEC, mode);
+    if (upload.fd >= 0)
+        return true;
+    Logger::log(LogLevel::DEBUG, "O_TMPFILE is not supported in " + directory.string() + ", using a named file");
+#endif
+
+    // a hidden file next to the target, so the final rename stays on the same filesystem
+    std::string name = (directory / ("." + target.filename().string() + ".put-XXXXXX")).string();
+    std::vector<char> tmpName(name.begin(), name.end());
+    tmpName.push_back('\0');
+    upload.fd = mkstemp(tmpName.data());
+    if (upload.fd < 0) {
+        Logger::log(LogLevel::ERROR, "Failed to create temporary file for " + upload.target + ": " + strerror(errno));
+        return false;
+    }
+    fcntl(upload.fd, F_SETFD, FD_CLOEXEC);
+    fchmod(upload.fd, mode);
+    upload.tmpPath = tmpName.data();
+    return true;
+}
+
+// the body is written chunk by chunk on the thread pool, the views keep the slices alive until the write is done
+struct PutWrite {
+    std::vector<SliceView> views;
+    int fd = -1;
+    off_t offset = -1;
+    size_t written = 0;
+    int error = 0;
+};
+
+void RequestHandler::writePutFile() {
+    const std::shared_ptr<SmartBuffer> &body = request->body;
+    body->read(UPLOAD_CHUNK_SIZE);
+    if (body->getReadBufferSize() == 0) {
+        finishPutBody();
+        return;
+    }
+
+    // the worker gets its own descriptor, so closing the upload can't hand the number to someone else
+    const auto write = std::make_shared<PutWrite>();
+    write->views.assign(body->getReadSlices().begin(), body->getReadSlices().end());
+    write->fd = fcntl(putUpload->fd, F_DUPFD_CLOEXEC, 0);
+    write->offset = putUpload->offset;
+    fileTask = ThreadPool::submit([write] {
+        iovec iov[BUFFER_MAX_IOVECS];
+        size_t count = 0;
+        for (const SliceView &view: write->views) {
+            if (count == BUFFER_MAX_IOVECS)
+                break;
+            iov[count++] = {const_cast<char *>(view.data()), view.size()};
+        }
+
+        iovec *next = iov;
+        while (count > 0 && write->fd >= 0) {
+            const off_t offset = write->offset < 0 ? -1 : write->offset + static_cast<off_t>(write->written);
+            ssize_t written = offset < 0
+                                  ? writev(write->fd, next, static_cast<int>(count))
+                                  : pwritev(write->fd, next, static_cast<int>(count), offset);
+            if (written <= 0) {
+                write->error = written < 0 ? errno : EIO;
+                break;
+            }
+            write->written += written;
+            while (count > 0 && static_cast<size_t>(written) >= next->iov_len) {
+                written -= static_cast<ssize_t>(next->iov_len);
+                next++;
+                count--;
+            }
+            if (count > 0) {
+                next->iov_base = static_cast<char *>(next->iov_base) + written;
+                next->iov_len -= written;
+            }
+        }
+        if (write->fd < 0)
+            write->error = EBADF;
+        else
+            close(write->fd);
+    }, [this, write] {
+        fileTask.reset();
+        if (write->error != 0) {
+            Logger::log(LogLevel::ERROR, "Failed to write to file: " + putUpload->target + ": " +
+                                         strerror(write->error));
+            putUpload.reset();
+            setResponse(write->error == ENOSPC
+                            ? HttpResponse::html(HttpResponse::StatusCode::INSUFFICIENT_STORAGE)
+                            : HttpResponse::html(HttpResponse::StatusCode::INTERNAL_SERVER_ERROR,
+                                                 "Failed to write to file"));
+            return;
+        }
+        if (putUpload->offset >= 0)
+            putUpload->offset += static_cast<off_t>(write->written);
+        write->views.clear();
+        request->body->cleanReadBuffer(write->written);
+        writePutFile();
+    });
+}
+
+void RequestHandler::finishPutBody() {
+    if (putUpload->partialPath.empty()) {
+        setResponse(publishPutFile());
+        return;
+    }
+
+    // the client is told how much is persisted and won't send it again, so it has to be on the disk
+    const int fd = fcntl(putUpload->fd, F_DUPFD_CLOEXEC, 0);
+    const auto synced = std::make_shared<bool>(false);
+    fileTask = ThreadPool::submit([fd, synced] {
+        *synced = fd >= 0 && fdatasync(fd) == 0;
+        if (fd >= 0)
+            close(fd);
+    }, [this, synced] {
+        fileTask.reset();
+        setResponse(finishResumableUpload(*synced));
+    });
+}
+
+HttpResponse RequestHandler::publishPutFile() {
+    PutUpload &upload = *putUpload;
+
+    bool published = upload.moved;
+    if (!published && upload.tmpPath.empty())
+        published = SmartBuffer::linkTmpFile(upload.fd, upload.target);
+    else if (!published && rename(upload.tmpPath.c_str(), upload.target.c_str()) == 0) {
+        upload.tmpPath.clear();
+        published = true;
+    }
+    if (!published) {
+        Logger::log(LogLevel::ERROR, "Failed to publish uploaded file " + upload.target + ": " + strerror(errno));
+        putUpload.reset();
+        return HttpResponse::html(HttpResponse::StatusCode::INTERNAL_SERVER_ERROR, "Failed to publish file");
+    }
+
+    OpenFileCache::invalidate(upload.target);
+    const std::string absolutePath = std::filesystem::absolute(upload.target).lexically_normal().string();
+    SessionManager::addUploadedFile(client->sessionId, absolutePath);
 
-*/
-    return HttpResponse(201);  // Created
-}
\ No newline at end of file
+    const bool replaced = upload.replaced;
+    putUpload.reset();
+    if (replaced)
+        return HttpResponse(HttpResponse::StatusCode::NO_CONTENT);
+    return HttpResponse::html(HttpResponse::StatusCode::CREATED, "File uploaded successfully");
+}
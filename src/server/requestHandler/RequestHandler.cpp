@@ -18,6 +18,8 @@
 #include <sys/types.h>
 #include <arpa/inet.h>
 #include <server/handler/CallbackHandler.h>
+#include <server/handler/MetricHandler.h>
+#include <server/cache/ErrorPageCache.h>
 #include <server/FdHandler.h>
 #include <sys/poll.h>
 
@@ -54,13 +56,22 @@ RequestHandler::~RequestHandler() {
         close(fileWriteFd);
         fileWriteFd = -1;
     }
-    if (cgiProcessId != -1) {
-        cleanupCgiProcess(cgiProcessId);
-    }
+    if (cgiProcessId != -1)
+        CgiProcessManager::abandon(cgiProcessId);
+    CgiProcessManager::cancel(cgiTicket);
+    if (cgiCacheWaiterId)
+        CgiCache::unwait(cgiCacheKey, *cgiCacheWaiterId);
+    if (cgiCacheLeader)
+        CgiCache::abort(cgiCacheKey);
     if (postRequestCallbackId != -1) {
         CallbackHandler::unregisterCallback(postRequestCallbackId);
         postRequestCallbackId = -1;
     }
+    if (fastCgiRequest)
+        fastCgiPool->cancel(fastCgiRequest);
+    if (cgiWorkerRequest)
+        cgiWorkerPool->cancel(cgiWorkerRequest);
+    ThreadPool::cancel(fileTask);
 }
 
 
@@ -122,12 +133,108 @@ void RequestHandler::setRoutePath() {
     Logger::log(LogLevel::DEBUG, "set path to " + routePath);
 }
 
+using LookupFunction = std::function<std::shared_ptr<const OpenFileInfo>(const std::string &)>;
+
+// makes the lookups the handlers are going to make, stops at the first one that lookup can't answer
+static bool collectLookups(TargetLookup &target, const LookupFunction &lookup) {
+    const auto add = [&target, &lookup](const std::string &path) {
+        auto info = lookup(path);
+        if (info)
+            target.infos[path] = info;
+        return info;
+    };
+
+    const auto route = add(target.routePath);
+    if (!route)
+        return false;
+
+    std::string servedPath = target.routePath;
+    std::shared_ptr<const OpenFileInfo> served = route;
+    if (route->isDirectory() && !target.indexName.empty()) {
+        servedPath = (std::filesystem::path(target.routePath) / target.indexName).string();
+        served = add(servedPath);
+        if (!served)
+            return false;
+    }
+
+    target.needsListing = target.autoindex && route->isDirectory() && !served->isFile();
+    if (!served->isFile() || !target.precompressed)
+        return true;
+    return add(servedPath + ".br") && add(servedPath + ".gz");
+}
+
+// what GET and HEAD serve and is not cached yet is looked up on the thread pool, returns false if nothing had to be
+// loaded. without the open file cache the lookups are not kept, so a round trip to a worker would cost more than the
+// open and fstat it saves. they are made on the loop then and only a directory listing is read on the pool
+bool RequestHandler::loadTargetAsync() {
+    const bool serving = request->method == GET || request->method == HEAD;
+    if (!serving || ThreadPool::getThreadCount() == 0)
+        return false;
+
+    const auto target = std::make_shared<TargetLookup>();
+    target->routePath = routePath;
+    target->indexName = !matchedRoute->index.empty() ? matchedRoute->index : serverConfig.index;
+    target->precompressed = serverConfig.gzip_static;
+    target->autoindex = matchedRoute->autoindex;
+    const LookupFunction inlineLookup = OpenFileCache::isEnabled() ? OpenFileCache::find : OpenFileCache::lookup;
+    if (collectLookups(*target, inlineLookup) && !target->needsListing) {
+        lookups = std::move(target->infos);
+        return false;
+    }
+    if (target->autoindex)
+        target->listing = DirectoryCache::find(routePath);
+
+    fileTask = ThreadPool::submit([target] {
+        collectLookups(*target, [&target](const std::string &path) {
+            if (const auto it = target->infos.find(path); it != target->infos.end())
+                return it->second;
+            target->loaded.push_back(path);
+            return OpenFileCache::load(path);
+        });
+        // a listing is only read again if the directory changed since it was cached
+        struct stat directory{};
+        if (target->needsListing && (!target->listing || stat(target->routePath.c_str(), &directory) != 0 ||
+                                     !DirectoryCache::isCurrent(*target->listing, directory))) {
+            target->listing = DirectoryCache::read(target->routePath);
+            target->listingLoaded = true;
+        }
+    }, [this, target] {
+        fileTask.reset();
+        for (const std::string &path: target->loaded)
+            OpenFileCache::store(path, target->infos[path]);
+        lookups = std::move(target->infos);
+        if (target->needsListing) {
+            if (target->listingLoaded)
+                DirectoryCache::store(target->routePath, target->listing);
+            MetricHandler::incrementMetric(target->listingLoaded ? "autoindex_cache_misses" : "autoindex_cache_hits", 1);
+            directoryListing = std::move(target->listing);
+        }
+        targetLoaded = true;
+
+        try {
+            if (const auto response = handleTarget())
+                setResponse(response.value());
+        } catch (std::exception &e) {
+            Logger::log(LogLevel::ERROR, "Error handling request: " + std::string(e.what()));
+            setResponse(HttpResponse::html(HttpResponse::StatusCode::INTERNAL_SERVER_ERROR));
+        }
+    });
+    return true;
+}
+
+std::shared_ptr<const OpenFileInfo> RequestHandler::lookupPath(const std::string &path) const {
+    if (const auto it = lookups.find(path); it != lookups.end())
+        return it->second;
+    return OpenFileCache::lookup(path);
+}
+
 void RequestHandler::validateTargetPath() {
-    isFile = std::filesystem::is_regular_file(routePath);
+    targetInfo = lookupPath(routePath);
+    isFile = targetInfo->isFile();
     if (isFile)
         return;
 
-    isDirectory = std::filesystem::is_directory(routePath);
+    isDirectory = targetInfo->isDirectory();
     if (!isDirectory) {
         Logger::log(LogLevel::ERROR, "Target path is neither a file nor a directory: " + routePath);
         return;
@@ -140,7 +247,8 @@ void RequestHandler::validateTargetPath() {
     const std::string indexFilePath = std::filesystem::path(routePath) / (!route.index.empty()
                                                                               ? route.index
                                                                               : serverConfig.index);
-    hasValidIndexFile = std::filesystem::is_regular_file(indexFilePath);
+    indexInfo = lookupPath(indexFilePath);
+    hasValidIndexFile = indexInfo->isFile();
 
     this->indexFilePath = indexFilePath;
 }
@@ -197,6 +305,13 @@ std::optional<HttpResponse> RequestHandler::handleRequest() {
         response.setBody(matchedRoute->return_directive.second);
         return response;
     }
+    return handleTarget();
+}
+
+// the rest of the request needs its target, which may have to be looked up on the thread pool first
+std::optional<HttpResponse> RequestHandler::handleTarget() {
+    if (!targetLoaded && loadTargetAsync())
+        return std::nullopt;
 
     try {
         validateTargetPath();
@@ -205,12 +320,21 @@ std::optional<HttpResponse> RequestHandler::handleRequest() {
         return HttpResponse::html(HttpResponse::StatusCode::FORBIDDEN);
     }
 
+    if (!matchedRoute->fastcgi_pass.empty()) {
+        if (!isFile && !hasValidIndexFile)
+            return HttpResponse::html(HttpResponse::StatusCode::NOT_FOUND);
+        Logger::log(LogLevel::DEBUG, "request is a FastCGI request");
+        return handleFastCgi();
+    }
+
     if (isCgiRequest()) {
         Logger::log(LogLevel::DEBUG, "request is a CGI request");
         if (!validateCgiEnvironment())
             return HttpResponse::html(HttpResponse::StatusCode::INTERNAL_SERVER_ERROR,
                                       "CGI Error: Invalid CGI environment");
-        return handleCgi();
+        if (matchedRoute->cgi_cache > 0 && request->method == GET)
+            return handleCachedCgi();
+        return runCgi();
     }
 
 
@@ -221,6 +345,10 @@ std::optional<HttpResponse> RequestHandler::handleRequest() {
             return handlePost();
         case PUT:
             return handlePut();
+        case PATCH:
+            return handlePatch();
+        case HEAD:
+            return handleHead();
         case DELETE:
             return handleDelete();
         default:
@@ -240,20 +368,14 @@ HttpResponse RequestHandler::handleCustomErrorPage(HttpResponse original, Server
         return original;
 
 
-    if (access(errorPagePath.c_str(), R_OK) != 0 || !std::filesystem::is_regular_file(errorPagePath)) {
-        Logger::log(LogLevel::ERROR, "error page has an invalid path: " + errorPagePath);
-        return original;
-    }
-    const int fd = open(errorPagePath.c_str(), O_RDONLY);
-    if (fd < 0) {
-        Logger::log(LogLevel::ERROR, "error page does not exist: " + errorPagePath);
+    // the page was read when the config was loaded, a page that can't be read is logged there
+    const auto page = ErrorPageCache::get(errorPagePath, original.getStatus());
+    if (!page)
         return original;
-    }
 
-    HttpResponse newResponse(HttpResponse::StatusCode::OK);
-    newResponse.enableChunkedEncoding(std::make_shared<SmartBuffer>(fd));
+    HttpResponse newResponse(original.getStatus());
     newResponse.setHeader("Content-Type", getMimeType(errorPagePath));
-    newResponse.setStatus(original.getStatus());
+    newResponse.setPrerendered(page);
     return newResponse;
 }
 
@@ -264,6 +386,84 @@ std::string RequestHandler::getFilePath() const {
     return this->routePath;
 }
 
+std::string RequestHandler::getUploadDirectory() const {
+    if (!matchedRoute.has_value() || routePath.empty() || matchedRoute->internalHandler != nullptr ||
+        matchedRoute->deny_all || !matchedRoute->fastcgi_pass.empty() || matchedRoute->return_directive.first != -1)
+        return "";
+    const std::vector<HttpMethod> &methods = matchedRoute->allowedMethods;
+    if (std::find(methods.begin(), methods.end(), request->method) == methods.end())
+        return "";
+    // scripts read their body from a pipe
+    if (matchedRoute->cgi_params.count(getFileExtension(routePath)))
+        return "";
+
+    std::string directory;
+    if (request->method == PUT)
+        directory = std::filesystem::path(routePath).parent_path().string();
+    else if (request->method == POST)
+        directory = routePath;
+    if (directory.empty() || !std::filesystem::is_directory(directory) || access(directory.c_str(), W_OK) != 0)
+        return "";
+    return directory;
+}
+
 void RequestHandler::setResponse(const HttpResponse &response) const {
-    this->client->setResponse(handleCustomErrorPage(response, serverConfig, matchedRoute));
+    HttpResponse finalResponse = handleCustomErrorPage(response, serverConfig, matchedRoute);
+    compressResponse(finalResponse);
+    // HEAD is answered like GET, only the body is left out
+    if (request->method == HEAD && finalResponse.hasBody()) {
+        const std::string contentLength = finalResponse.getHeader("Content-Length");
+        finalResponse.removeBody();
+        if (!contentLength.empty() && !finalResponse.getPrerendered())
+            finalResponse.setHeader("Content-Length", contentLength);
+    }
+    this->client->setResponse(finalResponse);
+}
+
+bool RequestHandler::isCompressibleType(const std::string &contentType) const {
+    std::string type = contentType.substr(0, contentType.find(';'));
+    type.erase(type.find_last_not_of(" \t") + 1);
+    std::transform(type.begin(), type.end(), type.begin(), ::tolower);
+
+    for (const auto &pattern: serverConfig.gzip_types) {
+        if (pattern == "*" || pattern == type)
+            return true;
+        if (pattern.size() > 2 && pattern.compare(pattern.size() - 2, 2, "/*") == 0 &&
+            type.compare(0, pattern.size() - 1, pattern, 0, pattern.size() - 1) == 0)
+            return true;
+    }
+    return false;
+}
+
+bool RequestHandler::shouldCompress(const std::string &contentType, const size_t length) const {
+    return serverConfig.gzip && length >= serverConfig.gzip_min_length && isCompressibleType(contentType) &&
+           acceptsEncoding(request->getHeader("Accept-Encoding"), "gzip");
+}
+
+// chunked bodies like autoindex and cgi output are compressed while they are sent,
+// status and error pages come with a compressed variant
+void RequestHandler::compressResponse(HttpResponse &response) const {
+    if (const std::shared_ptr<const PrerenderedResponse> page = response.getPrerendered()) {
+        if (page->gzipped && response.hasBody() && shouldCompress(response.getHeader("Content-Type"), page->body.size())) {
+            response.setPrerendered(page->gzipped);
+            MetricHandler::incrementMetric("gzip_responses", 1);
+            MetricHandler::incrementMetric("gzip_bytes_saved", page->body.size() - page->gzipped->body.size());
+        }
+        return;
+    }
+    if (!serverConfig.gzip || !response.hasBody() || !response.isChunkedEncoding() || response.getPrerendered() ||
+        response.getEncoder() || response.hasHeader("Content-Encoding"))
+        return;
+
+    // event streams have to reach the client frame by frame, deflate would hold them back
+    const std::string contentType = response.getHeader("Content-Type");
+    if (contentType == "text/event-stream" || !isCompressibleType(contentType))
+        return;
+    response.setHeader("Vary", "Accept-Encoding");
+
+    // a streamed body has an unknown length, so it is always compressed. its chunks are flushed as they are sent
+    const auto body = response.getBody();
+    const size_t length = body->isStreaming() ? serverConfig.gzip_min_length : body->getSize();
+    if (shouldCompress(contentType, length))
+        response.enableCompression(serverConfig.gzip_comp_level);
 }
@@ -9,24 +9,108 @@
 #include <parser/http/HttpRequest.h>
 #include <server/response/HttpResponse.h>
 #include <optional>
-#include <parser/cgi/CgiParser.h>
+#include <server/cgi/CgiResponseBuilder.h>
+#include <server/cache/OpenFileCache.h>
+#include <server/cache/DirectoryCache.h>
+#include <server/fastcgi/FastCgiPool.h>
+#include <server/cgi/CgiWorkerPool.h>
+#include <server/cgi/CgiProcessManager.h>
+#include <server/cache/CgiCache.h>
+#include <server/handler/ThreadPool.h>
+#include <parser/multipart/MultipartParser.h>
+#include <sys/uio.h>
+#include <webserv.h>
 
 class ClientConnection;
 
-enum class MultipartParseStateEnum {
-    LOOKING_FOR_BOUNDARY,
-    READING_HEADERS,
-    READING_FILE_CONTENT
+// a multipart/form-data upload, the file of the current part is closed together with it
+struct MultipartUpload {
+    MultipartParser parser;
+    int fileFd = -1;
+    size_t uploadedFiles = 0;
+    bool writeFailed = false;
+    // the chunk that is parsed and where it is in the spilled body, so part data can be copied inside the kernel
+    const char *chunk = nullptr;
+    size_t chunkSize = 0;
+    off_t chunkOffset = -1;
+    bool copyFileRange = false;
+    // part data inside the slices of this tick, written together before the slices are released
+    iovec pending[BUFFER_MAX_IOVECS]{};
+    size_t pendingCount = 0;
+
+    explicit MultipartUpload(const std::string &boundary): parser(boundary) {
+    }
+
+    ~MultipartUpload();
 };
 
-struct MultipartParseState {
-    std::string boundary;
-    std::string endBoundary;
-    std::string parseBuffer;
-    int fileWriteFd = -1;
-    int uploadedFiles;
-    std::vector<std::string> fileNames;
-    MultipartParseStateEnum currentState;
+// a PUT body that is written next to its target and published once it is complete
+struct PutUpload {
+    int fd = -1;
+    // empty for an O_TMPFILE file, which disappears by itself when it is not linked
+    std::string tmpPath;
+    std::string target;
+    bool replaced = false;
+    bool moved = false;
+    // position of the next write for a piece of a resumable upload, -1 writes sequentially
+    off_t offset = -1;
+    off_t total = -1;
+    // absolute path of the partial file, its piece is marked as written until the upload is gone
+    std::string partialPath;
+
+    ~PutUpload();
+};
+
+// an unfinished resumable upload by the absolute path of its partial file. the total is kept from the first piece
+// that told it, and only one piece at a time may write into the file
+struct PartialUpload {
+    off_t total = -1;
+    bool writing = false;
+};
+
+// what the handlers of a request look up about its target, collected up front so it can be done on the thread pool
+struct TargetLookup {
+    std::string routePath;
+    // index file of the route, empty if it has none
+    std::string indexName;
+    // the precompressed siblings of the served file are looked up too
+    bool precompressed = false;
+    // a directory without an index file is read for its listing
+    bool autoindex = false;
+    bool needsListing = false;
+    std::unordered_map<std::string, std::shared_ptr<const OpenFileInfo> > infos;
+    // lookups that came from the disk and not from the cache
+    std::vector<std::string> loaded;
+    // the cached listing of the directory until the worker found it outdated and read it again
+    std::shared_ptr<const DirectoryListing> listing;
+    bool listingLoaded = false;
+};
+
+// an autoindex response is rendered in batches while it is sent, the stat calls of a batch run on the thread pool
+struct AutoIndexStream {
+    std::shared_ptr<const DirectoryListing> listing;
+    std::string directory;
+    // request path with a trailing slash, the entries link relative to it
+    std::string uriPath;
+    bool json = false;
+    size_t offset = 0;
+    size_t limit = 0;
+    size_t next = 0; // index of the next entry to render
+    size_t end = 0;
+    std::shared_ptr<SmartBuffer> body;
+};
+
+// inclusive byte positions of a satisfiable range
+struct ByteRange {
+    off_t first;
+    off_t last;
+};
+
+// Content-Range of an uploaded piece, total is -1 while the client does not know the size yet
+struct ContentRange {
+    off_t first;
+    off_t last;
+    off_t total;
 };
 
 
@@ -42,6 +126,15 @@ private:
     bool isDirectory = false;
     bool hasValidIndexFile = false;
     std::string indexFilePath;
+    std::shared_ptr<const OpenFileInfo> targetInfo;
+    std::shared_ptr<const OpenFileInfo> indexInfo;
+    // lookups made for this request on the thread pool, used before the cache
+    std::unordered_map<std::string, std::shared_ptr<const OpenFileInfo> > lookups;
+    std::shared_ptr<const DirectoryListing> directoryListing;
+    std::shared_ptr<AutoIndexStream> autoIndex;
+    bool targetLoaded = false;
+    // blocking filesystem work of this request that runs on the thread pool, at most one at a time
+    std::shared_ptr<ThreadPool::Task> fileTask;
 
     ssize_t bytesWrittenToCgi = 0;
     std::string cgiOutputBuffer{};
@@ -51,7 +144,26 @@ private:
     int cgiProcessId = -1;
     int fileWriteFd = -1;
     ssize_t postRequestCallbackId = -1;
-    CgiParser cgiParser;
+    std::unique_ptr<MultipartUpload> multipartUpload;
+    std::unique_ptr<PutUpload> putUpload;
+    CgiResponseBuilder cgiOutput;
+    bool cgiResponseStarted = false;
+    // bytes of the current chunk that still have to be spliced from the cgi pipe to the client
+    size_t cgiSpliceRemaining = 0;
+    // chunk header or trailer of spliced output the full socket did not take yet
+    std::string cgiSpliceFraming;
+    // the output pipe is not polled until the client took enough of the buffered output
+    bool cgiOutputPaused = false;
+    std::shared_ptr<FastCgiRequest> fastCgiRequest;
+    FastCgiPool *fastCgiPool = nullptr;
+    std::shared_ptr<CgiWorkerRequest> cgiWorkerRequest;
+    CgiWorkerPool *cgiWorkerPool = nullptr;
+    std::shared_ptr<CgiProcessManager::Ticket> cgiTicket;
+    std::optional<int> cgiExitStatus;
+    std::string cgiCacheKey;
+    // this request runs the script others wait for
+    bool cgiCacheLeader = false;
+    std::optional<size_t> cgiCacheWaiterId;
 
 public:
     RequestHandler(ClientConnection *connection, const std::shared_ptr<HttpRequest> &request,
@@ -63,6 +175,14 @@ public:
 
     std::optional<HttpResponse> handleRequest();
 
+    // directory a PUT or POST body ends up in, empty if the body is not stored as a file
+    [[nodiscard]] std::string getUploadDirectory() const;
+
+    void resumeCgiOutput();
+
+    // renders the next entries of an autoindex once the client took the previous ones
+    void resumeAutoIndex();
+
     static HttpResponse handleCustomErrorPage(HttpResponse original, ServerConfig &serverConfig,
                                               std::optional<RouteConfig> matchedRoute);
 
@@ -72,11 +192,36 @@ public:
 
     static std::string urlDecode(const std::string &in);
 
+    static std::string createETag(const struct stat &fileStat);
+
+    static std::string formatHttpDate(time_t time);
+
+    static std::optional<time_t> parseHttpDate(const std::string &date);
+
+    // checks an Accept-Encoding header, encodings with q=0 are refused
+    static bool acceptsEncoding(const std::string &header, const std::string &encoding);
+
+    // returns std::nullopt if the header has to be ignored and an empty list if no range is satisfiable
+    static std::optional<std::vector<ByteRange> > parseRange(const std::string &header, off_t fileSize);
+
+    static std::optional<ContentRange> parseContentRange(const std::string &header);
+
+    // hidden file next to path that collects the pieces of a resumable upload
+    static std::string getPartialUploadPath(const std::string &path);
+
+    static std::unordered_map<std::string, PartialUpload> partialUploads;
+
 private:
     void findRoute();
 
     void setRoutePath();
 
+    [[nodiscard]] std::optional<HttpResponse> handleTarget();
+
+    bool loadTargetAsync();
+
+    [[nodiscard]] std::shared_ptr<const OpenFileInfo> lookupPath(const std::string &path) const;
+
     void validateTargetPath();
 
     bool isCgiRequest();
@@ -87,29 +232,111 @@ private:
 
     [[nodiscard]] HttpResponse handleGet();
 
+    [[nodiscard]] HttpResponse handleServeFile(const std::string &path,
+                                               const std::shared_ptr<const OpenFileInfo> &file);
+
+    [[nodiscard]] bool isNotModified(const OpenFileInfo &file) const;
+
+    [[nodiscard]] std::string findPrecompressed(const std::string &path, std::string &servedPath,
+                                                std::shared_ptr<const OpenFileInfo> &served) const;
+
+    [[nodiscard]] bool isCompressibleType(const std::string &contentType) const;
+
+    [[nodiscard]] bool shouldCompress(const std::string &contentType, size_t length) const;
+
+    void compressResponse(HttpResponse &response) const;
+
+    [[nodiscard]] bool matchesIfRange(const OpenFileInfo &file) const;
+
+    [[nodiscard]] HttpResponse handleRangeRequest(HttpResponse response, const OpenFileInfo &file,
+                                                  const std::vector<ByteRange> &ranges) const;
+
     [[nodiscard]] std::optional<HttpResponse> handlePost();
 
     [[nodiscard]] std::optional<HttpResponse> handlePostMultipart(const std::string &contentType);
 
-    void processMultipartBuffer(std::shared_ptr<MultipartParseState> state);
+    bool beginMultipartFile(const MultipartPart &part);
+
+    bool writeMultipartFile(const char *data, size_t length);
+
+    void copyMultipartFile(const char *&data, size_t &length);
+
+    bool flushMultipartFile();
+
+    void finishMultipartUpload();
 
     [[nodiscard]] std::optional<HttpResponse> handlePostTestFile();
 
-    HttpResponse handlePut() const;
+    [[nodiscard]] std::optional<HttpResponse> checkPutTarget();
+
+    [[nodiscard]] std::optional<HttpResponse> handlePut();
+
+    [[nodiscard]] std::optional<HttpResponse> preparePutFile();
+
+    bool openPutFile(PutUpload &upload) const;
+
+    void writePutFile();
+
+    void finishPutBody();
+
+    [[nodiscard]] HttpResponse publishPutFile();
+
+    [[nodiscard]] std::optional<HttpResponse> handleResumableUpload();
+
+    [[nodiscard]] HttpResponse finishResumableUpload(bool synced);
+
+    [[nodiscard]] std::optional<HttpResponse> handlePatch();
+
+    [[nodiscard]] HttpResponse handleHead();
+
+    [[nodiscard]] std::optional<HttpResponse> handleDelete();
 
-    [[nodiscard]] HttpResponse handleDelete() const;
+    void onCgiProcessExit(int status);
 
-    void cleanupCgiProcess(pid_t pid) const;
+    [[nodiscard]] HttpResponse createCgiErrorResponse() const;
+
+    [[nodiscard]] std::optional<HttpResponse> runCgi();
+
+    [[nodiscard]] std::optional<HttpResponse> handleCachedCgi();
+
+    void completeCachedCgi(const CgiResponseBuilder &output);
 
     [[nodiscard]] std::optional<HttpResponse> handleCgi();
 
+    [[nodiscard]] std::optional<HttpResponse> startCgi();
+
+    [[nodiscard]] std::optional<HttpResponse> handleFastCgi();
+
+    [[nodiscard]] std::optional<HttpResponse> handleCgiWorker();
+
+    [[nodiscard]] std::vector<std::string> createRequestEnvironment(const std::string &scriptFileName) const;
+
+    [[nodiscard]] std::unordered_map<std::string, std::string> createCgiEnvironment(
+        const std::string &scriptFileName) const;
+
     HttpResponse handleAutoIndex(const std::string &path);
 
+    void renderAutoIndex();
+
     bool writeRequestBodyToCgi(int pipe_fd, const std::string &body);
 
+    [[nodiscard]] bool canSpliceRequestBody() const;
+
+    ssize_t spliceRequestBodyToCgi(int fd) const;
+
+    [[nodiscard]] bool canSpliceCgiOutput() const;
+
+    bool spliceCgiOutput(int fd);
+
+    bool sendCgiSpliceFraming();
+
+    void pauseCgiOutput(int fd);
+
+    void finishCgiOutput(int fd);
+
     [[nodiscard]] bool validateCgiEnvironment() const;
 
-    void configureCgiChildProcess(int input_pipe[2], int output_pipe[2]) const;
+    pid_t spawnCgiProcess(int input_pipe[2], int output_pipe[2]) const;
 };
 
 
@@ -8,6 +8,12 @@
 #include <dirent.h>
 #include <vector>
 #include <algorithm>
+#include <ctime>
+#include <cstdio>
+#include <cstdlib>
+#include <sstream>
+#include <filesystem>
+#include <webserv.h>
 
 static std::map<std::string, std::string> mimeTypes = {
     {".html", "text/html"},
@@ -49,6 +55,146 @@ std::string RequestHandler::getFileExtension(const std::string &path) {
 
 std::string RequestHandler::getMimeType(const std::string &path) {
     std::string ext = getFileExtension(path);
-    if (mimeTypes.count(ext)) return mimeTypes[ext];
+    // lookups run on the thread pool too, so the map is only read
+    if (const auto it = mimeTypes.find(ext); it != mimeTypes.end()) return it->second;
     return "application/octet-stream";
 }
+
+
+std::string RequestHandler::createETag(const struct stat &fileStat) {
+    char etag[64];
+    snprintf(etag, sizeof(etag), "\"%llx-%llx-%llx\"", static_cast<unsigned long long>(fileStat.st_ino),
+             static_cast<unsigned long long>(fileStat.st_size), static_cast<unsigned long long>(fileStat.st_mtime));
+    return etag;
+}
+
+std::string RequestHandler::formatHttpDate(const time_t time) {
+    std::tm tm{};
+    gmtime_r(&time, &tm);
+    char buffer[64];
+    std::strftime(buffer, sizeof(buffer), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+    return buffer;
+}
+
+std::optional<time_t> RequestHandler::parseHttpDate(const std::string &date) {
+    std::tm tm{};
+    const char *end = strptime(date.c_str(), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+    if (end == nullptr || *end != '\0')
+        return std::nullopt;
+    return timegm(&tm);
+}
+static std::optional<off_t> parseBytePosition(const std::string &value) {
+    // 18 digits always fit into off_t
+    if (value.empty() || value.size() > 18 || value.find_first_not_of("0123456789") != std::string::npos)
+        return std::nullopt;
+    return static_cast<off_t>(std::stoll(value));
+}
+
+std::optional<std::vector<ByteRange> > RequestHandler::parseRange(const std::string &header, const off_t fileSize) {
+    if (header.rfind("bytes=", 0) != 0)
+        return std::nullopt;
+
+    std::vector<ByteRange> ranges;
+    std::stringstream stream(header.substr(6));
+    std::string spec;
+    while (std::getline(stream, spec, ',')) {
+        spec.erase(0, spec.find_first_not_of(" \t"));
+        spec.erase(spec.find_last_not_of(" \t") + 1);
+        if (spec.empty())
+            continue;
+
+        const size_t dash = spec.find('-');
+        if (dash == std::string::npos)
+            return std::nullopt;
+
+        // suffix range, the last n bytes of the file
+        if (dash == 0) {
+            const auto suffix = parseBytePosition(spec.substr(1));
+            if (!suffix.has_value())
+                return std::nullopt;
+            if (suffix.value() > 0 && fileSize > 0)
+                ranges.push_back({std::max<off_t>(0, fileSize - suffix.value()), fileSize - 1});
+            continue;
+        }
+
+        const auto first = parseBytePosition(spec.substr(0, dash));
+        if (!first.has_value())
+            return std::nullopt;
+        off_t last = fileSize - 1;
+        if (dash + 1 < spec.size()) {
+            const auto parsedLast = parseBytePosition(spec.substr(dash + 1));
+            if (!parsedLast.has_value() || parsedLast.value() < first.value())
+                return std::nullopt;
+            last = std::min(last, parsedLast.value());
+        }
+        if (first.value() < fileSize)
+            ranges.push_back({first.value(), last});
+    }
+
+    // overlapping ranges are merged, so a client can't make us send the same bytes over and over
+    std::sort(ranges.begin(), ranges.end(), [](const ByteRange &a, const ByteRange &b) {
+        return a.first < b.first;
+    });
+    std::vector<ByteRange> merged;
+    for (const auto &range: ranges) {
+        if (!merged.empty() && range.first <= merged.back().last + 1)
+            merged.back().last = std::max(merged.back().last, range.last);
+        else
+            merged.push_back(range);
+    }
+
+    if (merged.size() > MAX_BYTE_RANGES)
+        return std::nullopt;
+    return merged;
+}
+
+std::optional<ContentRange> RequestHandler::parseContentRange(const std::string &header) {
+    if (header.rfind("bytes ", 0) != 0)
+        return std::nullopt;
+
+    const size_t dash = header.find('-', 6);
+    const size_t slash = header.find('/', 6);
+    if (dash == std::string::npos || slash == std::string::npos || dash > slash)
+        return std::nullopt;
+
+    const auto first = parseBytePosition(header.substr(6, dash - 6));
+    const auto last = parseBytePosition(header.substr(dash + 1, slash - dash - 1));
+    const std::string totalValue = header.substr(slash + 1);
+    const auto total = totalValue == "*" ? std::optional<off_t>(-1) : parseBytePosition(totalValue);
+    if (!first.has_value() || !last.has_value() || !total.has_value() || last.value() < first.value())
+        return std::nullopt;
+    if (total.value() >= 0 && last.value() >= total.value())
+        return std::nullopt;
+    return ContentRange{first.value(), last.value(), total.value()};
+}
+
+std::string RequestHandler::getPartialUploadPath(const std::string &path) {
+    const std::filesystem::path target(path);
+    return (target.parent_path() / ("." + target.filename().string() + ".partial")).string();
+}
+
+bool RequestHandler::acceptsEncoding(const std::string &header, const std::string &encoding) {
+    std::stringstream stream(header);
+    std::string token;
+    bool wildcard = false;
+    while (std::getline(stream, token, ',')) {
+        const size_t semicolon = token.find(';');
+        std::string name = token.substr(0, semicolon);
+        name.erase(0, name.find_first_not_of(" \t"));
+        name.erase(name.find_last_not_of(" \t") + 1);
+        std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+
+        double quality = 1;
+        if (semicolon != std::string::npos) {
+            const size_t q = token.find("q=", semicolon);
+            if (q != std::string::npos)
+                quality = std::strtod(token.c_str() + q + 2, nullptr);
+        }
+
+        if (name == encoding)
+            return quality > 0;
+        if (name == "*")
+            wildcard = quality > 0;
+    }
+    return wildcard;
+}
@@ -0,0 +1,63 @@
+//
+// Created by Emil Ebert on 18.10.26.
+//
+
+#include "GzipEncoder.h"
+
+#include <common/Logger.h>
+
+// 15 window bits plus 16 makes zlib write a gzip header instead of a zlib one
+#define GZIP_WINDOW_BITS (15 + 16)
+#define GZIP_MEMORY_LEVEL 8
+
+GzipEncoder::GzipEncoder(const int level) {
+    if (deflateInit2(&stream, level, Z_DEFLATED, GZIP_WINDOW_BITS, GZIP_MEMORY_LEVEL, Z_DEFAULT_STRATEGY) != Z_OK) {
+        Logger::log(LogLevel::ERROR, "Failed to initialize gzip encoder");
+        return;
+    }
+    initialized = true;
+}
+
+GzipEncoder::~GzipEncoder() {
+    if (initialized)
+        deflateEnd(&stream);
+}
+
+std::string GzipEncoder::compress(const char *data, const size_t length, const bool flush) {
+    return deflateData(data, length, flush ? Z_SYNC_FLUSH : Z_NO_FLUSH);
+}
+
+std::string GzipEncoder::finish() {
+    return deflateData(nullptr, 0, Z_FINISH);
+}
+
+std::string GzipEncoder::compressAll(const std::string &data, const int level) {
+    GzipEncoder encoder(level);
+    if (!encoder.isValid())
+        return "";
+    std::string result = encoder.compress(data.data(), data.size());
+    result += encoder.finish();
+    return result;
+}
+
+std::string GzipEncoder::deflateData(const char *data, const size_t length, const int flush) {
+    std::string output;
+    if (!initialized)
+        return output;
+
+    char buffer[16384];
+    stream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data));
+    stream.avail_in = static_cast<uInt>(length);
+    int result;
+    do {
+        stream.next_out = reinterpret_cast<Bytef *>(buffer);
+        stream.avail_out = sizeof(buffer);
+        result = deflate(&stream, flush);
+        if (result == Z_STREAM_ERROR) {
+            Logger::log(LogLevel::ERROR, "Failed to compress response body");
+            break;
+        }
+        output.append(buffer, sizeof(buffer) - stream.avail_out);
+    } while (stream.avail_out == 0 || (flush == Z_FINISH && result != Z_STREAM_END));
+    return output;
+}
@@ -0,0 +1,45 @@
+//
+// Created by Emil Ebert on 18.10.26.
+//
+
+#ifndef GZIPENCODER_H
+#define GZIPENCODER_H
+
+#include <string>
+#include <zlib.h>
+
+// streaming gzip compression of a response body, fed chunk by chunk while the body is sent
+class GzipEncoder {
+private:
+    z_stream stream{};
+    bool initialized = false;
+
+public:
+    explicit GzipEncoder(int level);
+
+    GzipEncoder(const GzipEncoder &) = delete;
+
+    GzipEncoder &operator=(const GzipEncoder &) = delete;
+
+    ~GzipEncoder();
+
+    // returns the compressed data deflate produced so far, this can be empty.
+    // with flush everything given so far is returned, so a client can decode it before the body ends
+    std::string compress(const char *data, size_t length, bool flush = false);
+
+    // flushes the buffered data together with the gzip trailer
+    std::string finish();
+
+    [[nodiscard]] bool isValid() const { return initialized; }
+    [[nodiscard]] size_t getBytesIn() const { return stream.total_in; }
+    [[nodiscard]] size_t getBytesOut() const { return stream.total_out; }
+
+    // empty if the encoder could not be initialized
+    static std::string compressAll(const std::string &data, int level);
+
+private:
+    std::string deflateData(const char *data, size_t length, int flush);
+};
+
+
+#endif //GZIPENCODER_H
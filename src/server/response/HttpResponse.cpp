@@ -6,9 +6,12 @@
 #include <iostream>
 #include <utility>
 #include <parser/http/HttpParser.h>
+#include <unistd.h>
 
 #include "NotFoundImage.h"
 
+std::unordered_map<int, std::shared_ptr<const PrerenderedResponse> > HttpResponse::statusPages;
+
 HttpResponse::HttpResponse(const int statusCode)
     : statusCode(statusCode),
       chunkedEncoding(true) {
@@ -28,6 +31,8 @@ int HttpResponse::getStatus() const {
 
 void HttpResponse::setHeader(const std::string &name, const std::string &value) {
     headers[name] = value;
+    if (prerendered && name != "Connection")
+        lateHeaders[name] = value;
 }
 
 void HttpResponse::setBody(const std::string &body) {
@@ -43,6 +48,55 @@ void HttpResponse::enableChunkedEncoding(std::shared_ptr<SmartBuffer> body) {
     headers.erase("Content-Length");
 }
 
+void HttpResponse::setLengthDelimitedBody(std::shared_ptr<SmartBuffer> body, const size_t length) {
+    this->body = std::move(body);
+    chunkedEncoding = false;
+    headers.erase("Transfer-Encoding");
+    headers["Content-Length"] = std::to_string(length);
+}
+
+FileBody::FileBody(const int fd, std::vector<FileSegment> segments): fd(fd), segments(std::move(segments)) {
+}
+
+FileBody::~FileBody() {
+    if (fd >= 0)
+        close(fd);
+}
+
+void HttpResponse::setFileBody(const int fd, std::vector<FileSegment> segments) {
+    size_t length = 0;
+    for (const auto &segment: segments)
+        length += segment.prefix.size() + segment.length;
+
+    fileBody = std::make_shared<FileBody>(fd, std::move(segments));
+    chunkedEncoding = false;
+    headers.erase("Transfer-Encoding");
+    headers["Content-Length"] = std::to_string(length);
+}
+
+void HttpResponse::enableCompression(const int level) {
+    auto gzip = std::make_shared<GzipEncoder>(level);
+    if (!gzip->isValid())
+        return;
+
+    encoder = std::move(gzip);
+    chunkedEncoding = true;
+    headers["Transfer-Encoding"] = "chunked";
+    headers["Content-Encoding"] = "gzip";
+    headers.erase("Content-Length");
+    if (const auto it = headers.find("ETag"); it != headers.end() && it->second.rfind("W/", 0) != 0)
+        it->second = "W/" + it->second;
+}
+
+void HttpResponse::removeBody() {
+    bodyAllowed = false;
+    fileBody.reset();
+    encoder.reset();
+    chunkedEncoding = false;
+    headers.erase("Transfer-Encoding");
+    headers.erase("Content-Length");
+}
+
 bool HttpResponse::isChunkedEncoding() const {
     return chunkedEncoding;
 }
@@ -76,22 +130,29 @@ std::string HttpResponse::getStatusMessage(const int code) {
     switch (code) {
         case OK: return "OK";
         case CREATED: return "Created";
+        case ACCEPTED: return "Accepted";
         case NO_CONTENT: return "No Content";
+        case PARTIAL_CONTENT: return "Partial Content";
         case MOVED_PERMANENTLY: return "Moved Permanently";
         case FOUND: return "Found";
+        case NOT_MODIFIED: return "Not Modified";
         case BAD_REQUEST: return "Bad Request";
         case NOT_FOUND: return "Not Found";
         case REQUEST_TIMEOUT: return "Request Timeout";
         case CONTENT_TOO_LARGE: return "Content Too Large";
         case METHOD_NOT_ALLOWED: return "Method Not Allowed";
+        case RANGE_NOT_SATISFIABLE: return "Range Not Satisfiable";
         case INTERNAL_SERVER_ERROR: return "Internal Server Error";
         case REQUEST_URI_TOO_LONG: return "Request URI Too Long";
         case NOT_IMPLEMENTED: return "Not Implemented";
+        case BAD_GATEWAY: return "Bad Gateway";
+        case SERVICE_UNAVAILABLE: return "Service Unavailable";
         case FORBIDDEN: return "Forbidden";
         case CONFLICT: return "Conflict";
         case UNSUPPORTED_MEDIA_TYPE: return "Unsupported Media Type";
         case GATEWAY_TIMEOUT: return "Gateway Timeout";
         case HTTP_VERSION_NOT_SUPPORTED: return "HTTP Version Not Supported";
+        case INSUFFICIENT_STORAGE: return "Insufficient Storage";
         default: return "Unknown";
 
     }
@@ -99,6 +160,38 @@ std::string HttpResponse::getStatusMessage(const int code) {
 
 HttpResponse HttpResponse::html(const StatusCode statusCode, const std::string &bodyMessage) {
     HttpResponse response(statusCode);
+    response.setHeader("Content-Type", "text/html");
+    // the 404 page ignores the message, so it is always the same
+    if (bodyMessage.empty() || statusCode == NOT_FOUND) {
+        response.setPrerendered(getStatusPage(statusCode));
+        return response;
+    }
+    response.setBody(renderStatusPage(statusCode, bodyMessage));
+    return response;
+}
+
+void HttpResponse::prerenderStatusPages() {
+    static constexpr StatusCode errors[] = {
+        BAD_REQUEST, FORBIDDEN, NOT_FOUND, REQUEST_TIMEOUT, CONFLICT, CONTENT_TOO_LARGE, REQUEST_URI_TOO_LONG,
+        UNSUPPORTED_MEDIA_TYPE, METHOD_NOT_ALLOWED, RANGE_NOT_SATISFIABLE, INTERNAL_SERVER_ERROR, NOT_IMPLEMENTED,
+        BAD_GATEWAY, SERVICE_UNAVAILABLE, GATEWAY_TIMEOUT, HTTP_VERSION_NOT_SUPPORTED, INSUFFICIENT_STORAGE,
+    };
+    for (const StatusCode statusCode: errors)
+        getStatusPage(statusCode);
+}
+
+std::shared_ptr<const PrerenderedResponse> HttpResponse::getStatusPage(const int statusCode) {
+    if (const auto it = statusPages.find(statusCode); it != statusPages.end())
+        return it->second;
+
+    HttpResponse base(statusCode);
+    base.setHeader("Content-Type", "text/html");
+    auto page = base.prerenderCompressible(renderStatusPage(statusCode, ""));
+    statusPages[statusCode] = page;
+    return page;
+}
+
+std::string HttpResponse::renderStatusPage(const int statusCode, const std::string &bodyMessage) {
     std::stringstream ss;
     if (statusCode == NOT_FOUND)
         createNotFoundPage(ss);
@@ -108,13 +201,11 @@ HttpResponse HttpResponse::html(const StatusCode statusCode, const std::string &
                 "<title>" << statusCode << "</title>"
                 "</head>"
                 "<body>"
-                "<h1>" << statusCode << " " << response.statusMessage
+                "<h1>" << statusCode << " " << getStatusMessage(statusCode)
                 << (!bodyMessage.empty() ? (": " + bodyMessage) : "") << "</h1>"
                 "</body>"
                 "</html>";
-    response.setBody(ss.str());
-    response.setHeader("Content-Type", "text/html");
-    return response;
+    return ss.str();
 }
 
 void HttpResponse::createNotFoundPage(std::stringstream &ss) {
@@ -164,3 +255,41 @@ std::string HttpResponse::getHeader(const std::string &name) const {
 void HttpResponse::addSetCookie(const std::string &cookie) {
     setCookies.push_back(cookie);
 }
+
+std::shared_ptr<PrerenderedResponse> HttpResponse::prerender(std::string body) const {
+    auto result = std::make_shared<PrerenderedResponse>();
+    result->statusCode = statusCode;
+
+    std::stringstream head;
+    head << "HTTP/1.1 " << statusCode << " " << statusMessage << "\r\n";
+    for (const auto &[fst, snd]: headers) {
+        if (fst == "Transfer-Encoding" || fst == "Content-Length" || fst == "Connection")
+            continue;
+        head << fst << ": " << snd << "\r\n";
+    }
+    head << "Content-Length: " << body.size() << "\r\n";
+
+    result->head = head.str();
+    result->body = std::move(body);
+    return result;
+}
+
+std::shared_ptr<PrerenderedResponse> HttpResponse::prerenderCompressible(std::string body) const {
+    // rendered once, so it is worth the best compression
+    std::string compressed = GzipEncoder::compressAll(body, Z_BEST_COMPRESSION);
+    if (compressed.empty() || compressed.size() >= body.size())
+        return prerender(std::move(body));
+
+    HttpResponse variant = *this;
+    variant.setHeader("Vary", "Accept-Encoding");
+    auto result = variant.prerender(std::move(body));
+    variant.setHeader("Content-Encoding", "gzip");
+    result->gzipped = variant.prerender(std::move(compressed));
+    return result;
+}
+
+void HttpResponse::setPrerendered(std::shared_ptr<const PrerenderedResponse> prerendered) {
+    this->prerendered = std::move(prerendered);
+    if (this->prerendered)
+        statusCode = this->prerendered->statusCode;
+}
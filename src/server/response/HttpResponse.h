@@ -12,6 +12,42 @@
 #include <server/buffer/SmartBuffer.h>
 #include <memory>
 #include <vector>
+#include <server/response/GzipEncoder.h>
+
+// status line, headers and body rendered once, so cached responses can be sent without touching the disk.
+// head does not contain the Connection header and the empty line, those are added per connection
+struct PrerenderedResponse {
+    int statusCode;
+    std::string head;
+    std::string body;
+    // the same response with a gzip body, only status and error pages have one
+    std::shared_ptr<const PrerenderedResponse> gzipped;
+
+    [[nodiscard]] size_t size() const { return head.size() + body.size(); }
+};
+
+// part of a file body, prefix is sent right before the file data (used for the multipart/byteranges headers)
+struct FileSegment {
+    std::string prefix;
+    off_t offset;
+    size_t length;
+};
+
+// file body that is sent straight from the descriptor with sendfile, the fd is closed with the body
+struct FileBody {
+    int fd;
+    std::vector<FileSegment> segments;
+    size_t segmentIndex = 0;
+    size_t segmentSent = 0; // prefix and file bytes already sent of the current segment
+
+    FileBody(int fd, std::vector<FileSegment> segments);
+
+    FileBody(const FileBody &) = delete;
+
+    FileBody &operator=(const FileBody &) = delete;
+
+    ~FileBody();
+};
 
 class HttpResponse {
 private:
@@ -20,20 +56,35 @@ private:
     std::unordered_map<std::string, std::string> headers;
     std::shared_ptr<SmartBuffer> body;
     std::vector<std::string> setCookies;
-    bool chunkedEncoding;;
+    bool chunkedEncoding;
+    bool bodyAllowed = true;
+    std::shared_ptr<const PrerenderedResponse> prerendered;
+    std::shared_ptr<FileBody> fileBody;
+    std::shared_ptr<GzipEncoder> encoder;
+    // headers set after the response was prerendered, they are sent between its head and the Connection header
+    std::unordered_map<std::string, std::string> lateHeaders;
+
+    // built-in pages without a message by status code, rendered once
+    static std::unordered_map<int, std::shared_ptr<const PrerenderedResponse> > statusPages;
 
 public:
     // only used for chunked encoding, because there we have to send the header and body separately
     bool alreadySendHeader = false;
+    // progress of prerendered responses, they are sent with a single sendmsg when possible
+    size_t bytesSent = 0;
+    std::string prerenderedTail;
 
     static std::string getStatusMessage(int code);
 
     enum StatusCode {
         OK = 200,
         CREATED = 201,
+        ACCEPTED = 202,
         NO_CONTENT = 204,
+        PARTIAL_CONTENT = 206,
         MOVED_PERMANENTLY = 301,
         FOUND = 302,
+        NOT_MODIFIED = 304,
         BAD_REQUEST = 400,
         FORBIDDEN = 403,
         NOT_FOUND = 404,
@@ -43,10 +94,14 @@ public:
         REQUEST_URI_TOO_LONG = 414,
         UNSUPPORTED_MEDIA_TYPE = 415,
         METHOD_NOT_ALLOWED = 405,
+        RANGE_NOT_SATISFIABLE = 416,
         INTERNAL_SERVER_ERROR = 500,
         NOT_IMPLEMENTED = 501,
+        BAD_GATEWAY = 502,
+        SERVICE_UNAVAILABLE = 503,
         GATEWAY_TIMEOUT = 504,
         HTTP_VERSION_NOT_SUPPORTED = 505,
+        INSUFFICIENT_STORAGE = 507,
     };
 
     HttpResponse() = delete;
@@ -55,6 +110,11 @@ public:
 
     static HttpResponse html(StatusCode statusCode, const std::string &bodyMessage = "");
 
+    // renders the built-in pages of all error statuses, pages of other statuses are rendered on first use
+    static void prerenderStatusPages();
+
+    static std::shared_ptr<const PrerenderedResponse> getStatusPage(int statusCode);
+
     void setStatus(int code, const std::string &message = "");
 
     [[nodiscard]] int getStatus() const;
@@ -66,6 +126,24 @@ public:
     // this is only used for sending files
     void enableChunkedEncoding(std::shared_ptr<SmartBuffer> body);
 
+    // like enableChunkedEncoding, but the body is sent as is with a Content-Length known in advance
+    void setLengthDelimitedBody(std::shared_ptr<SmartBuffer> body, size_t length);
+
+    // sends the segments of fd without copying them through user space, uses Content-Length instead of chunks
+    void setFileBody(int fd, std::vector<FileSegment> segments);
+
+    [[nodiscard]] const std::shared_ptr<FileBody> &getFileBody() const { return fileBody; }
+
+    // compresses the chunked body while it is sent, the ETag becomes weak because the bytes differ from the file
+    void enableCompression(int level);
+
+    [[nodiscard]] const std::shared_ptr<GzipEncoder> &getEncoder() const { return encoder; }
+
+    // for responses like 304 that must not carry a body, only the header is sent
+    void removeBody();
+
+    [[nodiscard]] bool hasBody() const { return bodyAllowed; }
+
     [[nodiscard]] std::string toString() const;
 
     [[nodiscard]] std::string toHeaderString() const;
@@ -82,8 +160,24 @@ public:
 
     void addSetCookie(const std::string &cookie);
 
+    [[nodiscard]] const std::vector<std::string> &getSetCookies() const { return setCookies; }
+
+    // renders the current status and headers together with body, using Content-Length instead of chunked encoding
+    [[nodiscard]] std::shared_ptr<PrerenderedResponse> prerender(std::string body) const;
+
+    // like prerender, with a gzip variant if that makes the body smaller
+    [[nodiscard]] std::shared_ptr<PrerenderedResponse> prerenderCompressible(std::string body) const;
+
+    void setPrerendered(std::shared_ptr<const PrerenderedResponse> prerendered);
+
+    [[nodiscard]] const std::unordered_map<std::string, std::string> &getLateHeaders() const { return lateHeaders; }
+
+    [[nodiscard]] const std::shared_ptr<const PrerenderedResponse> &getPrerendered() const { return prerendered; }
+
 private:
     static void createNotFoundPage(std::stringstream &ss);
+
+    static std::string renderStatusPage(int statusCode, const std::string &bodyMessage);
 };
 
 
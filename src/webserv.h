@@ -18,6 +18,37 @@
 #define SERVER_NAME "webserv"
 #define TEMP_DIR_NAME ".tmp"
 #define SESSION_SAVE_FILE ".sessions.bin"
+#define MAX_BYTE_RANGES 16
+#define FILE_BODY_SEND_SIZE (256 * 1024)
+#define FASTCGI_KEEPALIVE_TIMEOUT 60
+#define FASTCGI_MAX_MULTIPLEXED 32
+#define CGI_MAX_HEADER_SIZE (64 * 1024)
+#define CGI_STREAM_BUFFER_SIZE (64 * 1024)
+// a streamed cgi body holds the watermark and one more read of the pipe or the worker before it is paused
+#define CGI_BODY_MEMORY_SIZE (CGI_STREAM_BUFFER_SIZE + 64 * 1024)
+#define CGI_CACHE_MEMORY_ENTRY_SIZE (64 * 1024)
+// seconds an abandoned cgi process gets after SIGTERM before it is killed
+#define CGI_KILL_TIMEOUT 5
+#define SYSTEM_STATS_INTERVAL_MS 1000
+#define SYSTEM_STATS_IDLE_TIMEOUT 30
+#define METRIC_STREAM_MAX_PENDING (32 * 1024)
+#define MULTIPART_MAX_HEADER_SIZE (16 * 1024)
+#define UPLOAD_CHUNK_SIZE (256 * 1024)
+#define AUTOINDEX_BATCH_SIZE 128
+// a batch ends early once its rows are this large, so it stays below the pending limit
+#define AUTOINDEX_BATCH_MAX_BYTES (32 * 1024)
+#define AUTOINDEX_MAX_PENDING (64 * 1024)
+// the pending limit and one more batch stay in memory
+#define AUTOINDEX_BODY_MEMORY_SIZE (AUTOINDEX_MAX_PENDING + 2 * AUTOINDEX_BATCH_MAX_BYTES)
+#define ERROR_PAGE_MAX_SIZE (1024 * 1024)
+// entries of the open file cache when it is only turned on for the static cache
+#define STATIC_CACHE_OPEN_FILES 1000
+#define BUFFER_SLICE_SIZE (16 * 1024)
+#define BUFFER_SLICE_POOL_SIZE 256
+#define BUFFER_MAX_IOVECS 64
+#define FILE_READ_SIZE (256 * 1024)
+// smallest mapping of the mmap spill backend, it doubles whenever it is full
+#define BUFFER_MMAP_MIN_SIZE (1024 * 1024)
 
 #if defined(__APPLE__)
 #ifndef MSG_NOSIGNAL
@@ -0,0 +1,5 @@
+#!/usr/bin/env python3
+
+print("Content-Type: text/plain")
+print()
+print("Hello from python")
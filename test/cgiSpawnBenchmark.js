@@ -0,0 +1,61 @@
+// measures how long cgi requests take while many idle keep-alive connections are open
+// usage: node cgiSpawnBenchmark.js [connections] [requests] [url]
+// the poll loop only watches 1024 fds at once, more idle connections would starve the measured requests
+const net = require('net');
+const http = require('http');
+
+const connections = parseInt(process.argv[2] || '1000');
+const requests = parseInt(process.argv[3] || '200');
+const url = new URL(process.argv[4] || 'http://127.0.0.1:8080/cgi/test.py');
+
+function openIdleConnection() {
+    return new Promise((resolve, reject) => {
+        const socket = net.connect(url.port, url.hostname, () => {
+            socket.write(`GET / HTTP/1.1\r\nHost: ${url.host}\r\nConnection: keep-alive\r\n\r\n`);
+        });
+        socket.once('data', () => resolve(socket));
+        socket.on('error', reject);
+    });
+}
+
+function timedRequest(agent) {
+    return new Promise((resolve, reject) => {
+        const start = process.hrtime.bigint();
+        http.get(url, {agent}, (response) => {
+            response.resume();
+            response.on('end', () => resolve(Number(process.hrtime.bigint() - start) / 1e6));
+        }).on('error', reject);
+    });
+}
+
+function percentile(sorted, p) {
+    return sorted[Math.min(sorted.length - 1, Math.floor(sorted.length * p))].toFixed(2);
+}
+
+async function main() {
+    const sockets = [];
+    for (let i = 0; i < connections; i += 100) {
+        const batch = [];
+        for (let j = i; j < Math.min(connections, i + 100); j++)
+            batch.push(openIdleConnection());
+        sockets.push(...await Promise.all(batch));
+    }
+    console.log(`${sockets.length} idle connections open`);
+
+    const agent = new http.Agent({keepAlive: false});
+    const times = [];
+    for (let i = 0; i < requests; i++)
+        times.push(await timedRequest(agent));
+    times.sort((a, b) => a - b);
+
+    const average = times.reduce((sum, time) => sum + time, 0) / times.length;
+    console.log(`${requests} requests to ${url.href}`);
+    console.log(`avg ${average.toFixed(2)} ms, p50 ${percentile(times, 0.5)} ms, p99 ${percentile(times, 0.99)} ms`);
+
+    sockets.forEach(socket => socket.destroy());
+}
+
+main().catch(error => {
+    console.error(error);
+    process.exit(1);
+});
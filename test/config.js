@@ -0,0 +1,20 @@
+const request = require('supertest');
+
+const url = 'http://localhost:8080';
+describe('config', function () {
+    // cgi_workers and cgi_cache_key start with cgi too, but only the cgi directive maps an extension to a script.
+    // the location in the test config names .txt in cgi_cache_key, so it would be run with /bin/false otherwise
+    it('cgi_cache_key does not add a cgi extension', async function () {
+        await request(url)
+            .get('/cgiparams/static.txt')
+            .expect(200)
+            .expect('static\n');
+    });
+
+    it('cgi_workers keeps the cgi extension', async function () {
+        await request(url)
+            .get('/cgiparams/hello.py')
+            .expect(200)
+            .expect('Hello from python\n');
+    });
+});
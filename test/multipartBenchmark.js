@@ -0,0 +1,88 @@
+// uploads a large multipart/form-data body and measures how long the server needs to store it
+// usage: node multipartBenchmark.js [megabytes] [files] [url]
+// the body is generated while it is sent, the upload location needs a client_max_body_size above the body size
+const http = require('http');
+const crypto = require('crypto');
+
+const megabytes = parseInt(process.argv[2] || '1024');
+const files = parseInt(process.argv[3] || '4');
+const url = new URL(process.argv[4] || 'http://127.0.0.1:8080/upload');
+
+const boundary = '----webservBenchmark' + crypto.randomBytes(8).toString('hex');
+const fileSize = Math.floor(megabytes * 1024 * 1024 / files);
+// random data with fragments of the delimiter in it, so the boundary search can't skip ahead all the time
+const block = crypto.randomBytes(1024 * 1024);
+for (let i = 0; i < block.length - 64; i += 4096)
+    block.write('\r\n--' + boundary.slice(0, i % boundary.length), i, 'latin1');
+
+function partHeader(index) {
+    return `--${boundary}\r\nContent-Disposition: form-data; name="file${index}"; ` +
+        `filename="benchmark_${index}.bin"\r\nContent-Type: application/octet-stream\r\n\r\n`;
+}
+
+function bodyLength() {
+    let length = Buffer.byteLength(`--${boundary}--\r\n`);
+    for (let i = 0; i < files; i++)
+        length += Buffer.byteLength(partHeader(i)) + fileSize + 2;
+    return length;
+}
+
+async function writeBody(request) {
+    const write = (data) => new Promise(resolve => {
+        if (request.write(data))
+            resolve();
+        else
+            request.once('drain', resolve);
+    });
+
+    for (let i = 0; i < files; i++) {
+        await write(partHeader(i));
+        for (let sent = 0; sent < fileSize; sent += block.length)
+            await write(block.subarray(0, Math.min(block.length, fileSize - sent)));
+        await write('\r\n');
+    }
+    request.end(`--${boundary}--\r\n`);
+}
+
+function upload() {
+    return new Promise((resolve, reject) => {
+        const start = process.hrtime.bigint();
+        let uploaded = 0n;
+        const request = http.request(url, {
+            method: 'POST',
+            headers: {
+                'Content-Type': `multipart/form-data; boundary=${boundary}`,
+                'Content-Length': bodyLength(),
+            },
+        }, (response) => {
+            let body = '';
+            response.on('data', chunk => body += chunk);
+            response.on('end', () => {
+                const end = process.hrtime.bigint();
+                resolve({status: response.statusCode, body, uploadMs: Number(uploaded - start) / 1e6,
+                    totalMs: Number(end - start) / 1e6});
+            });
+        });
+        request.on('error', reject);
+        request.on('finish', () => uploaded = process.hrtime.bigint());
+        writeBody(request).catch(reject);
+    });
+}
+
+async function main() {
+    const length = bodyLength();
+    console.log(`uploading ${(length / 1024 / 1024).toFixed(0)} MB in ${files} file(s) to ${url.href}`);
+    const result = await upload();
+    if (result.status !== 201)
+        throw new Error(`unexpected status ${result.status}: ${result.body}`);
+
+    const processingMs = result.totalMs - result.uploadMs;
+    console.log(`sent in ${result.uploadMs.toFixed(0)} ms, answered after ${result.totalMs.toFixed(0)} ms`);
+    console.log(`${(length / 1024 / 1024 / (result.totalMs / 1000)).toFixed(1)} MB/s overall, ` +
+        `${processingMs.toFixed(0)} ms spent parsing after the body arrived`);
+}
+
+main().catch(error => {
+    console.error(error);
+    process.exit(1);
+});
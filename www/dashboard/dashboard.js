@@ -187,17 +187,19 @@ const uptimeChart = new Chart(uptimeCtx, {
     options: chartOptions.options
 });
 
+// webserv metrics are pushed by the server whenever its metrics window rolls
+let json2 = null;
+const metricStream = new EventSource('http://api.localhost:8080/metrics/stream');
+metricStream.onmessage = (event) => {
+  json2 = JSON.parse(event.data);
+};
+
 async function fetchMetrics() {
+  if (!json2)
+    return;
   try {
-    const [res1, res2] = await Promise.all([
-      fetch('/cgi/metrics.py'),
-      fetch('http://api.localhost:8080/metrics')
-    ]);
-
-    const [json1, json2] = await Promise.all([
-      res1.json(),
-      res2.json()
-    ]);
+    const res1 = await fetch('http://api.localhost:8080/system');
+    const json1 = await res1.json();
 
     // shift old, push new
     cpuChart.data.datasets[0].data.shift();